@@ -22,6 +22,7 @@
 #include "../helper/matlab_types.h"
 
 #include<fstream>
+#include<vector>
 
 
 template<typename T>
@@ -40,11 +41,26 @@ inline void readString(std::istream& stream, std::string& value, std::size_t len
 }
 
 
+// format flag 4: dir, list and string lengths are uint64
+static bool wideCounts = false;
+
+inline uint64_t readCount(std::istream& stream)
+{
+	if(wideCounts)
+	{
+		uint64_t count;
+		readBinStream<uint64_t>(stream, &count);
+		return count;
+	}
+	uint32_t count;
+	readBinStream<uint32_t>(stream, &count);
+	return count;
+}
+
+
 inline void readBinStream(std::istream& stream, std::string& value)
 {
-	uint32_t length;
-	readBinStream<uint32_t>(stream, &length);
-	readString(stream, value, length);
+	readString(stream, value, static_cast<std::size_t>(readCount(stream)));
 }
 
 inline std::string readBinSting(std::istream& stream)
@@ -98,11 +114,10 @@ mxArray* readDir(std::istream& stream)
 
 	// TODO: remove leak when exception
 
-	// read dir elements
-	const uint32_t dirLength = readBinStream<uint32_t>(stream);
+	// read dir elements (no reserve, the count is not trusted before the elements are read)
+	const uint64_t dirLength = readCount(stream);
 	std::vector<NameAndMxArray> nameAndArray;
-	nameAndArray.reserve(dirLength);
-	for(uint32_t i = 0; i < dirLength; ++i)
+	for(uint64_t i = 0; i < dirLength && stream.good(); ++i)
 	{
 		NameAndMxArray data;
 		data.name  = readBinSting(stream);
@@ -113,7 +128,7 @@ mxArray* readDir(std::istream& stream)
 
 	// extract names
 	std::vector<const char*> namePtrList;
-	namePtrList .reserve(dirLength);
+	namePtrList .reserve(nameAndArray.size());
 	for(const NameAndMxArray& item : nameAndArray)
 		namePtrList .push_back(item.name.data());
 
@@ -127,11 +142,15 @@ mxArray* readDir(std::istream& stream)
 
 mxArray* readList(std::istream& stream)
 {
-	const uint32_t dirLength = readBinStream<uint32_t>(stream);
+	// the cell is created after reading the elements, the count is not trusted
+	const uint64_t listLength = readCount(stream);
+	std::vector<mxArray*> elements;
+	for(uint64_t i = 0; i < listLength && stream.good(); ++i)
+		elements.push_back(readNode(stream));
 
-	mxArray* mxarr = mxCreateCellMatrix(1, dirLength);
-	for(uint32_t i = 0; i<dirLength; ++i)
-		mxSetCell(mxarr, i, readNode(stream));
+	mxArray* mxarr = mxCreateCellMatrix(1, elements.size());
+	for(std::size_t i = 0; i<elements.size(); ++i)
+		mxSetCell(mxarr, i, elements[i]);
 
 	return mxarr;
 }
@@ -152,23 +171,86 @@ mxArray* readMat(std::istream& stream, uint32_t rows, uint32_t cols)
 		return nullptr;
 
 	T* matlabPtr = reinterpret_cast<T*>(mxGetPr(matlabMat));
-	readBinStream(stream, matlabPtr, rows*cols);
+	readBinStream(stream, matlabPtr, static_cast<std::size_t>(rows)*cols);
 
 	transposeMatlabMatrix<T>(matlabMat);
 	return matlabMat;
 }
 
 
+// mat with more than 2 dims, sizes in row-major order (channels as last dimension)
+template<typename T>
+mxArray* readMat(std::istream& stream, const std::vector<mwSize>& sizes)
+{
+	std::size_t numElements = 1;
+	for(mwSize size : sizes)
+		numElements *= size;
+
+	// the payload is read in one piece and reordered from row-major to column-major
+	std::vector<T> buffer(numElements);
+	readBinStream(stream, buffer.data(), numElements);
+
+	mxArray* matlabMat = mxCreateNumericArray(sizes.size(), sizes.data(), MatlabType<T>::classID, mxREAL);
+	if(!matlabMat)
+		return nullptr;
+
+	T* matlabPtr = reinterpret_cast<T*>(mxGetData(matlabMat));
+	std::vector<mwSize> index(sizes.size(), 0);
+	std::vector<std::size_t> colMajorStep(sizes.size(), 1);
+	for(std::size_t i = 1; i < sizes.size(); ++i)
+		colMajorStep[i] = colMajorStep[i-1]*sizes[i-1];
+
+	std::size_t pos = 0;
+	for(const T& value : buffer)
+	{
+		matlabPtr[pos] = value;
+		for(std::size_t d = sizes.size(); d-- > 0;)                // next row-major index
+		{
+			pos += colMajorStep[d];
+			if(++index[d] < sizes[d])
+				break;
+			pos -= colMajorStep[d]*sizes[d];
+			index[d] = 0;
+		}
+	}
+	return matlabMat;
+}
+
+
 mxArray* readMat(std::istream& stream)
 {
 	const uint32_t type     = readBinStream<uint32_t>(stream);
-	/*const uint32_t channels =*/ readBinStream<uint32_t>(stream);
+	const uint32_t channels = readBinStream<uint32_t>(stream);
 	const uint32_t rows     = readBinStream<uint32_t>(stream);
 	const uint32_t cols     = readBinStream<uint32_t>(stream);
+	const uint32_t dims     = readBinStream<uint32_t>(stream) >> 24;    // 0 for 2d mats (format flag 8)
 	                          readBinStream<uint32_t>(stream);
 	                          readBinStream<uint32_t>(stream);
 	                          readBinStream<uint32_t>(stream);
-	                          readBinStream<uint32_t>(stream);
+
+	if(dims > 2)
+	{
+		std::vector<mwSize> sizes = { rows, cols };
+		for(uint32_t i = 2; i < dims; ++i)
+			sizes.push_back(readBinStream<uint32_t>(stream));
+		if(channels > 1)
+			sizes.push_back(channels);
+
+		switch(type)
+		{
+			case 0: return readMat<uint8_t >(stream, sizes);
+			case 2: return readMat<uint16_t>(stream, sizes);
+			case 7: return readMat<uint32_t>(stream, sizes);
+			case 1: return readMat<int8_t  >(stream, sizes);
+			case 3: return readMat<int16_t >(stream, sizes);
+			case 4: return readMat<int32_t >(stream, sizes);
+			case 5: return readMat<float   >(stream, sizes);
+			case 6: return readMat<double  >(stream, sizes);
+			default:
+				mexWarnMsgIdAndTxt("MexParsing", "unknown matrix data type %d\n", type);
+				return nullptr;
+		}
+	}
 
 	switch(type)
 	{
@@ -233,13 +315,22 @@ void mexFunction(int            nlhs  ,
 		}
 
 	    uint32_t version = readBinStream<uint32_t>(stream);
-		if(version != 1)
+		if(version != 1 && version != 2)
 		{
 			mexErrMsgIdAndTxt("MATLAB:mexcpp:nargin", "wrong bin format version %d", version);
 			return;
 		}
 
-	                       readBinStream<uint32_t>(stream);
+		// version 2: format flags, the trailing index (flag 1) is not needed for reading, flag 4 selects 64 bit lengths,
+		// flag 8 allows mats with more than 2 dims, compressed mats (flag 2) are not supported
+		uint32_t flags = readBinStream<uint32_t>(stream);
+		if(version == 2 && (flags & ~13u) != 0)
+		{
+			mexErrMsgIdAndTxt("MATLAB:mexcpp:nargin", "unsupported bin format flags %d", flags);
+			return;
+		}
+		wideCounts = version == 2 && (flags & 4u) != 0;
+
 	                       readBinStream<uint32_t>(stream);
 	                       readBinStream<uint32_t>(stream);
 	                       readBinStream<uint32_t>(stream);
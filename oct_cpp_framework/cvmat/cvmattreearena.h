@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2018 Kay Gawlik <kaydev@amarunet.de> <kay.gawlik@beuth-hochschule.de> <kay.gawlik@charite.de>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <memory_resource>
+#include <type_traits>
+#include <vector>
+#include <utility>
+
+
+namespace CppFW
+{
+	// monotonic memory for all nodes of a CVMatTree (opt in, see CVMatTree(CVMatTreeArena&))
+	// objects are not freed individually, the memory is released in one step with the arena
+	// destructors are only called for objects that hold external resources
+	// the arena must outlive the trees and is not thread safe
+	class CVMatTreeArena
+	{
+	public:
+		explicit CVMatTreeArena(std::size_t initialSize = 64*1024) : memory(initialSize) {}
+		~CVMatTreeArena();
+
+		CVMatTreeArena(const CVMatTreeArena&)            = delete;
+		CVMatTreeArena& operator=(const CVMatTreeArena&) = delete;
+
+		std::pmr::memory_resource* getResource()                 { return &memory; }
+
+		// constructs an object in the arena, the destructor is called when the arena is destroyed
+		template<typename T, typename... Args>
+		T* create(Args&&... args)
+		{
+			if constexpr(std::is_trivially_destructible<T>::value)
+				return createUnmanaged<T>(std::forward<Args>(args)...);
+
+			destructors.emplace_back(nullptr, &destroy<T>);        // reserve first, construction is the last step which can throw
+			try
+			{
+				T* obj = createUnmanaged<T>(std::forward<Args>(args)...);
+				destructors.back().first = obj;
+				return obj;
+			}
+			catch(...)
+			{
+				destructors.pop_back();
+				throw;
+			}
+		}
+
+		// constructs an object in the arena without calling its destructor (see addDestructor)
+		template<typename T, typename... Args>
+		T* createUnmanaged(Args&&... args)
+		{
+			void* ptr = memory.allocate(sizeof(T), alignof(T));
+			return new(ptr) T(std::forward<Args>(args)...);
+		}
+
+		template<typename T>
+		void addDestructor(T* obj)                               { destructors.emplace_back(obj, &destroy<T>); }
+
+	private:
+		typedef void (*Destructor)(void*);
+
+		template<typename T>
+		static void destroy(void* obj)                           { static_cast<T*>(obj)->~T(); }
+
+		std::pmr::monotonic_buffer_resource    memory;
+		std::vector<std::pair<void*, Destructor>> destructors;
+	};
+
+}
@@ -0,0 +1,143 @@
+/*
+ * Copyright (c) 2018 Kay Gawlik <kaydev@amarunet.de> <kay.gawlik@beuth-hochschule.de> <kay.gawlik@charite.de>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cvmattreedir.h"
+
+#include <algorithm>
+
+
+namespace CppFW
+{
+
+	CVMatTreeDir::CVMatTreeDir(std::pmr::memory_resource* resource)
+	: entries(resource)
+	, slots  (resource)
+	{
+	}
+
+	template<typename Equal>
+	std::size_t CVMatTreeDir::findEntry(std::size_t hash, Equal equal) const
+	{
+		if(slots.empty())
+		{
+			for(std::size_t i = 0; i < entries.size(); ++i)
+				if(equal(entries[i].first))
+					return i;
+			return entries.size();
+		}
+
+		const std::size_t mask = slots.size() - 1;
+		for(std::size_t pos = hash & mask; slots[pos] != 0; pos = (pos + 1) & mask)
+		{
+			const std::size_t index = slots[pos] - 1;
+			if(equal(entries[index].first))
+				return index;
+		}
+		return entries.size();
+	}
+
+	std::size_t CVMatTreeDir::findEntry(std::string_view name) const
+	{
+		const std::size_t hash = CVMatTreeKey::hashName(name);
+		return findEntry(hash, [hash, name](const CVMatTreeKey& key) { return key.hash() == hash && key == name; });
+	}
+
+	std::size_t CVMatTreeDir::findEntry(const CVMatTreeKey& name) const
+	{
+		return findEntry(name.hash(), [&name](const CVMatTreeKey& key) { return key == name; });
+	}
+
+	CVMatTreeDir::const_iterator CVMatTreeDir::find(std::string_view name) const
+	{
+		return entries.begin() + static_cast<std::ptrdiff_t>(findEntry(name));
+	}
+
+	CVMatTreeDir::const_iterator CVMatTreeDir::find(const CVMatTreeKey& name) const
+	{
+		return entries.begin() + static_cast<std::ptrdiff_t>(findEntry(name));
+	}
+
+	std::pair<CVMatTreeDir::const_iterator, bool> CVMatTreeDir::emplace(std::string_view name, CVMatTree* node)
+	{
+		const std::size_t index = findEntry(name);
+		if(index < entries.size())
+			return std::make_pair(entries.begin() + static_cast<std::ptrdiff_t>(index), false);
+		return insertEntry(CVMatTreeKey(name), node);
+	}
+
+	std::pair<CVMatTreeDir::const_iterator, bool> CVMatTreeDir::emplace(const CVMatTreeKey& name, CVMatTree* node)
+	{
+		const std::size_t index = findEntry(name);
+		if(index < entries.size())
+			return std::make_pair(entries.begin() + static_cast<std::ptrdiff_t>(index), false);
+		return insertEntry(name, node);
+	}
+
+	std::pair<CVMatTreeDir::const_iterator, bool> CVMatTreeDir::insertEntry(CVMatTreeKey name, CVMatTree* node)
+	{
+		entries.emplace_back(std::move(name), node);
+		try
+		{
+			if(entries.size() > maxLinearSearch)
+			{
+				if(slots.size() < entries.size()*2)                  // load factor <= 0.5
+					rehash(std::max<std::size_t>(32, slots.size()*2));
+				else
+					insertSlot(entries.size() - 1);
+			}
+		}
+		catch(...)
+		{
+			entries.pop_back();
+			throw;
+		}
+		return std::make_pair(entries.end() - 1, true);
+	}
+
+	void CVMatTreeDir::clear()
+	{
+		entries.clear();
+		slots  .clear();
+	}
+
+	void CVMatTreeDir::insertSlot(std::size_t entryIndex)
+	{
+		const std::size_t mask = slots.size() - 1;
+		std::size_t pos = entries[entryIndex].first.hash() & mask;
+		while(slots[pos] != 0)
+			pos = (pos + 1) & mask;
+		slots[pos] = static_cast<uint32_t>(entryIndex + 1);
+	}
+
+	void CVMatTreeDir::rehash(std::size_t numSlots)
+	{
+		slots.assign(numSlots, 0);
+		for(std::size_t i = 0; i < entries.size(); ++i)
+			insertSlot(i);
+	}
+
+	std::vector<const CVMatTreeDir::Entry*> CVMatTreeDir::sorted() const
+	{
+		std::vector<const Entry*> result;
+		result.reserve(entries.size());
+		for(const Entry& entry : entries)
+			result.push_back(&entry);
+		std::sort(result.begin(), result.end(), [](const Entry* a, const Entry* b) { return a->first < b->first; });
+		return result;
+	}
+
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2018 Kay Gawlik <kaydev@amarunet.de> <kay.gawlik@beuth-hochschule.de> <kay.gawlik@charite.de>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include <cstdint>
+
+#include "cvmattreekey.h"
+
+
+namespace CppFW
+{
+	class CVMatTree;
+
+	// flat storage of the subnodes of a dir node
+	// entries are stored and iterated in insertion order, sorted() returns them ordered by name
+	// the iteration order depends on how the tree was built, sorted() is deterministic (CVMatTreeStructBin::writeBin uses it, see WriteOptions::insertionOrder)
+	// names are interned (CVMatTreeKey), lookup with a key compares pointers, lookup with a string_view compares hash and name
+	// small dirs are searched linear, bigger dirs use an open addressing hash table
+	class CVMatTreeDir
+	{
+	public:
+		typedef std::pair<CVMatTreeKey, CVMatTree*>      Entry;
+		typedef std::pmr::vector<Entry>::const_iterator  const_iterator;
+		typedef const_iterator                           iterator;
+
+		explicit CVMatTreeDir(std::pmr::memory_resource* resource = std::pmr::get_default_resource());
+
+		const_iterator begin() const                             { return entries.begin(); }
+		const_iterator end  () const                             { return entries.end  (); }
+		std::size_t    size () const                             { return entries.size (); }
+		bool           empty() const                             { return entries.empty(); }
+
+		const_iterator find(std::string_view    name) const;
+		const_iterator find(const CVMatTreeKey& name) const;
+		std::pair<const_iterator, bool> emplace(std::string_view    name, CVMatTree* node);
+		std::pair<const_iterator, bool> emplace(const CVMatTreeKey& name, CVMatTree* node);
+		void clear();
+
+		std::vector<const Entry*> sorted() const;
+
+	private:
+		static constexpr std::size_t maxLinearSearch = 8;
+
+		std::pmr::vector<Entry>    entries;
+		std::pmr::vector<uint32_t> slots;                           // index+1 in entries, 0 = empty slot, size is 0 or a power of two
+
+		template<typename Equal>
+		std::size_t findEntry(std::size_t hash, Equal equal) const;
+		std::size_t findEntry(std::string_view    name) const;
+		std::size_t findEntry(const CVMatTreeKey& name) const;
+		std::pair<const_iterator, bool> insertEntry(CVMatTreeKey name, CVMatTree* node);   // name is not in the dir
+		void        insertSlot(std::size_t entryIndex);
+		void        rehash(std::size_t numSlots);
+	};
+
+}
@@ -87,7 +87,7 @@ namespace CppFW
 		{
 			if(tree)
 			{
-				const CVMatTree* node = tree->getDirNodeOpt(name.c_str());
+				const CVMatTree* node = tree->getDirNodeOpt(name);
 				if(node)
 					setValue(*node, value);
 			}
@@ -97,7 +97,7 @@ namespace CppFW
 		GetFromCVMatTree subSet(const std::string& name)
 		{
 			if(tree)
-				return GetFromCVMatTree(tree->getDirNodeOpt(name.c_str()));
+				return GetFromCVMatTree(tree->getDirNodeOpt(name));
 			return GetFromCVMatTree(nullptr);
 		}
 
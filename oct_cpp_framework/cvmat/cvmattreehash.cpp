@@ -0,0 +1,178 @@
+/*
+ * Copyright (c) 2018 Kay Gawlik <kaydev@amarunet.de> <kay.gawlik@beuth-hochschule.de> <kay.gawlik@charite.de>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cvmattreehash.h"
+
+#include <cstring>
+
+
+namespace
+{
+	const uint64_t prime1 = 11400714785074694791ULL;
+	const uint64_t prime2 = 14029467366897019727ULL;
+	const uint64_t prime3 =  1609587929392839161ULL;
+	const uint64_t prime4 =  9650029242287828579ULL;
+	const uint64_t prime5 =  2870177450012600261ULL;
+
+	inline uint64_t rotl(uint64_t x, int r)
+	{
+		return (x << r) | (x >> (64 - r));
+	}
+
+	// little endian loads, memcpy because the data is not necessarily aligned
+	inline uint64_t read64(const uint8_t* p)
+	{
+		uint64_t v;
+		std::memcpy(&v, p, sizeof(v));
+		return v;
+	}
+
+	inline uint32_t read32(const uint8_t* p)
+	{
+		uint32_t v;
+		std::memcpy(&v, p, sizeof(v));
+		return v;
+	}
+
+	inline uint64_t round(uint64_t acc, uint64_t input)
+	{
+		acc += input*prime2;
+		acc  = rotl(acc, 31);
+		return acc*prime1;
+	}
+
+	inline uint64_t mergeRound(uint64_t acc, uint64_t val)
+	{
+		acc ^= round(0, val);
+		return acc*prime1 + prime4;
+	}
+
+	inline const uint8_t* processStripes(uint64_t* acc, const uint8_t* p, const uint8_t* end)
+	{
+		uint64_t v1 = acc[0];
+		uint64_t v2 = acc[1];
+		uint64_t v3 = acc[2];
+		uint64_t v4 = acc[3];
+		for(; p + 32 <= end; p += 32)
+		{
+			v1 = round(v1, read64(p     ));
+			v2 = round(v2, read64(p +  8));
+			v3 = round(v3, read64(p + 16));
+			v4 = round(v4, read64(p + 24));
+		}
+		acc[0] = v1;
+		acc[1] = v2;
+		acc[2] = v3;
+		acc[3] = v4;
+		return p;
+	}
+}
+
+
+namespace CppFW
+{
+
+	CVMatTreeHash::CVMatTreeHash(uint64_t seed)
+	: seed(seed)
+	{
+		acc[0] = seed + prime1 + prime2;
+		acc[1] = seed + prime2;
+		acc[2] = seed;
+		acc[3] = seed - prime1;
+	}
+
+	void CVMatTreeHash::update(const void* data, std::size_t length)
+	{
+		const uint8_t* p   = static_cast<const uint8_t*>(data);
+		const uint8_t* end = p + length;
+		totalLength += length;
+
+		if(bufferSize + length < sizeof(buffer))
+		{
+			if(length > 0)
+				std::memcpy(buffer + bufferSize, p, length);
+			bufferSize += length;
+			return;
+		}
+
+		if(bufferSize > 0)
+		{
+			const std::size_t fill = sizeof(buffer) - bufferSize;
+			std::memcpy(buffer + bufferSize, p, fill);
+			processStripes(acc, buffer, buffer + sizeof(buffer));
+			p += fill;
+			bufferSize = 0;
+		}
+
+		p = processStripes(acc, p, end);
+
+		bufferSize = static_cast<std::size_t>(end - p);
+		if(bufferSize > 0)
+			std::memcpy(buffer, p, bufferSize);
+	}
+
+	uint64_t CVMatTreeHash::digest() const
+	{
+		uint64_t h;
+		if(totalLength >= 32)
+		{
+			h = rotl(acc[0], 1) + rotl(acc[1], 7) + rotl(acc[2], 12) + rotl(acc[3], 18);
+			h = mergeRound(h, acc[0]);
+			h = mergeRound(h, acc[1]);
+			h = mergeRound(h, acc[2]);
+			h = mergeRound(h, acc[3]);
+		}
+		else
+			h = seed + prime5;
+
+		h += totalLength;
+
+		const uint8_t* p   = buffer;
+		const uint8_t* end = buffer + bufferSize;
+		for(; p + 8 <= end; p += 8)
+		{
+			h ^= round(0, read64(p));
+			h  = rotl(h, 27)*prime1 + prime4;
+		}
+		if(p + 4 <= end)
+		{
+			h ^= static_cast<uint64_t>(read32(p))*prime1;
+			h  = rotl(h, 23)*prime2 + prime3;
+			p += 4;
+		}
+		for(; p < end; ++p)
+		{
+			h ^= (*p)*prime5;
+			h  = rotl(h, 11)*prime1;
+		}
+
+		h ^= h >> 33;
+		h *= prime2;
+		h ^= h >> 29;
+		h *= prime3;
+		h ^= h >> 32;
+		return h;
+	}
+
+	uint64_t CVMatTreeHash::hash(const void* data, std::size_t length, uint64_t seed)
+	{
+		CVMatTreeHash hasher(seed);
+		hasher.update(data, length);
+		return hasher.digest();
+	}
+
+}
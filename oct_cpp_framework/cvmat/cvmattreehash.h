@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2018 Kay Gawlik <kaydev@amarunet.de> <kay.gawlik@beuth-hochschule.de> <kay.gawlik@charite.de>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+
+namespace CppFW
+{
+	// streaming 64 bit hash (XXH64 algorithm), used for CVMatTree::contentHash()
+	class CVMatTreeHash
+	{
+	public:
+		explicit CVMatTreeHash(uint64_t seed = 0);
+
+		void update(const void* data, std::size_t length);
+
+		template<typename T>
+		void updateValue(T value)                                { update(&value, sizeof(T)); }
+
+		uint64_t digest() const;
+
+		static uint64_t hash(const void* data, std::size_t length, uint64_t seed = 0);
+
+	private:
+		uint64_t      acc[4];
+		uint8_t       buffer[32];
+		std::size_t   bufferSize  = 0;
+		uint64_t      totalLength = 0;
+		uint64_t      seed;
+	};
+
+}
@@ -0,0 +1,157 @@
+/*
+ * Copyright (c) 2018 Kay Gawlik <kaydev@amarunet.de> <kay.gawlik@beuth-hochschule.de> <kay.gawlik@charite.de>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cvmattreekey.h"
+
+#include <functional>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+
+
+namespace CppFW
+{
+
+	struct CVMatTreeKey::Pool
+	{
+		std::shared_mutex                                      mutex;
+		std::unordered_map<std::string_view, const Record*>    lookup;    // the view points into the record
+	};
+
+	CVMatTreeKey::Record::Record(std::string_view name, bool counted)
+	: str    (name)
+	, hash   (hashName(name))
+	, counted(counted)
+	, refs   (1)
+	{
+	}
+
+	CVMatTreeKey::CVMatTreeKey()
+	: record(emptyRecord())
+	{
+	}
+
+	CVMatTreeKey::CVMatTreeKey(std::string_view name)
+	: record(intern(name))
+	{
+	}
+
+	CVMatTreeKey::CVMatTreeKey(CVMatTreeKey&& other) noexcept
+	: record(other.record)
+	{
+		other.record = emptyRecord();
+	}
+
+	CVMatTreeKey& CVMatTreeKey::operator=(const CVMatTreeKey& other)
+	{
+		other.addRef();
+		release();
+		record = other.record;
+		return *this;
+	}
+
+	CVMatTreeKey& CVMatTreeKey::operator=(CVMatTreeKey&& other) noexcept
+	{
+		if(this != &other)
+		{
+			release();
+			record       = other.record;
+			other.record = emptyRecord();
+		}
+		return *this;
+	}
+
+	std::size_t CVMatTreeKey::hashName(std::string_view name)
+	{
+		return std::hash<std::string_view>()(name);
+	}
+
+	CVMatTreeKey::Pool& CVMatTreeKey::pool()
+	{
+		static Pool* pool = new Pool;                                // never destroyed, keys may be used during static destruction
+		return *pool;
+	}
+
+	std::size_t CVMatTreeKey::poolSize()
+	{
+		std::shared_lock<std::shared_mutex> lock(pool().mutex);
+		return pool().lookup.size();
+	}
+
+	const CVMatTreeKey::Record* CVMatTreeKey::emptyRecord()
+	{
+		static const Record* record = new Record(std::string_view(), false);   // never destroyed, as the pool
+		return record;
+	}
+
+	void CVMatTreeKey::release()
+	{
+		if(!record->counted)
+			return;
+
+		std::size_t refs = record->refs.load(std::memory_order_relaxed);
+		while(refs > 1)
+			if(record->refs.compare_exchange_weak(refs, refs - 1, std::memory_order_release, std::memory_order_relaxed))
+				return;
+
+		// possibly the last reference: intern can not hand out the record while the exclusive lock is held
+		std::unique_lock<std::shared_mutex> lock(pool().mutex);
+		if(record->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		{
+			pool().lookup.erase(record->str);
+			delete record;
+		}
+	}
+
+	const CVMatTreeKey::Record* CVMatTreeKey::intern(std::string_view name)
+	{
+		if(name.empty())
+			return emptyRecord();
+
+		Pool& namePool = pool();
+		{
+			std::shared_lock<std::shared_mutex> lock(namePool.mutex);
+			auto it = namePool.lookup.find(name);
+			if(it != namePool.lookup.end())
+			{
+				it->second->refs.fetch_add(1, std::memory_order_relaxed);
+				return it->second;
+			}
+		}
+
+		std::unique_lock<std::shared_mutex> lock(namePool.mutex);
+		auto it = namePool.lookup.find(name);
+		if(it != namePool.lookup.end())
+		{
+			it->second->refs.fetch_add(1, std::memory_order_relaxed);
+			return it->second;
+		}
+
+		const Record* record = new Record(name, true);
+		try
+		{
+			namePool.lookup.emplace(std::string_view(record->str), record);
+		}
+		catch(...)
+		{
+			delete record;
+			throw;
+		}
+		return record;
+	}
+
+}
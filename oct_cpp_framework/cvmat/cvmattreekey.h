@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2018 Kay Gawlik <kaydev@amarunet.de> <kay.gawlik@beuth-hochschule.de> <kay.gawlik@charite.de>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+
+namespace CppFW
+{
+	// interned name of a dir entry
+	// equal names share one string in a global pool, the key is a pointer to it (comparison is a pointer compare)
+	// the pool is thread safe, the names are reference counted and removed from the pool with the last key
+	class CVMatTreeKey
+	{
+	public:
+		CVMatTreeKey();                                            // empty name
+		explicit CVMatTreeKey(std::string_view name);
+		CVMatTreeKey(const CVMatTreeKey& other)                  : record(other.record) { addRef(); }
+		CVMatTreeKey(CVMatTreeKey&& other) noexcept;
+		~CVMatTreeKey()                                          { release(); }
+
+		CVMatTreeKey& operator=(const CVMatTreeKey& other);
+		CVMatTreeKey& operator=(CVMatTreeKey&& other) noexcept;
+
+		const std::string& str () const                          { return record->str ; }
+		std::size_t        hash() const                          { return record->hash; }
+		operator const std::string&() const                      { return record->str ; }
+
+		bool operator==(const CVMatTreeKey& other) const         { return record == other.record; }
+		bool operator!=(const CVMatTreeKey& other) const         { return record != other.record; }
+		bool operator< (const CVMatTreeKey& other) const         { return record->str < other.record->str; }
+
+		friend bool operator==(const CVMatTreeKey& key, std::string_view name) { return key.record->str == name; }
+		friend bool operator==(std::string_view name, const CVMatTreeKey& key) { return key.record->str == name; }
+		friend bool operator!=(const CVMatTreeKey& key, std::string_view name) { return key.record->str != name; }
+		friend bool operator!=(std::string_view name, const CVMatTreeKey& key) { return key.record->str != name; }
+
+		static std::size_t hashName(std::string_view name);
+		static std::size_t poolSize();                             // number of interned names
+
+	private:
+		struct Record
+		{
+			Record(std::string_view name, bool counted);
+
+			std::string                      str;
+			std::size_t                      hash;
+			bool                             counted;              // false for the empty name, which is never removed
+			mutable std::atomic<std::size_t> refs;
+		};
+
+		struct Pool;
+
+		const Record* record;
+
+		void addRef() const                                      { if(record->counted) record->refs.fetch_add(1, std::memory_order_relaxed); }
+		void release();
+
+		static Pool&         pool();
+		static const Record* emptyRecord();
+		static const Record* intern(std::string_view name);      // with a reference for the new key
+	};
+
+	inline std::ostream& operator<<(std::ostream& stream, const CVMatTreeKey& key) { return stream << key.str(); }
+
+}
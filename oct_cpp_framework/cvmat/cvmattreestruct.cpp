@@ -16,6 +16,8 @@
  */
 
 #include "cvmattreestruct.h"
+#include "cvmattreearena.h"
+#include "cvmattreehash.h"
 
 
 #include <fstream>
@@ -25,17 +27,22 @@
 
 #include <boost/lexical_cast.hpp>
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
 #include <stdexcept>
+#include <utility>
 
 namespace
 {
-	template<typename Type, typename IndexType, typename MapType>
-	Type& getAndInsert(const IndexType& id, MapType& map)
+	template<typename Type, typename IndexType, typename MapType, typename Creator, typename Deleter>
+	Type& getAndInsert(const IndexType& id, MapType& map, Creator create, Deleter remove)
 	{
 		typename MapType::iterator it = map.find(id);
 		if(it == map.end())
 		{
-			Type* type = new Type;
+			Type* type = create();
 			std::pair<typename MapType::iterator, bool> pit;
 			try
 			{
@@ -43,12 +50,12 @@ namespace
 			}
 			catch(...)
 			{
-				delete type;
+				remove(type);
 				throw;
 			}
 			if(pit.second == false)
 			{
-				delete type;
+				remove(type);
 				throw "SubstructureTemplate pit.second == false";
 			}
 			return *((pit.first)->second);
@@ -56,104 +63,469 @@ namespace
 		return *(it->second);
 	};
 	
-	bool matIsEqual(const cv::Mat mat1, const cv::Mat mat2) // http://dragonwood-blastevil.blogspot.de/2013/02/opencv-compare-whether-two-mat-is.html
+	// -0 is replaced by +0 because they are equal for operator==
+	template<typename Bits>
+	void hashFloatValues(CppFW::CVMatTreeHash& hash, const uint8_t* data, std::size_t n)
 	{
-		// treat two empty mat as identical as well
-		if(mat1.empty() && mat2.empty())
-			return true;
-		
-		// if dimensionality of two mat is not identical, these two mat is not identical
-		if(mat1.cols != mat2.cols || mat1.rows != mat2.rows || mat1.dims != mat2.dims || mat1.type() != mat2.type())
-			return false;
-			
-		cv::Mat diff;
-		cv::compare(mat1, mat2, diff, cv::CMP_NE);
-		int nz = cv::countNonZero(diff);
-		return nz == 0;
+		const Bits signBit = static_cast<Bits>(Bits(1) << (sizeof(Bits)*8 - 1));
+		Bits block[256];
+		for(std::size_t begin = 0; begin < n; begin += 256)
+		{
+			const std::size_t blockLength = std::min<std::size_t>(256, n - begin);
+			std::memcpy(block, data + begin*sizeof(Bits), blockLength*sizeof(Bits));
+			for(std::size_t i = 0; i < blockLength; ++i)
+				block[i] = block[i] == signBit ? 0 : block[i];
+			hash.update(block, blockLength*sizeof(Bits));
+		}
 	}
-	
-	template <typename Map>
-	bool map_compare_ptr(const Map& lhs, const Map& rhs)
+
+	void hashSpan(CppFW::CVMatTreeHash& hash, const uint8_t* data, std::size_t n, int depth)
 	{
-		if(lhs.size() != rhs.size())
-			return false;
-		typename Map::const_iterator lhsIt = lhs.begin();
-		typename Map::const_iterator rhsIt = rhs.begin();
-		for(std::size_t i=0; i<lhs.size(); ++i)
+		switch(depth)
 		{
-			if(lhsIt->first != rhsIt->first)
-				return false;
-			if(*(lhsIt->second) != *(rhsIt->second))
-				return false;
-			++lhsIt;
-			++rhsIt;
+			case CV_32F: hashFloatValues<uint32_t>(hash, data, n); break;
+			case CV_64F: hashFloatValues<uint64_t>(hash, data, n); break;
+			default:     hash.update(data, n*CV_ELEM_SIZE1(depth)); break;
 		}
-		return true;
 	}
 
-	template <typename Vec>
-	bool vector_compare_ptr(const Vec& lhs, const Vec& rhs)
+	void hashMat(CppFW::CVMatTreeHash& hash, const cv::Mat& mat)
 	{
-		if(lhs.size() != rhs.size())
-			return false;
-		typename Vec::const_iterator lhsIt = lhs.begin();
-		typename Vec::const_iterator rhsIt = rhs.begin();
-		for(std::size_t i=0; i<lhs.size(); ++i)
+		// all empty mats are equal
+		if(mat.empty())
+			return;
+
+		hash.updateValue(static_cast<int32_t>(mat.type()));
+		hash.updateValue(static_cast<int32_t>(mat.dims));
+		for(int i = 0; i < mat.dims; ++i)
+			hash.updateValue(static_cast<int32_t>(mat.size[i]));
+
+		const int depth = mat.depth();
+		if(mat.isContinuous())
+			hashSpan(hash, mat.ptr(), mat.total()*static_cast<std::size_t>(mat.channels()), depth);
+		else if(mat.dims > 2)
 		{
-			if(*(*lhsIt) != *(*rhsIt))
-				return false;
-			++lhsIt;
-			++rhsIt;
+			const cv::Mat continuous = mat.clone();
+			hashSpan(hash, continuous.ptr(), continuous.total()*static_cast<std::size_t>(continuous.channels()), depth);
+		}
+		else
+		{
+			const std::size_t rowValues = static_cast<std::size_t>(mat.cols)*static_cast<std::size_t>(mat.channels());
+			for(int r = 0; r < mat.rows; ++r)
+				hashSpan(hash, mat.ptr(r), rowValues, depth);
 		}
-		return true;
 	}
+
+	// compares trees without temporary mats and stops at the first difference
+	class TreeComparator
+	{
+		typedef CppFW::CVMatTree                 CVMatTree;
+		typedef CVMatTree::CompareOptions        Options;
+		typedef std::pair<const CVMatTree*, const CVMatTree*> NodePair;
+
+		static constexpr std::size_t blockSize         = 256;        // elements between the early exit checks
+		static constexpr std::size_t parallelBlockSize = 1 << 18;    // elements per parallel task of continuous mats
+
+		const Options&    options;
+		const bool        tolerant;
+		std::atomic<bool> different;
+
+		template<typename T>
+		static bool valuesEqual(const T* a, const T* b, std::size_t n)
+		{
+			for(std::size_t begin = 0; begin < n; begin += blockSize)
+			{
+				const std::size_t end = std::min(n, begin + blockSize);
+				bool equal = true;
+				for(std::size_t i = begin; i < end; ++i)
+					equal &= a[i] == b[i];
+				if(!equal)
+					return false;
+			}
+			return true;
+		}
+
+		template<typename T>
+		bool valuesClose(const T* a, const T* b, std::size_t n) const
+		{
+			for(std::size_t i = 0; i < n; ++i)
+			{
+				const T va = a[i];
+				const T vb = b[i];
+				if(va == vb)
+					continue;
+				if(std::isnan(va) || std::isnan(vb))
+				{
+					if(options.nanEqual && std::isnan(va) && std::isnan(vb))
+						continue;
+					return false;
+				}
+				const double diff = std::abs(static_cast<double>(va) - static_cast<double>(vb));
+				const double max  = std::max(std::abs(static_cast<double>(va)), std::abs(static_cast<double>(vb)));
+				if(!(diff <= options.absTolerance + options.relTolerance*max))
+					return false;
+			}
+			return true;
+		}
+
+		// n values of the depth of the mat
+		bool spanEqual(const uint8_t* a, const uint8_t* b, std::size_t n, int depth) const
+		{
+			switch(depth)
+			{
+				case CV_32F:
+					return tolerant ? valuesClose(reinterpret_cast<const float *>(a), reinterpret_cast<const float *>(b), n)
+					                : valuesEqual(reinterpret_cast<const float *>(a), reinterpret_cast<const float *>(b), n);
+				case CV_64F:
+					return tolerant ? valuesClose(reinterpret_cast<const double*>(a), reinterpret_cast<const double*>(b), n)
+					                : valuesEqual(reinterpret_cast<const double*>(a), reinterpret_cast<const double*>(b), n);
+				default:
+					return std::memcmp(a, b, n*CV_ELEM_SIZE1(depth)) == 0; // integer types: equal values have equal bytes
+			}
+		}
+
+		bool matEqual(const cv::Mat& mat1, const cv::Mat& mat2)
+		{
+			// treat two empty mat as identical as well
+			if(mat1.empty() && mat2.empty())
+				return true;
+
+			// if dimensionality of two mat is not identical, these two mat is not identical
+			if(mat1.dims != mat2.dims || mat1.type() != mat2.type() || mat1.size != mat2.size)
+				return false;
+
+			// the row loops below handle 2d mats only
+			if(mat1.dims > 2 && !(mat1.isContinuous() && mat2.isContinuous()))
+				return matEqual(mat1.isContinuous() ? mat1 : mat1.clone(), mat2.isContinuous() ? mat2 : mat2.clone());
+
+			const int         depth     = mat1.depth();
+			const std::size_t rowValues = static_cast<std::size_t>(mat1.cols)*static_cast<std::size_t>(mat1.channels());
+
+			if(mat1.isContinuous() && mat2.isContinuous())
+			{
+				const std::size_t n = mat1.total()*static_cast<std::size_t>(mat1.channels());
+				const std::size_t valueSize = CV_ELEM_SIZE1(depth);
+				if(!options.parallel || n <= parallelBlockSize)
+					return spanEqual(mat1.ptr(), mat2.ptr(), n, depth);
+
+				const int numBlocks = static_cast<int>((n + parallelBlockSize - 1)/parallelBlockSize);
+				cv::parallel_for_(cv::Range(0, numBlocks), [&](const cv::Range& range)
+				{
+					for(int i = range.start; i < range.end && !different; ++i)
+					{
+						const std::size_t begin = static_cast<std::size_t>(i)*parallelBlockSize;
+						const std::size_t end   = std::min(n, begin + parallelBlockSize);
+						if(!spanEqual(mat1.ptr() + begin*valueSize, mat2.ptr() + begin*valueSize, end - begin, depth))
+							different = true;
+					}
+				});
+				return !different;
+			}
+
+			if(!options.parallel || static_cast<std::size_t>(mat1.rows)*rowValues <= parallelBlockSize)
+			{
+				for(int r = 0; r < mat1.rows; ++r)
+					if(!spanEqual(mat1.ptr(r), mat2.ptr(r), rowValues, depth))
+						return false;
+				return true;
+			}
+
+			cv::parallel_for_(cv::Range(0, mat1.rows), [&](const cv::Range& range)
+			{
+				for(int r = range.start; r < range.end && !different; ++r)
+					if(!spanEqual(mat1.ptr(r), mat2.ptr(r), rowValues, depth))
+						different = true;
+			});
+			return !different;
+		}
+
+		bool subNodesEqual(const std::vector<NodePair>& nodes)
+		{
+			cv::parallel_for_(cv::Range(0, static_cast<int>(nodes.size())), [&](const cv::Range& range)
+			{
+				for(int i = range.start; i < range.end && !different; ++i)
+					if(!nodeEqual(*nodes[static_cast<std::size_t>(i)].first, *nodes[static_cast<std::size_t>(i)].second))
+						different = true;
+			});
+			return !different;
+		}
+
+		bool listEqual(const CVMatTree::NodeList& lhs, const CVMatTree::NodeList& rhs)
+		{
+			if(lhs.size() != rhs.size())
+				return false;
+
+			if(options.parallel && lhs.size() > 1)
+			{
+				std::vector<NodePair> nodes;
+				nodes.reserve(lhs.size());
+				for(std::size_t i = 0; i < lhs.size(); ++i)
+					nodes.emplace_back(lhs[i], rhs[i]);
+				return subNodesEqual(nodes);
+			}
+
+			for(std::size_t i = 0; i < lhs.size(); ++i)
+				if(!nodeEqual(*lhs[i], *rhs[i]))
+					return false;
+			return true;
+		}
+
+		bool dirEqual(const CVMatTree::NodeDir& lhs, const CVMatTree::NodeDir& rhs)
+		{
+			// the insertion order of the dirs may differ
+			if(lhs.size() != rhs.size())
+				return false;
+
+			std::vector<NodePair> nodes;
+			if(options.parallel)
+				nodes.reserve(lhs.size());
+
+			for(const CVMatTree::NodePair& entry : lhs)
+			{
+				CVMatTree::NodeDir::const_iterator rhsIt = rhs.find(entry.first);
+				if(rhsIt == rhs.end())
+					return false;
+				if(options.parallel)
+					nodes.emplace_back(entry.second, rhsIt->second);
+				else if(!nodeEqual(*entry.second, *rhsIt->second))
+					return false;
+			}
+
+			if(options.parallel && nodes.size() > 1)
+				return subNodesEqual(nodes);
+			return nodes.empty() || nodeEqual(*nodes[0].first, *nodes[0].second);
+		}
+
+	public:
+		explicit TreeComparator(const Options& options)
+		: options (options)
+		, tolerant(options.nanEqual || options.absTolerance > 0 || options.relTolerance > 0)
+		, different(false)
+		{}
+
+		bool nodeEqual(const CVMatTree& lhs, const CVMatTree& rhs)
+		{
+			if(different)
+				return false;
+			if(lhs.type() != rhs.type())
+				return false;
+			if(options.cachedHashes && !tolerant && lhs.isContentHashCached() && rhs.isContentHashCached() && lhs.contentHash() != rhs.contentHash())
+				return false;
+
+			switch(lhs.type())
+			{
+				case CVMatTree::Type::Undef:
+					return true;
+				case CVMatTree::Type::String:
+					return lhs.getString() == rhs.getString();
+				case CVMatTree::Type::Mat:
+					return matEqual(lhs.getMat(), rhs.getMat());
+				case CVMatTree::Type::List:
+					return listEqual(lhs.getNodeList(), rhs.getNodeList());
+				case CVMatTree::Type::Dir:
+					return dirEqual(lhs.getNodeDir(), rhs.getNodeDir());
+			}
+			return false;
+		}
+	};
 }
 
 
 namespace CppFW
 {
+	CVMatTree::CVMatTree(CVMatTreeArena& arena)
+	: arena(&arena)
+	{
+	}
+
 	CVMatTree::~CVMatTree()
 	{
-		delete mat;
-		for(CVMatTree* obj : nodeList)
-			delete obj;
-		for(NodePair& pair : nodeDir)
-			delete pair.second;
+		deleteSubNodes();
 	}
 
 	void CVMatTree::clear()
 	{
-		delete mat;
-		mat = nullptr;
+		invalidateContentHash();
+		deleteSubNodes();
+		payload.emplace<std::monostate>();
 
-		for(CVMatTree* obj : nodeList)
-			delete obj;
-		nodeList.clear();
-		for(NodePair& pair : nodeDir)
-			delete pair.second;
-		nodeDir.clear();
+		internalType = Type::Undef;
+	}
 
-		str.clear();
 
-		internalType = Type::Undef;
+	std::pmr::memory_resource* CVMatTree::getResource() const
+	{
+		if(arena)
+			return arena->getResource();
+		return std::pmr::get_default_resource();
+	}
+
+	CVMatTree* CVMatTree::newNode()
+	{
+		CVMatTree* node;
+		if(arena)
+		{
+			// destructor is only needed for payloads with external resources, dir keys included (see setArenaManaged)
+			node = arena->createUnmanaged<CVMatTree>(*arena);
+			node->arenaOwned = true;
+		}
+		else
+			node = new CVMatTree;
+		node->parent = this;
+		return node;
+	}
+
+	void CVMatTree::setArenaManaged()
+	{
+		if(!arenaOwned || arenaManaged)
+			return;
+		arena->addDestructor(this);
+		arenaManaged = true;
 	}
 
+	void CVMatTree::deleteSubNodes()
+	{
+		// nodes in an arena are destroyed with the arena
+		if(NodeList* nodeList = std::get_if<NodeList>(&payload))
+		{
+			for(CVMatTree* obj : *nodeList)
+				if(!obj->arenaOwned)
+					delete obj;
+		}
+		else if(NodeDir* nodeDir = std::get_if<NodeDir>(&payload))
+		{
+			for(const NodePair& pair : *nodeDir)
+				if(!pair.second->arenaOwned)
+					delete pair.second;
+		}
+	}
+
+	void CVMatTree::takePayload(CVMatTree& other) noexcept
+	{
+		// move construction of the alternatives keeps the memory resource of other (no allocation)
+		switch(other.payload.index())
+		{
+			case 1: payload.emplace<NodeDir    >(std::move(std::get<NodeDir    >(other.payload))); break;
+			case 2: payload.emplace<NodeList   >(std::move(std::get<NodeList   >(other.payload))); break;
+			case 3: payload.emplace<cv::Mat    >(std::move(std::get<cv::Mat    >(other.payload))); break;
+			case 4: payload.emplace<std::string>(std::move(std::get<std::string>(other.payload))); break;
+			case 5: payload.emplace<LazyPayload>(std::move(std::get<LazyPayload>(other.payload))); break;
+			default: payload.emplace<std::monostate>(); break;
+		}
+		internalType = other.internalType;
+
+		if(NodeList* nodeList = std::get_if<NodeList>(&payload))
+		{
+			for(CVMatTree* obj : *nodeList)
+				obj->parent = this;
+		}
+		else if(NodeDir* nodeDir = std::get_if<NodeDir>(&payload))
+		{
+			for(const NodePair& pair : *nodeDir)
+				pair.second->parent = this;
+		}
+
+		other.invalidateContentHash();
+		other.payload.emplace<std::monostate>();
+		other.internalType = Type::Undef;
+	}
+
+	void CVMatTree::invalidateContentHash()
+	{
+		// a valid hash implies valid hashes of all subnodes, so the walk can stop at the first invalid node
+		for(CVMatTree* node = this; node && node->hashValid; node = node->parent)
+			node->hashValid = false;
+	}
+
+	uint64_t CVMatTree::contentHash() const
+	{
+		if(!hashValid)
+		{
+			hashValue = computeContentHash();
+			hashValid = true;
+		}
+		return hashValue;
+	}
+
+	uint64_t CVMatTree::computeContentHash() const
+	{
+		CVMatTreeHash hash;
+		hash.updateValue(static_cast<uint32_t>(internalType));
+
+		switch(internalType)
+		{
+			case Type::Undef:
+				break;
+			case Type::String:
+			{
+				const std::string& str = getString();
+				hash.updateValue(static_cast<uint64_t>(str.size()));
+				hash.update(str.data(), str.size());
+				break;
+			}
+			case Type::Mat:
+				hashMat(hash, getMat());
+				break;
+			case Type::List:
+			{
+				const NodeList& nodeList = std::get<NodeList>(payload);
+				hash.updateValue(static_cast<uint64_t>(nodeList.size()));
+				for(const CVMatTree* node : nodeList)
+					hash.updateValue(node->contentHash());
+				break;
+			}
+			case Type::Dir:
+			{
+				// sum of the entry hashes, equal dirs can differ in the insertion order
+				const NodeDir& nodeDir = std::get<NodeDir>(payload);
+				uint64_t entrySum = 0;
+				for(const NodePair& pair : nodeDir)
+				{
+					CVMatTreeHash entryHash;
+					entryHash.updateValue(pair.second->contentHash());
+					entryHash.update(pair.first.str().data(), pair.first.str().size());
+					entrySum += entryHash.digest();
+				}
+				hash.updateValue(static_cast<uint64_t>(nodeDir.size()));
+				hash.updateValue(entrySum);
+				break;
+			}
+		}
+		return hash.digest();
+	}
 
 
-	CVMatTree& CVMatTree::getDirNode(const std::string& name)
+	template<typename Name>
+	CVMatTree& CVMatTree::getDirNodeT(const Name& name)
 	{
+		invalidateContentHash();
 		if(internalType == Type::Undef)
+		{
+			setArenaManaged();                                   // the dir releases its keys (CVMatTreeKey pool)
+			payload.emplace<NodeDir>(getResource());
 			internalType = Type::Dir;
+		}
 		if(internalType != Type::Dir)
 			throw WrongType("CVMatTree::getDirNode()");
-		return getAndInsert<CVMatTree, std::string, NodeDir>(name, nodeDir);
+		return getAndInsert<CVMatTree>(name, std::get<NodeDir>(payload), [this]() { return newNode(); }, [](CVMatTree* node) { if(!node->arenaOwned) delete node; });
 	}
 
-	const CppFW::CVMatTree& CVMatTree::getDirNode(const std::string& name) const
+	CVMatTree& CVMatTree::getDirNode(std::string_view name)
+	{
+		return getDirNodeT(name);
+	}
+
+	CVMatTree& CVMatTree::getDirNode(const CVMatTreeKey& name)
+	{
+		return getDirNodeT(name);
+	}
+
+	const CppFW::CVMatTree& CVMatTree::getDirNode(std::string_view name) const
 	{
 		if(internalType != Type::Dir)
 			throw WrongType("CVMatTree::getDirNode() const");
 
+		const NodeDir& nodeDir = std::get<NodeDir>(payload);
 		const NodeDir::const_iterator it = nodeDir.find(name);
 		if(it == nodeDir.end())
 			throw std::out_of_range("CVMatTree::getDirNode() const: node not found");
@@ -162,11 +534,13 @@ namespace CppFW
 	}
 
 
-	const CppFW::CVMatTree* CVMatTree::getDirNodeOpt(const char* name) const
+	template<typename Name>
+	const CVMatTree* CVMatTree::getDirNodeOptT(const Name& name) const
 	{
 		if(internalType != Type::Dir)
 			return nullptr;
 
+		const NodeDir& nodeDir = std::get<NodeDir>(payload);
 		NodeDir::const_iterator it = nodeDir.find(name);
 		if(it == nodeDir.end())
 			return nullptr;
@@ -174,47 +548,63 @@ namespace CppFW
 		return it->second;
 	}
 
+	const CppFW::CVMatTree* CVMatTree::getDirNodeOpt(std::string_view name) const
+	{
+		return getDirNodeOptT(name);
+	}
+
+	const CppFW::CVMatTree* CVMatTree::getDirNodeOpt(const CVMatTreeKey& name) const
+	{
+		return getDirNodeOptT(name);
+	}
+
 
 	const CVMatTree::NodeDir& CVMatTree::getNodeDir() const
 	{
 		if(internalType != Type::Dir)
 			throw WrongType("CVMatTree::getNodeDir() const");
-		return nodeDir;
+		return std::get<NodeDir>(payload);
 	}
 
 
 	CVMatTree& CVMatTree::getListNode(std::size_t index)
 	{
+		invalidateContentHash();
 		if(internalType != Type::List)
 			throw WrongType("VMatTree::getListNode()");
-		return *(nodeList.at(index));
+		return *(std::get<NodeList>(payload).at(index));
 	}
 
 	const CVMatTree::NodeList& CVMatTree::getNodeList() const
 	{
 		if(internalType != Type::List)
 			throw WrongType("CVMatTree::getNodeList() const");
-		return nodeList;
+		return std::get<NodeList>(payload);
 
 	}
 
 	CVMatTree& CVMatTree::newListNode()
 	{
+		invalidateContentHash();
 		if(internalType == Type::Undef)
+		{
+			payload.emplace<NodeList>(getResource());
 			internalType = Type::List;
+		}
 		if(internalType != Type::List)
 			throw WrongType("CVMatTree::newListNode()");
-		CVMatTree* newNode = new CVMatTree;
+		CVMatTree* node = newNode();
 		try
 		{
-			nodeList.push_back(newNode);
+			std::get<NodeList>(payload).push_back(node);
 		}
 		catch(...)
 		{
-			delete newNode;
+			if(!node->arenaOwned)
+				delete node;
 			throw;
 		}
-		return *newNode;
+		return *node;
 	}
 
 	std::size_t CVMatTree::getNumElements() const
@@ -222,9 +612,9 @@ namespace CppFW
 		switch(internalType)
 		{
 			case Type::Dir:
-				return nodeDir.size();
+				return std::get<NodeDir>(payload).size();
 			case Type::List:
-				return nodeList.size();
+				return std::get<NodeList>(payload).size();
 			case Type::Mat:
 				return 1;
 			case Type::String:
@@ -240,80 +630,128 @@ namespace CppFW
 	{
 		if(internalType != Type::Mat)
 			throw WrongType("CVMatTree::getMat() const");
-		return *mat;
+		loadPayload();
+		return std::get<cv::Mat>(payload);
 	}
 
 	const cv::Mat* CVMatTree::getMatOpt() const
 	{
 		if(internalType != Type::Mat)
 			return nullptr;
-		return mat;
+		loadPayload();
+		return &std::get<cv::Mat>(payload);
 	}
 
 	cv::Mat& CVMatTree::getMat()
 	{
+		invalidateContentHash();
 		if(internalType == Type::Undef)
 		{
+			setArenaManaged();
+			payload.emplace<cv::Mat>();
 			internalType = Type::Mat;
-			mat = new cv::Mat;
 		}
 		if(internalType != Type::Mat)
 			throw WrongType("CVMatTree::getMat()");
-		return *mat;
+		loadPayload();
+		return std::get<cv::Mat>(payload);
 	}
 
 	const std::string& CVMatTree::getString() const
 	{
 		if(internalType != Type::String)
 			throw WrongType("CVMatTree::getString() const");
-		return str;
+		loadPayload();
+		return std::get<std::string>(payload);
 	}
 
 	std::string& CVMatTree::getString()
 	{
+		invalidateContentHash();
 		if(internalType == Type::Undef)
+		{
+			setArenaManaged();
+			payload.emplace<std::string>();
 			internalType = Type::String;
+		}
 		if(internalType != Type::String)
 			throw WrongType("CVMatTree::getString()");
-		return str;
+		loadPayload();
+		return std::get<std::string>(payload);
 	}
 
 	const std::string& CVMatTree::getStringOrEmpty() const
 	{
-		return str; // str is empty when other datatype is set
+		static const std::string emptyString;
+		if(internalType != Type::String)
+			return emptyString;
+		loadPayload();
+		return std::get<std::string>(payload);
 	}
 
+	void CVMatTree::setLazyPayload(Type type, std::shared_ptr<PayloadLoader> loader, uint64_t position)
+	{
+		if(internalType != Type::Undef)
+			throw WrongType("CVMatTree::setLazyPayload()");
+		if(type != Type::Mat && type != Type::String)
+			throw WrongType("CVMatTree::setLazyPayload(): only mat and string payloads");
+
+		invalidateContentHash();
+		setArenaManaged();
+		payload.emplace<LazyPayload>(LazyPayload{std::move(loader), position});
+		internalType = type;
+	}
 
-
-	bool CVMatTree::operator==(const CppFW::CVMatTree& other) const
+	void CVMatTree::loadLazyPayload() const
 	{
-		if(internalType != other.internalType)
-			return false;
+		CVMatTree& node = const_cast<CVMatTree&>(*this);
+		LazyPayload lazy = std::move(std::get<LazyPayload>(node.payload));
+		if(internalType == Type::Mat)
+			node.payload.emplace<cv::Mat>();
+		else
+			node.payload.emplace<std::string>();
 
-		switch(internalType)
+		try
 		{
-			case Type::Undef:
-				return true;
-			case Type::String:
-				return str == other.str;
-			case Type::Mat:
-				return matIsEqual(*mat, *(other.mat));
-			case Type::List:
-				return vector_compare_ptr(nodeList, other.nodeList);
-			case Type::Dir:
-				return map_compare_ptr(nodeDir, other.nodeDir);
+			lazy.loader->loadPayload(node, lazy.position);
 		}
+		catch(...)
+		{
+			node.payload.emplace<LazyPayload>(std::move(lazy));
+			throw;
+		}
+	}
+
+
 
-		return false;
+	bool CVMatTree::operator==(const CppFW::CVMatTree& other) const
+	{
+		return isEqual(other, CompareOptions());
 	}
 
-	CVMatTree::CVMatTree(CVMatTree&& other)
+	bool CVMatTree::isEqual(const CppFW::CVMatTree& other, const CompareOptions& options) const
 	{
-		std::swap(mat         , other.mat         );
-		std::swap(internalType, other.internalType);
+		TreeComparator comparator(options);
+		return comparator.nodeEqual(*this, other);
+	}
 
-		nodeDir .swap(other.nodeDir );
-		nodeList.swap(other.nodeList);
+	CVMatTree::CVMatTree(CVMatTree&& other) noexcept
+	: arena(other.arena)
+	{
+		takePayload(other);
+	}
+
+	CVMatTree& CVMatTree::operator=(CVMatTree&& other) noexcept
+	{
+		if(this == &other)
+			return *this;
+
+		invalidateContentHash();
+		deleteSubNodes();
+		takePayload(other);
+		if(internalType != Type::Undef)
+			setArenaManaged();                                   // subnodes of other are not necessarily in the arena
+		return *this;
 	}
 
 
@@ -324,21 +762,34 @@ namespace CppFW
 
 	void CVMatTree::print(std::ostream& stream, int deept) const
 	{
+		loadPayload();
 		switch(internalType)
 		{
 			case Type::Undef:
 				stream << "<>";
 				break;
 			case Type::String:
-				stream << "Str: " << str;
+				stream << "Str: " << std::get<std::string>(payload);
 				break;
 			case Type::Mat:
-				stream << "Mat " << mat->rows << " x " << mat->cols << " | type: " << mat->type() << " | depth: " << mat->depth() << " | channels: " << mat->channels() << '\n';
-				stream << *mat;
+			{
+				const cv::Mat& mat = std::get<cv::Mat>(payload);
+				if(mat.dims > 2)
+				{
+					// the cv::Mat output handles only 2d mats
+					stream << "Mat " << mat.size[0];
+					for(int i = 1; i < mat.dims; ++i)
+						stream << " x " << mat.size[i];
+					stream << " | type: " << mat.type() << " | depth: " << mat.depth() << " | channels: " << mat.channels() << '\n';
+					break;
+				}
+				stream << "Mat " << mat.rows << " x " << mat.cols << " | type: " << mat.type() << " | depth: " << mat.depth() << " | channels: " << mat.channels() << '\n';
+				stream << mat;
 				break;
+			}
 			case Type::List:
 				stream << "{\n";
-				for(const CVMatTree* node : nodeList)
+				for(const CVMatTree* node : std::get<NodeList>(payload))
 				{
 					for(int i=-1; i<deept; ++i) stream << "  ";
 					node->print(stream, deept+1);
@@ -348,11 +799,11 @@ namespace CppFW
 				break;
 			case Type::Dir:
 				stream << "[\n";
-				for(const NodePair& pair : nodeDir)
+				for(const NodePair* pair : std::get<NodeDir>(payload).sorted())
 				{
 					for(int i=-1; i<deept; ++i) stream << "  ";
-					stream << pair.first << " : ";
-					pair.second->print(stream, deept+1);
+					stream << pair->first << " : ";
+					pair->second->print(stream, deept+1);
 				}
 				for(int i=0; i<deept; ++i) stream << "  ";
 				stream << ']';
@@ -18,15 +18,22 @@
 #pragma once
 
 #include <vector>
-#include <map>
 #include <string>
+#include <string_view>
+#include <memory>
+#include <memory_resource>
 #include <stdexcept>
+#include <variant>
+#include <cstdint>
 
-namespace cv { class Mat; }
+#include <opencv2/core/core.hpp>
+
+#include "cvmattreedir.h"
 
 
 namespace CppFW
 {
+	class CVMatTreeArena;
 
 	class CVMatTree
 	{
@@ -37,22 +44,51 @@ namespace CppFW
 			WrongType(const char* what_arg) : domain_error(what_arg) {}
 		};
 
+		class PayloadLoadError : public std::runtime_error
+		{
+		public:
+			PayloadLoadError(const char* what_arg) : runtime_error(what_arg) {}
+		};
+
 		enum class Type { Undef, Dir, List, Mat, String };
 
-		typedef std::pair<const std::string, CVMatTree*> NodePair;
-		typedef std::map<std::string, CVMatTree*>        NodeDir ;
-		typedef std::vector<CVMatTree*>                  NodeList;
+		typedef CVMatTreeDir::Entry                       NodePair;
+		typedef CVMatTreeDir                              NodeDir ;   // iterates in insertion order, see CVMatTreeDir::sorted()
+		typedef std::pmr::vector<CVMatTree*>              NodeList;
+
+		// loads the payload of a mat or string node on first access (see CVMatTreeStructBin::ReadOptions::lazy)
+		// throws PayloadLoadError if the payload cannot be read, the node then stays lazy
+		class PayloadLoader
+		{
+		public:
+			virtual ~PayloadLoader()                                 = default;
+			virtual void loadPayload(CVMatTree& node, uint64_t position) = 0;
+		};
+
+		struct CompareOptions
+		{
+			bool   parallel     = false;                             // compare sibling subtrees and large mats in parallel (cv::parallel_for_)
+			double absTolerance = 0;                                 // float/double values a and b are equal if |a-b| <= absTolerance + relTolerance*max(|a|,|b|)
+			double relTolerance = 0;
+			bool   nanEqual     = false;                             // float/double NaN is equal to NaN
+			bool   cachedHashes = false;                             // nodes with different cached content hashes are unequal, the hashes must be up to date (see contentHash)
+		};
 
 		CVMatTree()            = default;
-		CVMatTree(CVMatTree&&);
+		explicit CVMatTree(CVMatTreeArena& arena);               // all subnodes are allocated in the arena, which must outlive the tree
+		CVMatTree(CVMatTree&& other) noexcept;
 		~CVMatTree();
 
+		CVMatTree& operator=(CVMatTree&& other) noexcept;        // the node keeps its arena, the payload and subnodes are taken from other
+
 		Type type() const                                        { return internalType; }
 		void clear();
 
-		      CVMatTree& getDirNode(const std::string& name);
-		const CVMatTree& getDirNode(const std::string& name) const;
-		const CVMatTree* getDirNodeOpt(const char* name) const;
+		      CVMatTree& getDirNode(std::string_view name);
+		      CVMatTree& getDirNode(const CVMatTreeKey& name);
+		const CVMatTree& getDirNode(std::string_view name) const;
+		const CVMatTree* getDirNodeOpt(std::string_view name) const;
+		const CVMatTree* getDirNodeOpt(const CVMatTreeKey& name) const;
 		const NodeDir  & getNodeDir() const;
 
 		CVMatTree& getListNode(std::size_t index);
@@ -68,20 +104,60 @@ namespace CppFW
 		      std::string& getString();
 		const std::string& getString() const;
 		const std::string& getStringOrEmpty() const;
+
+		// node becomes a mat or string node, the payload is loaded by the loader when it is accessed the first time
+		// the first access replaces the payload and is not thread safe, also for const access (const access of different nodes is)
+		void setLazyPayload(Type type, std::shared_ptr<PayloadLoader> loader, uint64_t position);
+		bool isPayloadLoaded() const                             { return !std::holds_alternative<LazyPayload>(payload); }
 		
 		bool operator==(const CVMatTree& other) const;
 		bool operator!=(const CVMatTree& other) const            { return !operator==(other); }
+		bool isEqual(const CVMatTree& other, const CompareOptions& options) const;
+
+		// 64 bit hash of the content (XXH64), combined from the hashes of the subnodes, equal trees have equal hashes
+		// the hashes are cached in the nodes and invalidated by non-const access of the node or a subnode
+		// changes through references or shared mat data obtained before the hash was computed are not detected (use invalidateContentHash)
+		// computing the hash is not thread safe
+		uint64_t contentHash() const;
+		bool     isContentHashCached() const                     { return hashValid; }
+		void     invalidateContentHash();
 
 		void print(std::ostream& stream) const;
 	private:
 		CVMatTree(const CVMatTree&)            = delete;
 		CVMatTree& operator=(const CVMatTree&) = delete;
 
+
+		struct LazyPayload
+		{
+			std::shared_ptr<PayloadLoader>   loader;
+			uint64_t                         position = 0;
+		};
+
+		// only the payload of the active type is stored, a lazy payload is replaced by the mat or string when it is loaded
+		typedef std::variant<std::monostate, NodeDir, NodeList, cv::Mat, std::string, LazyPayload> Payload;
+
 		Type                                 internalType = Type::Undef;
-		cv::Mat*                             mat          = nullptr;
-		NodeDir                              nodeDir;
-		NodeList                             nodeList;
-		std::string                          str;
+		bool                                 arenaOwned   = false;   // node memory is owned by the arena
+		bool                                 arenaManaged = false;   // arena calls the destructor
+		mutable bool                         hashValid    = false;
+		mutable uint64_t                     hashValue    = 0;
+		CVMatTree*                           parent       = nullptr;
+		CVMatTreeArena*                      arena        = nullptr;
+		Payload                              payload;
+
+		void loadPayload() const                                 { if(!isPayloadLoaded()) loadLazyPayload(); }
+		void loadLazyPayload() const;
+
+		std::pmr::memory_resource* getResource() const;
+		template<typename Name>       CVMatTree& getDirNodeT   (const Name& name);
+		template<typename Name> const CVMatTree* getDirNodeOptT(const Name& name) const;
+
+		CVMatTree* newNode();
+		void deleteSubNodes();
+		void takePayload(CVMatTree& other) noexcept;
+		void setArenaManaged();
+		uint64_t computeContentHash() const;
 		
 		void print(std::ostream& stream, int deept) const;
 	};
@@ -16,29 +16,138 @@
  */
 
 #include "treestructbin.h"
+#include "treestructbinconvert.h"
 #include "cvmattreestruct.h"
 
 #include <cassert>
 
+#include <algorithm>
+#include <cstring>
 #include <fstream>
+#include <limits>
+#include <sstream>
 #include <string>
 #include <filesystem>
+#include <atomic>
+#include <future>
+#include <mutex>
+#include <unordered_map>
 
 #include <opencv2/opencv.hpp>
 
 #include <boost/lexical_cast.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/interprocess/streams/bufferstream.hpp>
 #include <callback.h>
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <cerrno>
+#include <climits>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#define CVMATTREE_WRITEV
+#endif
+
 namespace sfs = std::filesystem;
 
 namespace CppFW
 {
 
+	inline const char* CVMatTreeStructBin::Input::take(uint64_t size)
+	{
+		if(failed || size > static_cast<uint64_t>(end - pos))
+		{
+			failed = true;
+			return nullptr;
+		}
+		const char* data = pos;
+		pos += size;
+		return data;
+	}
+
+	inline bool CVMatTreeStructBin::Input::read(char* data, std::streamsize size)
+	{
+		if(stream)
+			return static_cast<bool>(stream->read(data, size));
+
+		const char* source = take(static_cast<uint64_t>(size));
+		if(!source)
+			return false;
+		if(size > 0)
+			std::memcpy(data, source, static_cast<std::size_t>(size));
+		return true;
+	}
+
+	inline bool CVMatTreeStructBin::Input::good() const
+	{
+		return stream ? stream->good() : !failed;
+	}
+
+	inline void CVMatTreeStructBin::Input::clear()
+	{
+		if(stream)
+			stream->clear();
+		failed = false;
+	}
+
+	inline std::streampos CVMatTreeStructBin::Input::tellg() const
+	{
+		if(stream)
+			return stream->tellg();
+		return failed ? std::streampos(-1) : std::streampos(pos - begin);
+	}
+
+	inline void CVMatTreeStructBin::Input::seekg(std::streampos position)
+	{
+		seekg(static_cast<std::streamoff>(position), std::ios::beg);
+	}
+
+	inline void CVMatTreeStructBin::Input::seekg(std::streamoff offset, std::ios::seekdir dir)
+	{
+		if(stream)
+		{
+			stream->seekg(offset, dir);
+			return;
+		}
+
+		const char* origin = dir == std::ios::beg ? begin : dir == std::ios::end ? end : pos;
+		if(failed || offset < begin - origin || offset > end - origin)
+			failed = true;
+		else
+			pos = origin + offset;
+	}
+
+
 	namespace
 	{
-		const uint32_t version = 1;
+		const uint32_t version      = 1;
+		const uint32_t versionFlags = 2;                              // the first reserved header field contains HeaderFlags
 		const char     magic[] = "CVMatBin";
 
+		namespace HeaderFlags
+		{
+			const uint32_t Indexed    = 1 << 0;                        // trailing index (CVMatTreeBinIndex) after the root node
+			const uint32_t Compressed = 1 << 1;                        // mat payloads can be compressed (codec in the reserved mat header fields)
+			const uint32_t Wide       = 1 << 2;                        // dir, list and string lengths are uint64 instead of uint32
+			const uint32_t NDims      = 1 << 3;                        // mats can have more than 2 dims (dims in the reserved mat header fields, further sizes after the header)
+			const uint32_t Known      = Indexed | Compressed | Wide | NDims;
+		}
+
+		// header flags of a file of the given version, false for unknown versions or flags
+		bool decodeHeaderFlags(uint32_t fileVersion, uint32_t flags, uint32_t& headerFlags)
+		{
+			if(fileVersion != version && fileVersion != versionFlags)
+				return false;
+			headerFlags = fileVersion == version ? 0 : flags;
+			return !(headerFlags & ~HeaderFlags::Known);
+		}
+
+		const uint32_t indexVersion = 2;                              // 2: '/' and '\' in names are escaped (CVMatTreeBinIndex::appendPathSegment), older indices are ignored
+		const char     indexMagic[] = "CVMatIdx";
+		const uint32_t sidecarVersion = 1;                            // sidecar: indexMagic, sidecarVersion, size and time of the bin file, index entries
+
 
 		template<typename T>
 		inline void writeBin2Stream(std::ostream* stream, const T value, std::size_t num = 1)
@@ -52,15 +161,66 @@ namespace CppFW
 			stream->write(reinterpret_cast<const char*>(value.c_str()), value.size());
 		}
 
+		// a mat is handled as rows of its last dimension, 2d mats have mat.rows rows
+		inline std::size_t matRows(const cv::Mat& mat)
+		{
+			if(mat.dims <= 2)
+				return static_cast<std::size_t>(mat.rows);
+			std::size_t rows = 1;
+			for(int i = 0; i < mat.dims-1; ++i)
+				rows *= static_cast<std::size_t>(mat.size[i]);
+			return rows;
+		}
+
+		// dir entries in the written order, by name or in insertion order (WriteOptions::insertionOrder)
+		template<typename Function>
+		void forEachDirEntry(const CVMatTree::NodeDir& dir, bool byName, Function function)
+		{
+			if(!byName)
+			{
+				for(const CVMatTree::NodePair& pair : dir)
+					function(pair);
+				return;
+			}
+			for(const CVMatTree::NodePair* pair : dir.sorted())
+				function(*pair);
+		}
+
+		inline std::size_t matRowBytes(const cv::Mat& mat)
+		{
+			const int cols = mat.dims <= 2 ? mat.cols : mat.size[mat.dims-1];
+			return static_cast<std::size_t>(cols)*mat.elemSize();
+		}
+
+		inline const unsigned char* matRow(const cv::Mat& mat, std::size_t row)
+		{
+			if(mat.dims <= 2)
+				return mat.ptr(static_cast<int>(row));
+			const unsigned char* ptr = mat.data;
+			for(int i = mat.dims-2; i >= 0; --i)
+			{
+				const std::size_t size = static_cast<std::size_t>(mat.size[i]);
+				ptr += (row % size)*mat.step[i];
+				row /= size;
+			}
+			return ptr;
+		}
+
 		template<typename T>
 		inline void writeMatBin(std::ostream* stream, const cv::Mat& mat)
 		{
-			const int channels = mat.channels();
-			const int cols     = mat.cols;
-			for(int i = 0; i < mat.rows; i++)
+			if(mat.isContinuous())
+			{
+				stream->write(reinterpret_cast<const char*>(mat.ptr<T>()), static_cast<std::streamsize>(mat.total()*mat.elemSize()));
+				return;
+			}
+
+			const std::size_t rows     = matRows(mat);
+			const std::size_t rowBytes = matRowBytes(mat);
+			for(std::size_t i = 0; i < rows; i++)
 			{
-				const T* mi = mat.ptr<T>(i);
-				stream->write(reinterpret_cast<const char*>(mi), sizeof(T)*cols*channels);
+				const T* mi = reinterpret_cast<const T*>(matRow(mat, i));
+				stream->write(reinterpret_cast<const char*>(mi), static_cast<std::streamsize>(rowBytes));
 // 				writeBin2Stream(stream, *mi, cols*channels);
 // 				for(int j = 0; j < cols; j++)
 // 				{
@@ -73,334 +233,2830 @@ namespace CppFW
 			}
 		}
 
-		template<typename T>
-		inline void readBinStream(std::istream& stream, T* value, std::size_t num = 1)
+		// Stream: std::istream or CVMatTreeStructBin::Input
+		template<typename T, typename Stream>
+		inline void readBinStream(Stream& stream, T* value, std::size_t num = 1)
 		{
 			stream.read(reinterpret_cast<char*>(value), sizeof(T)*num);
 		}
 
 
-		inline void readString(std::istream& stream, std::string& value, std::size_t length)
+		template<typename Stream>
+		inline void readString(Stream& stream, std::string& value, std::size_t length)
 		{
 			value.resize(length);
 			readBinStream<char>(stream, const_cast<std::string::value_type*>(value.data()), static_cast<std::size_t>(length)); // TODO: remove const_cast in C++17
 		}
 
-		inline void readBinStream(std::istream& stream, std::string& value)
+		template<typename Stream>
+		inline void readBinStream(Stream& stream, std::string& value)
 		{
 			uint32_t length;
 			readBinStream<uint32_t>(stream, &length);
 			readString(stream, value, length);
 		}
 
-		inline std::string readBinSting(std::istream& stream)
+		template<typename T, typename Stream>
+		inline T readBinStream(Stream& stream)
 		{
-			std::string value;
-			readBinStream(stream, value);
+			T value;
+			readBinStream(stream, &value, 1);
 			return value;
 		}
 
-		template<typename T>
-		inline T readBinStream(std::istream& stream)
+		template<typename T, typename Stream>
+		inline void readMatBin(Stream& stream, cv::Mat& mat)
 		{
-			T value;
-			readBinStream(stream, &value, 1);
-			return value;
+			// one read call per mat (or per row for non continuous mats) instead of one per element
+			if(mat.isContinuous())
+			{
+				readBinStream(stream, mat.ptr<T>(), mat.total()*static_cast<std::size_t>(mat.channels()));
+				return;
+			}
+
+			const std::size_t rows        = matRows(mat);
+			const std::size_t rowElements = matRowBytes(mat)/sizeof(T);
+			for(std::size_t i = 0; i < rows; i++)
+				readBinStream(stream, reinterpret_cast<T*>(const_cast<unsigned char*>(matRow(mat, i))), rowElements);
 		}
 
-		template<typename T>
-		inline void readMatBin(std::istream& stream, cv::Mat& mat)
+		template<typename Stream>
+		inline void skipBinStream(Stream& stream, std::size_t num)
+		{
+			stream.seekg(static_cast<std::streamoff>(num), std::ios::cur);
+		}
+
+		const uint64_t indexEntryFixedSize = sizeof(uint32_t) + 2*sizeof(uint64_t) + 5*sizeof(uint32_t);   // path length, offset, size, type, depth, channels, rows, cols
+
+		CVMatTreeBinIndex::Entry indexEntry(const CVMatTree& node, const std::string& path, uint64_t offset)
+		{
+			CVMatTreeBinIndex::Entry entry;
+			entry.path   = path;
+			entry.offset = offset;
+			entry.type   = static_cast<uint32_t>(node.type());
+			if(node.type() == CVMatTree::Type::Mat)
+			{
+				const cv::Mat& mat = node.getMat();
+				entry.depth    = static_cast<uint32_t>(mat.depth());
+				entry.channels = static_cast<uint32_t>(mat.channels());
+				entry.rows     = static_cast<uint32_t>(mat.dims > 2 ? mat.size[0] : mat.rows);
+				entry.cols     = static_cast<uint32_t>(mat.dims > 2 ? mat.size[1] : mat.cols);
+			}
+			return entry;
+		}
+
+		std::size_t decimalDigits(uint64_t value)
+		{
+			std::size_t digits = 1;
+			for(; value >= 10; value /= 10)
+				++digits;
+			return digits;
+		}
+
+		void writeIndexEntries(std::ostream* stream, const std::vector<CVMatTreeBinIndex::Entry>& entries)
+		{
+			writeBin2Stream<uint32_t>(stream, indexVersion);
+			writeBin2Stream<uint64_t>(stream, entries.size());
+			for(const CVMatTreeBinIndex::Entry& entry : entries)
+			{
+				writeBin2Stream(stream, entry.path);
+				writeBin2Stream(stream, entry.offset  );
+				writeBin2Stream(stream, entry.size    );
+				writeBin2Stream(stream, entry.type    );
+				writeBin2Stream(stream, entry.depth   );
+				writeBin2Stream(stream, entry.channels);
+				writeBin2Stream(stream, entry.rows    );
+				writeBin2Stream(stream, entry.cols    );
+			}
+		}
+
+		template<typename Stream>
+		bool readIndexEntries(Stream& stream, CVMatTreeBinIndex& index)
+		{
+			if(readBinStream<uint32_t>(stream) != indexVersion)
+				return false;
+
+			const uint64_t numEntries = readBinStream<uint64_t>(stream);
+			for(uint64_t i = 0; i < numEntries && stream.good(); ++i)
+			{
+				CVMatTreeBinIndex::Entry entry;
+				readBinStream(stream, entry.path);
+				readBinStream(stream, &entry.offset  );
+				readBinStream(stream, &entry.size    );
+				readBinStream(stream, &entry.type    );
+				readBinStream(stream, &entry.depth   );
+				readBinStream(stream, &entry.channels);
+				readBinStream(stream, &entry.rows    );
+				readBinStream(stream, &entry.cols    );
+				index.addEntry(entry);
+			}
+
+			if(!stream.good())
+			{
+				index.clear();
+				return false;
+			}
+			return true;
+		}
+
+		// size and modification time of the bin file, stored in the sidecar index to detect stale sidecars
+		bool readFileStamp(const std::string& filename, uint64_t& size, int64_t& time)
+		{
+			std::error_code error;
+			size = sfs::file_size(filename, error);
+			if(error)
+				return false;
+			time = static_cast<int64_t>(sfs::last_write_time(filename, error).time_since_epoch().count());
+			return !error;
+		}
+
+		typedef std::vector<std::string> PathPattern;                 // segments of a selector pattern
+
+		PathPattern splitPathPattern(const std::string& pattern)
+		{
+			return CVMatTreeBinIndex::splitPath(pattern);
+		}
+
+		// glob match with * (any sequence) and ? (any character)
+		bool matchPathSegment(const std::string& pattern, const std::string& name)
+		{
+			std::size_t p = 0;
+			std::size_t n = 0;
+			std::size_t starP = std::string::npos;
+			std::size_t starN = 0;
+			while(n < name.size())
+			{
+				if(p < pattern.size() && (pattern[p] == '?' || pattern[p] == name[n]))
+				{
+					++p;
+					++n;
+				}
+				else if(p < pattern.size() && pattern[p] == '*')
+				{
+					starP = p++;
+					starN = n;
+				}
+				else if(starP != std::string::npos)
+				{
+					p = starP + 1;
+					n = ++starN;
+				}
+				else
+					return false;
+			}
+			while(p < pattern.size() && pattern[p] == '*')
+				++p;
+			return p == pattern.size();
+		}
+
+		// matches the node path segments [s, end) with the pattern segments [p, end)
+		bool matchPath(const PathPattern& pattern, std::size_t p, const PathPattern& path, std::size_t s)
+		{
+			if(p == pattern.size())
+				return s == path.size();
+			if(pattern[p] == "**")
+				return matchPath(pattern, p + 1, path, s) || (s < path.size() && matchPath(pattern, p, path, s + 1));
+			return s < path.size() && matchPathSegment(pattern[p], path[s]) && matchPath(pattern, p + 1, path, s + 1);
+		}
+
+		bool isHandledDepth(uint32_t depth)
+		{
+			switch(depth)
+			{
+				case CV_8U:
+				case CV_8S:
+				case CV_16U:
+				case CV_16S:
+				case CV_32S:
+				case CV_32F:
+				case CV_64F:
+					return true;
+			}
+			return false;
+		}
+
+
+		typedef boost::interprocess::mapped_region MappedRegion;
+
+		// releases the file mapping when the last mat referring to it is released
+		class MappedFileAllocator : public cv::MatAllocator
+		{
+		public:
+#if CV_VERSION_MAJOR >= 4
+			typedef cv::AccessFlag AccessFlag;
+#else
+			typedef int AccessFlag;
+#endif
+
+			cv::UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step, AccessFlag flags, cv::UMatUsageFlags usageFlags) const override
+			{
+				return cv::Mat::getStdAllocator()->allocate(dims, sizes, type, data, step, flags, usageFlags);
+			}
+
+			bool allocate(cv::UMatData* data, AccessFlag accessflags, cv::UMatUsageFlags usageFlags) const override
+			{
+				return cv::Mat::getStdAllocator()->allocate(data, accessflags, usageFlags);
+			}
+
+			void deallocate(cv::UMatData* u) const override
+			{
+				if(!u)
+					return;
+				delete static_cast<std::shared_ptr<MappedRegion>*>(u->userdata);
+				delete u;
+			}
+
+			static cv::Mat createMat(int dims, const int* sizes, int type, const char* data, const std::shared_ptr<MappedRegion>& region)
+			{
+				static MappedFileAllocator allocator;
+
+				cv::Mat mat(dims, sizes, type, const_cast<char*>(data));
+
+				cv::UMatData* u = new cv::UMatData(&allocator);
+				u->data     = u->origdata = mat.data;
+				u->size     = mat.total()*mat.elemSize();
+				u->userdata = new std::shared_ptr<MappedRegion>(region);
+
+				mat.u = u;
+				mat.addref();
+				return mat;
+			}
+		};
+
+	}
+
+
+	// target depths of ReadOptions::convertDepth and convertPaths
+	struct CVMatTreeStructBin::MatConversion
+	{
+		int depth = -1;
+		std::vector<std::pair<PathPattern, int>> paths;
+
+		MatConversion() = default;
+		explicit MatConversion(const ReadOptions& options)
+		: depth(options.convertDepth)
+		{
+			for(const std::pair<std::string, int>& path : options.convertPaths)
+				paths.emplace_back(splitPathPattern(path.first), path.second);
+		}
+
+		bool active    () const                                        { return depth >= 0 || !paths.empty(); }
+		bool tracksPath() const                                        { return !paths.empty(); }
+
+		int targetDepth(const std::string& nodePath) const             // -1: stored depth
 		{
-			int channels = mat.channels();
-			for(int i = 0; i < mat.rows; i++)
+			if(!paths.empty())
+			{
+				const PathPattern segments = splitPathPattern(nodePath);
+				for(const std::pair<PathPattern, int>& path : paths)
+					if(matchPath(path.first, 0, segments, 0))
+						return path.second;
+			}
+			return depth;
+		}
+	};
+
+
+	// reads the payload of lazy nodes from the file on first access
+	class CVMatTreeStructBin::LazyLoader : public CVMatTree::PayloadLoader
+	{
+		std::ifstream stream;
+		std::mutex    mutex;
+		uint32_t      headerFlags;
+	public:
+		std::unordered_map<uint64_t, int> convertDepths;              // target depth of converted mats by position, filled while reading the structure
+
+		LazyLoader(const std::string& filename, uint32_t headerFlags)
+		: stream(filename, std::ios::binary | std::ios::in)
+		, headerFlags(headerFlags)
+		{}
+
+		void loadPayload(CVMatTree& node, uint64_t position) override
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+
+			stream.clear();
+			stream.seekg(static_cast<std::streamoff>(position));
+
+			CVMatTreeStructBin reader(stream);
+			reader.headerFlags = headerFlags;
+			bool success = stream.good();
+			switch(node.type())
 			{
-				T* mi = mat.ptr<T>(i);
-				for(int j = 0; j < mat.cols; j++)
+				case CVMatTree::Type::Mat:
 				{
-					for(int c = 0; c < channels; ++c)
+					MatConversion conversion;
+					const std::unordered_map<uint64_t, int>::const_iterator it = convertDepths.find(position);
+					if(it != convertDepths.end())
+					{
+						conversion.depth     = it->second;
+						reader.matConversion = &conversion;
+					}
+					success = success && reader.readMatP(node.getMat());
+					break;
+				}
+				case CVMatTree::Type::String:
+					success = success && reader.readString(node.getString());
+					break;
+				default:
+					break;
+			}
+			if(!success || !stream.good())
+				throw CVMatTree::PayloadLoadError("CVMatTreeStructBin: reading lazy payload failed");
+		}
+	};
+
+
+	// part of a mat payload, serialized by the parallel writer and inserted at structOffset of the structure stream
+	struct CVMatTreeStructBin::PayloadChunk
+	{
+		std::size_t    structOffset = 0;
+		const cv::Mat* mat          = nullptr;
+		std::size_t    rowBegin     = 0;                               // rows of the last dimension
+		std::size_t    rowEnd       = 0;
+		std::size_t    size         = 0;
+
+		void serialize(std::string& buffer) const
+		{
+			buffer.resize(size);
+			char* out = &buffer[0];
+			const std::size_t rowBytes = matRowBytes(*mat);
+			if(mat->isContinuous())
+			{
+				std::memcpy(out, mat->data + rowBegin*rowBytes, size);
+				return;
+			}
+			for(std::size_t r = rowBegin; r < rowEnd; ++r, out += rowBytes)
+				std::memcpy(out, matRow(*mat, r), rowBytes);
+		}
+	};
+
+	namespace
+	{
+		const std::size_t parallelChunkBytes  = 4 << 20;            // payload bytes per task
+		const std::size_t parallelWindowBytes = 64 << 20;           // payload bytes serialized while the previous window is written
+		const std::size_t codecChunkBytes     = 256 << 10;          // independently compressed payload bytes
+		const uint32_t    codecBits           = 8;                  // first reserved mat header field: codec | filters << codecBits | dims << dimsShift
+		const uint32_t    codecMask           = (1u << codecBits) - 1;
+		const uint32_t    dimsShift           = 24;                 // 0 for 2d mats
+		const uint32_t    filtersMask         = (1u << (dimsShift - codecBits)) - 1;
+		const std::size_t convertBlockBytes   = 64 << 10;           // stored values read and converted at once (in the cache)
+
+		CVMatTreeBinCodec::Layout codecLayout(int depth, int channels, int cols)
+		{
+			CVMatTreeBinCodec::Layout layout;
+			layout.elemSize1 = static_cast<std::size_t>(CV_ELEM_SIZE1(depth));
+			layout.channels  = static_cast<std::size_t>(channels);
+			layout.rowBytes  = layout.elemSize1*layout.channels*static_cast<std::size_t>(cols);
+			return layout;
+		}
+
+		// fields of the 8 mat header words, the sizes of dims > 2 follow the header and are set by the caller (then storedMatSize)
+		bool decodeMatHeader(const uint32_t* values, uint32_t headerFlags, CVMatTreeStructBin::MatHeader& header)
+		{
+			header.depth      = static_cast<int>(values[0]);
+			header.channels   = static_cast<int>(values[1]);
+			header.rows       = static_cast<int>(values[2]);
+			header.cols       = static_cast<int>(values[3]);
+			header.codec      = static_cast<CVMatTreeBinCodec::Codec>(values[4] & codecMask);
+			header.filters    = (values[4] >> codecBits) & filtersMask;
+			header.chunkBytes = values[5];
+			if(!isHandledDepth(values[0]))
+				return false;
+
+			const uint32_t dims = values[4] >> dimsShift;
+			header.dims    = 2;
+			header.size[0] = header.rows;
+			header.size[1] = header.cols;
+			if(dims != 0)
+			{
+				if(!(headerFlags & HeaderFlags::NDims) || dims <= 2 || dims > CV_MAX_DIM)
+					return false;
+				header.dims = static_cast<int>(dims);
+			}
+			return true;
+		}
+
+		uint64_t storedMatSize(const uint32_t* values, const CVMatTreeStructBin::MatHeader& header)
+		{
+			return header.codec == CVMatTreeBinCodec::Codec::None
+			     ? header.payloadSize()
+			     : (static_cast<uint64_t>(values[7]) << 32) | values[6];
+		}
+
+		uint32_t writeHeaderFlags(const CVMatTreeStructBin::WriteOptions& options)
+		{
+			uint32_t flags = 0;
+			if(options.index)
+				flags |= HeaderFlags::Indexed;
+			if(options.codec != CVMatTreeBinCodec::Codec::None)
+				flags |= HeaderFlags::Compressed;
+			if(options.wideCounts)
+				flags |= HeaderFlags::Wide;
+			if(options.ndMats)
+				flags |= HeaderFlags::NDims;
+			return flags;
+		}
+
+		// enables the format options required by the tree: wideCounts if a dir, list or string exceeds the uint32 lengths, ndMats for mats with more than 2 dims
+		void addRequiredOptions(const CVMatTree& node, CVMatTreeStructBin::WriteOptions& options)
+		{
+			const uint64_t maxCount = std::numeric_limits<uint32_t>::max();
+			switch(node.type())
+			{
+				case CVMatTree::Type::Dir:
+					options.wideCounts |= node.getNodeDir().size() > maxCount;
+					for(const CVMatTree::NodePair& pair : node.getNodeDir())
 					{
-						readBinStream(stream, mi);
-						++mi;
+						options.wideCounts |= static_cast<const std::string&>(pair.first).size() > maxCount;
+						addRequiredOptions(*pair.second, options);
 					}
+					break;
+				case CVMatTree::Type::List:
+					options.wideCounts |= node.getNodeList().size() > maxCount;
+					for(const CVMatTree* subNode : node.getNodeList())
+						addRequiredOptions(*subNode, options);
+					break;
+				case CVMatTree::Type::String:
+					options.wideCounts |= node.getString().size() > maxCount;
+					break;
+				case CVMatTree::Type::Mat:
+					options.ndMats |= node.getMat().dims > 2;
+					break;
+				default:
+					break;
+			}
+		}
+
+		CVMatTreeStructBin::WriteOptions withRequiredOptions(const CVMatTreeStructBin::WriteOptions& options, const CVMatTree& tree)
+		{
+			CVMatTreeStructBin::WriteOptions result = options;
+			addRequiredOptions(tree, result);
+			return result;
+		}
+
+		// existing mats (readBinInto) are kept if they have the size and type of the header
+		void createMat(cv::Mat& mat, const CVMatTreeStructBin::MatHeader& header)
+		{
+			if(!mat.isContinuous())
+				mat.release();
+			mat.create(header.dims, header.size.data(), header.type());
+		}
+
+		// reads a name of the given length and compares it with key without allocation, the name is stored only if it differs
+		template<typename Stream>
+		bool readNameEquals(Stream& stream, const std::string& key, std::size_t length, std::string& name)
+		{
+			if(length != key.size())
+			{
+				readString(stream, name, length);
+				return false;
+			}
+
+			char buffer[256];
+			for(std::size_t pos = 0; pos < length;)
+			{
+				const std::size_t n = std::min(sizeof(buffer), length - pos);
+				stream.read(buffer, static_cast<std::streamsize>(n));
+				if(std::memcmp(buffer, key.data() + pos, n) != 0)
+				{
+					name.assign(key, 0, pos);
+					name.append(buffer, n);
+					name.resize(length);
+					stream.read(&name[pos + n], static_cast<std::streamsize>(length - pos - n));
+					return false;
 				}
+				pos += n;
+			}
+			return true;
+		}
+	}
+
+	uint64_t CVMatTreeStructBin::writePosition() const
+	{
+		return static_cast<uint64_t>(ostream->tellp() - streamBegin) + deferredBytes;
+	}
+
+	void CVMatTreeStructBin::deferMatPayload(const cv::Mat& mat)
+	{
+		const std::size_t rows       = matRows(mat);
+		const std::size_t rowBytes   = matRowBytes(mat);
+		const std::size_t chunkRows  = std::max<std::size_t>(1, parallelChunkBytes/std::max<std::size_t>(1, rowBytes));
+		const std::size_t structOffset = static_cast<std::size_t>(ostream->tellp() - streamBegin);
+
+		for(std::size_t row = 0; row < rows; row += chunkRows)
+		{
+			PayloadChunk chunk;
+			chunk.structOffset = structOffset;
+			chunk.mat          = &mat;
+			chunk.rowBegin     = row;
+			chunk.rowEnd       = std::min(rows, row + chunkRows);
+			chunk.size         = rowBytes*(chunk.rowEnd - row);
+			deferredBytes += chunk.size;
+			payloadChunks->push_back(chunk);
+		}
+	}
+
+	bool CVMatTreeStructBin::writeBinParallel(std::ostream& stream, const CVMatTree& tree, const WriteOptions& options)
+	{
+		// first pass: structure (headers, names, index) into a buffer, mat payloads are only recorded
+		std::vector<CVMatTreeBinIndex::Entry> entries;
+		std::vector<PayloadChunk> chunks;
+		std::ostringstream structureStream(std::ios::binary | std::ios::out);
+
+		CVMatTreeStructBin writer(structureStream);
+		writer.payloadChunks = &chunks;
+		if(options.index)
+			writer.indexEntries = &entries;
+
+		writer.writeHeader(withRequiredOptions(options, tree));
+		writer.handleNodeWrite(tree);
+		if(options.index)
+			writer.writeIndex();
+		if(!structureStream.good())
+			return false;
+
+		const std::string structure = structureStream.str();
+
+		// second pass: windows of payload chunks are serialized in parallel while the previous window is written
+		// two sets of buffers are used alternately, so their memory is reused
+		typedef std::vector<std::string> Buffers;
+		Buffers buffers[2];
+		auto serializeWindow = [&chunks](Buffers* windowBuffers, std::size_t begin, std::size_t end)
+		{
+			if(windowBuffers->size() < end - begin)
+				windowBuffers->resize(end - begin);
+			cv::parallel_for_(cv::Range(0, static_cast<int>(end - begin)), [&](const cv::Range& range)
+			{
+				for(int i = range.start; i < range.end; ++i)
+					chunks[begin + static_cast<std::size_t>(i)].serialize((*windowBuffers)[static_cast<std::size_t>(i)]);
+			});
+		};
+		auto windowEnd = [&chunks](std::size_t begin)
+		{
+			std::size_t bytes = 0;
+			std::size_t end   = begin;
+			while(end < chunks.size() && (end == begin || bytes + chunks[end].size <= parallelWindowBytes))
+				bytes += chunks[end++].size;
+			return end;
+		};
+
+		std::size_t structPos   = 0;
+		std::size_t begin       = 0;
+		std::size_t end         = windowEnd(begin);
+		int         bufferIndex = 0;
+		std::future<void> window = std::async(std::launch::async, serializeWindow, &buffers[bufferIndex], begin, end);
+		while(begin < chunks.size())
+		{
+			window.get();
+			const Buffers& windowBuffers = buffers[bufferIndex];
+			const std::size_t nextEnd = windowEnd(end);
+			bufferIndex = 1 - bufferIndex;
+			if(end < chunks.size())
+				window = std::async(std::launch::async, serializeWindow, &buffers[bufferIndex], end, nextEnd);
+
+			for(std::size_t i = begin; i < end; ++i)
+			{
+				const PayloadChunk& chunk = chunks[i];
+				stream.write(structure.data() + structPos, static_cast<std::streamsize>(chunk.structOffset - structPos));
+				stream.write(windowBuffers[i - begin].data(), static_cast<std::streamsize>(chunk.size));
+				structPos = chunk.structOffset;
 			}
+			begin = end;
+			end   = nextEnd;
 		}
+		stream.write(structure.data() + structPos, static_cast<std::streamsize>(structure.size() - structPos));
 
+		return stream.good();
 	}
 
 
 	bool CVMatTreeStructBin::writeBin(const std::string& filename, const CVMatTree& tree)
 	{
+		return writeBin(filename, tree, WriteOptions());
+	}
+	
+	bool CVMatTreeStructBin::writeBin(std::ostream& stream, const CVMatTree& tree)
+	{
+		return writeBin(stream, tree, WriteOptions());
+	}
+
+	bool CVMatTreeStructBin::writeBin(const std::string& filename, const CVMatTree& tree, const WriteOptions& options)
+	{
+#ifdef CVMATTREE_WRITEV
+		// uncompressed files with writev (writeBinFd), the payloads are not copied through a stream buffer
+		if(options.codec == CVMatTreeBinCodec::Codec::None)
+		{
+			const int fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+			if(fd < 0)
+				return false;
+			const bool ret = writeBinFd(fd, tree, options);
+			return ::close(fd) == 0 && ret;
+		}
+#endif
+
 		std::ofstream stream(filename, std::ios::binary | std::ios::out);
 		if(!stream.good())
 			return false;
-		
-		return writeBin(stream, tree);
+
+		return writeBin(stream, tree, options);
 	}
-	
-	bool CVMatTreeStructBin::writeBin(std::ostream& stream, const CVMatTree& tree)
+
+	bool CVMatTreeStructBin::writeBin(std::ostream& stream, const CVMatTree& tree, const WriteOptions& options)
 	{
+		if(options.parallel)
+			return writeBinParallel(stream, tree, options);
+
+		std::vector<CVMatTreeBinIndex::Entry> entries;
+
 		CVMatTreeStructBin writer(stream);
-		writer.writeHeader();
+		if(options.index)
+			writer.indexEntries = &entries;
+
+		writer.writeHeader(withRequiredOptions(options, tree));
 		writer.handleNodeWrite(tree);
+		if(options.index)
+			writer.writeIndex();
 
+		return stream.good();
+	}
+
+	bool CVMatTreeStructBin::writeBin(const std::string& filename, const cv::Mat& mat)
+	{
+		std::ofstream stream(filename, std::ios::binary | std::ios::out);
+		if(!stream.good())
+			return false;
+
+		CVMatTree tree;
+		tree.getMat() = mat;
+
+		return writeBin(stream, tree);
+	}
+
+
+	struct CVMatTreeStructBin::StreamWriter::Container
+	{
+		std::streampos countPos;                                       // position of the element count, backpatched by end()
+		uint64_t       count            = 0;
+		bool           list             = false;
+		bool           keyPending       = false;                       // dir: key written, node missing
+		std::size_t    indexPos         = 0;
+		std::size_t    parentPathLength = 0;
+		std::size_t    pathLength       = 0;
+	};
+
+	CVMatTreeStructBin::StreamWriter::StreamWriter(std::ostream& stream)
+	: StreamWriter(stream, WriteOptions())
+	{
+	}
+
+	CVMatTreeStructBin::StreamWriter::StreamWriter(const std::string& filename)
+	: StreamWriter(filename, WriteOptions())
+	{
+	}
+
+	CVMatTreeStructBin::StreamWriter::StreamWriter(std::ostream& stream, const WriteOptions& options)
+	{
+		init(stream, options);
+	}
+
+	CVMatTreeStructBin::StreamWriter::StreamWriter(const std::string& filename, const WriteOptions& options)
+	: file(std::make_unique<std::ofstream>(filename, std::ios::binary | std::ios::out))
+	{
+		init(*file, options);
+	}
+
+	CVMatTreeStructBin::StreamWriter::~StreamWriter()
+	{
+		finish();
+	}
+
+	void CVMatTreeStructBin::StreamWriter::init(std::ostream& stream, const WriteOptions& options)
+	{
+		writer.reset(new CVMatTreeStructBin(stream));
+		if(options.index)
+			writer->indexEntries = &indexEntries;
+
+		if(!stream.good())
+		{
+			fail();
+			return;
+		}
+
+		writer->writeHeader(options);
+		if(writer->streamBegin == std::streampos(-1) || !stream.good())   // not seekable
+			fail();
+	}
+
+	bool CVMatTreeStructBin::StreamWriter::beginNode()
+	{
+		if(failed || finished)
+			return false;
+
+		if(containers.empty())
+		{
+			if(rootWritten)
+				return fail();
+			rootWritten = true;
+			return true;
+		}
+
+		Container& parent = containers.back();
+		std::string& path = writer->nodePath;
+		if(parent.list)
+			CVMatTreeBinIndex::appendPathSegment(path, boost::lexical_cast<std::string>(parent.count++));
+		else
+		{
+			if(!parent.keyPending)
+				return fail();
+			parent.keyPending = false;
+			CVMatTreeBinIndex::appendPathSegment(path, pendingKey);
+		}
+		return true;
+	}
+
+	bool CVMatTreeStructBin::StreamWriter::beginContainer(CVMatTree::Type type)
+	{
+		if(!beginNode())
+			return false;
+
+		Container container;
+		container.list             = type == CVMatTree::Type::List;
+		container.parentPathLength = containers.empty() ? 0 : containers.back().pathLength;
+		container.pathLength       = writer->nodePath.size();
+
+		if(writer->indexEntries)
+		{
+			CVMatTreeBinIndex::Entry entry;
+			entry.path   = writer->nodePath;
+			entry.offset = writer->writePosition();
+			entry.type   = static_cast<uint32_t>(type);
+			container.indexPos = indexEntries.size();
+			indexEntries.push_back(entry);
+		}
+
+		std::ostream* stream = writer->ostream;
+		writeBin2Stream<uint32_t>(stream, static_cast<uint32_t>(type));
+		container.countPos = stream->tellp();
+		writer->writeCount(0);
+		if(!stream->good())
+			return fail();
+
+		containers.push_back(container);
+		return true;
+	}
+
+	bool CVMatTreeStructBin::StreamWriter::beginDir()
+	{
+		return beginContainer(CVMatTree::Type::Dir);
+	}
+
+	bool CVMatTreeStructBin::StreamWriter::beginList()
+	{
+		return beginContainer(CVMatTree::Type::List);
+	}
+
+	bool CVMatTreeStructBin::StreamWriter::key(const std::string& name)
+	{
+		if(failed || finished)
+			return false;
+		if(containers.empty() || containers.back().list || containers.back().keyPending)
+			return fail();
+
+		writer->writeString(name);
+		++containers.back().count;
+		containers.back().keyPending = true;
+		pendingKey = name;
+		return writer->ostream->good() || fail();
+	}
+
+	bool CVMatTreeStructBin::StreamWriter::end()
+	{
+		if(failed || finished)
+			return false;
+		if(containers.empty() || containers.back().keyPending)
+			return fail();
+
+		const Container& container = containers.back();
+		if(writer->indexEntries)
+		{
+			CVMatTreeBinIndex::Entry& entry = indexEntries[container.indexPos];
+			entry.size = writer->writePosition() - entry.offset;
+		}
+
+		std::ostream* stream = writer->ostream;
+		const std::streampos endPos = stream->tellp();
+		stream->seekp(container.countPos);
+		writer->writeCount(container.count);
+		stream->seekp(endPos);
+
+		writer->nodePath.resize(container.parentPathLength);
+		containers.pop_back();
+		return stream->good() || fail();
+	}
+
+	bool CVMatTreeStructBin::StreamWriter::writeTree(const CVMatTree& tree)
+	{
+		if(!beginNode())
+			return false;
+
+		writer->handleNodeWrite(tree);
+		writer->nodePath.resize(containers.empty() ? 0 : containers.back().pathLength);
+		return writer->ostream->good() || fail();
+	}
+
+	bool CVMatTreeStructBin::StreamWriter::writeMat(const cv::Mat& mat)
+	{
+		CVMatTree node;
+		node.getMat() = mat;
+		return writeTree(node);
+	}
+
+	bool CVMatTreeStructBin::StreamWriter::writeString(const std::string& str)
+	{
+		CVMatTree node;
+		node.getString() = str;
+		return writeTree(node);
+	}
+
+	bool CVMatTreeStructBin::StreamWriter::finish()
+	{
+		if(finished)
+			return !failed;
+
+		while(!containers.empty() && end())
+			;
+		if(!rootWritten)
+			writeTree(CVMatTree());                                    // same as writeBin of an empty tree
+
+		if(!failed)
+		{
+			if(writer->indexEntries)
+				writer->writeIndex();
+			writer->ostream->flush();
+			if(!writer->ostream->good())
+				fail();
+		}
+
+		finished = true;
+		return !failed;
+	}
+
+
+	CVMatTree CVMatTreeStructBin::readBin(std::istream& stream, CallbackStepper* callbackStepper)
+	{
+		CVMatTreeStructBin reader(stream);
+		CVMatTree tree;
+
+		if(reader.readHeader())
+		{
+			reader.handleNodeRead(tree, callbackStepper);
+		}
+
+		return tree;
+	}
+
+	bool CVMatTreeStructBin::readBinInto(CVMatTree& tree, const std::string& filename)
+	{
+		std::ifstream stream(filename, std::ios::binary | std::ios::in);
+		if(!stream.good())
+			return false;
+
+		return readBinInto(tree, stream);
+	}
+
+	bool CVMatTreeStructBin::readBinInto(CVMatTree& tree, std::istream& stream)
+	{
+		CVMatTreeStructBin reader(stream);
+		if(!reader.readHeader())
+			return false;
+
+		return reader.readNodeInto(tree);
+	}
+
+	CVMatTree CVMatTreeStructBin::readBin(const std::string& filename, Callback* callback)
+	{
+		return readBin(filename, ReadOptions(), callback);
+	}
+
+	CVMatTree CVMatTreeStructBin::readBin(const std::string& filename, const ReadOptions& options, Callback* callback)
+	{
+		std::size_t filesize = sfs::file_size(filename);
+		CppFW::CallbackStepper callbackStepper(callback, filesize);
+
+		std::ifstream stream(filename, std::ios::binary | std::ios::in);
+		if(!stream.good())
+			return CVMatTree();
+
+		CVMatTreeStructBin reader(stream);
+		CVMatTree tree = options.arena ? CVMatTree(*options.arena) : CVMatTree();
+
+		const MatConversion conversion(options);
+		if(conversion.active())
+			reader.matConversion = &conversion;
+
+		std::vector<PayloadRead> payloadReads;
+		if(options.parallel && !options.lazy)
+			reader.payloadReads = &payloadReads;
+
+		if(reader.readHeader())
+		{
+			// with an index (trailer or sidecar) the tree is built from the index without walking the structure
+			const std::streampos rootPos = stream.tellg();
+			CVMatTreeBinIndex index;
+			if(reader.payloadReads && reader.loadIndex(filename, index) && reader.readFromIndex(tree, index))
+				callbackStepper.setStep(filesize);
+			else
+			{
+				tree.clear();
+				payloadReads.clear();
+				stream.clear();
+				stream.seekg(rootPos);
+				reader.nodePath.clear();
+
+				if(options.lazy)
+					reader.lazyLoader = std::make_shared<LazyLoader>(filename, reader.headerFlags);
+				reader.handleNodeRead(tree, &callbackStepper);
+			}
+		}
+
+		// the structure reader only seeks over the payloads, a truncated file is detected here
+		if(!payloadReads.empty() && !readPayloadsParallel(filename, payloadReads))
+			tree.clear();
+
+		return tree;
+	}
+
+	struct CVMatTreeStructBin::PathSelection
+	{
+		std::vector<std::pair<const PathPattern*, std::size_t>> patterns;   // pattern and number of matched segments
+		bool complete = false;                                         // a pattern is matched completely, the whole subtree is selected
+
+		bool empty() const                                             { return !complete && patterns.empty(); }
+
+		void add(const PathPattern& pattern, std::size_t matched)
+		{
+			if(matched == pattern.size() || (matched + 1 == pattern.size() && pattern[matched] == "**"))
+				complete = true;
+			else
+				patterns.emplace_back(&pattern, matched);
+		}
+
+		void advance(const PathPattern& pattern, std::size_t matched, const std::string& name)
+		{
+			const std::string& segment = pattern[matched];
+			if(segment == "**")
+			{
+				add(pattern, matched);                                     // ** consumes the segment
+				advance(pattern, matched + 1, name);                       // ** matches no segment (not the last one, see add)
+			}
+			else if(matchPathSegment(segment, name))
+				add(pattern, matched + 1);
+		}
+
+		PathSelection child(const std::string& name) const
+		{
+			PathSelection result;
+			for(const std::pair<const PathPattern*, std::size_t>& pattern : patterns)
+			{
+				result.advance(*pattern.first, pattern.second, name);
+				if(result.complete)
+					break;
+			}
+			return result;
+		}
+	};
+
+	CVMatTree CVMatTreeStructBin::readBin(const std::string& filename, const std::vector<std::string>& selector)
+	{
+		std::ifstream stream(filename, std::ios::binary | std::ios::in);
+		if(!stream.good())
+			return CVMatTree();
+
+		return readBin(stream, selector);
+	}
+
+	CVMatTree CVMatTreeStructBin::readBin(std::istream& stream, const std::vector<std::string>& selector)
+	{
+		CVMatTreeStructBin reader(stream);
+		CVMatTree tree;
+
+		std::vector<PathPattern> patterns;
+		patterns.reserve(selector.size());
+		for(const std::string& pattern : selector)
+			patterns.push_back(splitPathPattern(pattern));
+
+		PathSelection selection;
+		for(const PathPattern& pattern : patterns)
+			selection.add(pattern, 0);
+
+		if(reader.readHeader() && (selection.complete || !selection.patterns.empty()))
+			reader.readSelected(tree, selection);
+
+		return tree;
+	}
+
+	CVMatTree CVMatTreeStructBin::readNode(const std::string& filename, const std::string& path)
+	{
+		std::ifstream stream(filename, std::ios::binary | std::ios::in);
+		if(!stream.good())
+			return CVMatTree();
+
+		CVMatTreeStructBin reader(stream);
+		CVMatTree tree;
+		if(!reader.readHeader())
+			return tree;
+
+		CVMatTreeBinIndex index;
+		if(!reader.loadIndex(filename, index))
+		{
+			if(reader.seekNode(path))
+				reader.handleNodeRead(tree, nullptr);
+			return tree;
+		}
+
+		const CVMatTreeBinIndex::Entry* entry = index.find(CVMatTreeBinIndex::normalizePath(path));
+		if(entry)
+		{
+			stream.seekg(reader.streamBegin + static_cast<std::streamoff>(entry->offset));
+			reader.handleNodeRead(tree, nullptr);
+		}
+		return tree;
+	}
+
+	CVMatTree CVMatTreeStructBin::readNode(std::istream& stream, const std::string& path)
+	{
+		CVMatTreeStructBin reader(stream);
+		CVMatTree tree;
+
+		if(!reader.readHeader())
+			return tree;
+
+		if(reader.headerFlags & HeaderFlags::Indexed)
+		{
+			const std::streampos rootPos = stream.tellg();
+
+			CVMatTreeBinIndex index;
+			if(reader.readIndexTrailer(index))
+			{
+				const CVMatTreeBinIndex::Entry* entry = index.find(CVMatTreeBinIndex::normalizePath(path));
+				if(entry)
+				{
+					stream.seekg(reader.streamBegin + static_cast<std::streamoff>(entry->offset));
+					reader.handleNodeRead(tree, nullptr);
+				}
+				return tree;
+			}
+
+			stream.clear();
+			stream.seekg(rootPos);
+		}
+
+		if(reader.seekNode(path))
+			reader.handleNodeRead(tree, nullptr);
+
+		return tree;
+	}
+
+	CVMatTreeBinIndex CVMatTreeStructBin::readIndex(const std::string& filename)
+	{
+		CVMatTreeBinIndex index;
+
+		std::ifstream stream(filename, std::ios::binary | std::ios::in);
+		if(!stream.good())
+			return index;
+
+		CVMatTreeStructBin reader(stream);
+		if(reader.readHeader())
+			reader.loadIndex(filename, index);
+
+		return index;
+	}
+
+	CVMatTree CVMatTreeStructBin::mapBin(const std::string& filename, Callback* callback)
+	{
+		namespace bip = boost::interprocess;
+
+		std::shared_ptr<MappedRegion> region;
+		try
+		{
+			bip::file_mapping mapping(filename.c_str(), bip::read_only);
+			region = std::make_shared<MappedRegion>(mapping, bip::copy_on_write);
+		}
+		catch(const bip::interprocess_exception&)
+		{
+			return CVMatTree();
+		}
+
+		const char* data = static_cast<const char*>(region->get_address());
+		const std::size_t size = region->get_size();
+
+		CppFW::CallbackStepper callbackStepper(callback, size);
+
+		CVMatTreeStructBin reader(data, size);
+		reader.shareBuffer = true;
+		reader.mappedFile  = region;
+
+		CVMatTree tree;
+		if(reader.readHeader())
+			reader.handleNodeRead(tree, &callbackStepper);
+
+		return tree;
+	}
+
+
+
+
+	void CVMatTreeStructBin::writeDir(const CVMatTree& node)
+	{
+		const CVMatTree::NodeDir& nodes = node.getNodeDir();
+
+		writeCount(nodes.size());
+		forEachDirEntry(nodes, dirsByName, [this](const CVMatTree::NodePair& pair)
+		{
+			const std::string& name  = pair.first;
+			const CVMatTree* subNode = pair.second;
+
+			writeString(name);
+
+			if(indexEntries)
+			{
+				const std::size_t pathLength = nodePath.size();
+				CVMatTreeBinIndex::appendPathSegment(nodePath, name);
+				handleNodeWrite(*subNode);
+				nodePath.resize(pathLength);
+			}
+			else
+				handleNodeWrite(*subNode);
+		});
+	}
+
+
+	bool CVMatTreeStructBin::readDir(CVMatTree& node, CallbackStepper* callbackStepper)
+	{
+		bool ret = true;
+		const uint64_t dirLength = readCount();
+		const bool     trackPath = matConversion && matConversion->tracksPath();
+		const std::size_t pathLength = nodePath.size();
+		std::string name;
+		for(uint64_t i=0; i<dirLength && input.good(); ++i)     // a corrupt count ends with the stream
+		{
+			if(!readString(name))
+				return false;
+			if(trackPath)
+				CVMatTreeBinIndex::appendPathSegment(nodePath, name);
+
+			ret &= handleNodeRead(node.getDirNode(name), callbackStepper);
+			nodePath.resize(pathLength);
+		}
+		return ret;
+	}
+
+
+	void CVMatTreeStructBin::writeList(const CVMatTree& node)
+	{
+		const CVMatTree::NodeList& nodes = node.getNodeList();
+
+		writeCount(nodes.size());
+		if(indexEntries)
+		{
+			const std::size_t pathLength = nodePath.size();
+			std::size_t listIndex = 0;
+			for(const CVMatTree* subNode : nodes)
+			{
+				CVMatTreeBinIndex::appendPathSegment(nodePath, boost::lexical_cast<std::string>(listIndex++));
+				handleNodeWrite(*subNode);
+				nodePath.resize(pathLength);
+			}
+			return;
+		}
+
+		for(const CVMatTree* subNode : nodes)
+		{
+			handleNodeWrite(*subNode);
+		}
+	}
+
+	bool CVMatTreeStructBin::readList(CVMatTree& node, CallbackStepper* callbackStepper)
+	{
+		bool ret = true;
+		const uint64_t listLength = readCount();
+		const bool     trackPath = matConversion && matConversion->tracksPath();
+		const std::size_t pathLength = nodePath.size();
+		for(uint64_t i=0; i<listLength && input.good(); ++i)
+		{
+			if(trackPath)
+				CVMatTreeBinIndex::appendPathSegment(nodePath, boost::lexical_cast<std::string>(i));
+
+			ret &= handleNodeRead(node.newListNode(), callbackStepper);
+			nodePath.resize(pathLength);
+		}
+		return ret;
+	}
+
+
+
+	void CVMatTreeStructBin::handleNodeWrite(const CVMatTree& node)
+	{
+		std::size_t indexPos = 0;
+		if(indexEntries)
+		{
+			indexPos = indexEntries->size();
+			indexEntries->push_back(indexEntry(node, nodePath, writePosition()));
+		}
+
+		handleNodeWriteData(node);
+
+		if(indexEntries)
+		{
+			CVMatTreeBinIndex::Entry& entry = (*indexEntries)[indexPos];
+			entry.size = writePosition() - entry.offset;
+		}
+	}
+
+	void CVMatTreeStructBin::handleNodeWriteData(const CVMatTree& node)
+	{
+		writeBin2Stream<uint32_t>(ostream, static_cast<uint32_t>(node.type()));
+		switch(node.type())
+		{
+			case CVMatTree::Type::Undef:
+				break;
+			case CVMatTree::Type::Dir:
+				writeDir(node);
+				break;
+			case CVMatTree::Type::List:
+				writeList(node);
+				break;
+			case CVMatTree::Type::Mat:
+				writeMatP(node.getMat());
+				break;
+			case CVMatTree::Type::String:
+				writeString(node.getString());
+				break;
+		}
+	}
+	
+
+	bool CVMatTreeStructBin::handleNodeRead(CVMatTree& node, CallbackStepper* callbackStepper)
+	{
+		assert(node.type() == CVMatTree::Type::Undef);
+
+		if(callbackStepper)
+		{
+			if(!callbackStepper->setStep(input.tellg()))
+				return false;
+		}
+		
+		uint32_t type = readBinStream<uint32_t>(input);
+		switch(static_cast<CVMatTree::Type>(type))
+		{
+			case CVMatTree::Type::Undef:
+				return true;
+			case CVMatTree::Type::Dir:
+				return readDir(node, callbackStepper);
+			case CVMatTree::Type::List:
+				return readList(node, callbackStepper);
+			case CVMatTree::Type::Mat:
+				if(lazyLoader)
+					return readLazy(node, CVMatTree::Type::Mat);
+				return readMatP(node.getMat());
+			case CVMatTree::Type::String:
+				if(lazyLoader)
+					return readLazy(node, CVMatTree::Type::String);
+				return readString(node.getString());
+		}
+		return false;
+	}
+
+	bool CVMatTreeStructBin::readNodeInto(CVMatTree& node)
+	{
+		const uint32_t type = readBinStream<uint32_t>(input);
+		if(!input.good())
+			return false;
+
+		node.invalidateContentHash();
+		const CVMatTree::Type nodeType = static_cast<CVMatTree::Type>(type);
+		if(node.type() != nodeType || !node.isPayloadLoaded())
+			node.clear();
+
+		switch(nodeType)
+		{
+			case CVMatTree::Type::Undef:
+				return true;
+			case CVMatTree::Type::Dir:
+				return readDirInto(node);
+			case CVMatTree::Type::List:
+				return readListInto(node);
+			case CVMatTree::Type::Mat:
+				return readMatP(node.getMat());
+			case CVMatTree::Type::String:
+				return readString(node.getString());
+		}
+		return false;
+	}
+
+	bool CVMatTreeStructBin::readDirInto(CVMatTree& node)
+	{
+		const uint64_t dirLength = readCount();
+		if(!input.good())
+			return false;
+		if(dirLength == 0)                                             // as readDir
+		{
+			node.clear();
+			return true;
+		}
+
+		// the entries are reused in place as long as the names match the existing dir in order
+		std::string name;
+		uint64_t matched = 0;
+		bool     pendingName = false;                                  // name of entry matched is read
+		if(node.type() == CVMatTree::Type::Dir && node.getNodeDir().size() == dirLength)
+		{
+			const CVMatTree::NodeDir& dir = node.getNodeDir();
+			for(CVMatTree::NodeDir::const_iterator it = dir.begin(); it != dir.end(); ++it, ++matched)
+			{
+				if(!readNameEquals(input, it->first, static_cast<std::size_t>(readCount()), name))
+				{
+					pendingName = true;
+					break;
+				}
+				if(!readNodeInto(*it->second))
+					return false;
+			}
+			if(matched == dirLength)
+				return true;
+		}
+
+		// the dir is rebuilt, subnodes of the existing dir with the same name are moved into it
+		CVMatTree previous(std::move(node));
+		if(previous.type() == CVMatTree::Type::Dir)
+		{
+			const CVMatTree::NodeDir& previousDir = previous.getNodeDir();
+			for(CVMatTree::NodeDir::const_iterator it = previousDir.begin(); it != previousDir.begin() + static_cast<std::ptrdiff_t>(matched); ++it)
+				node.getDirNode(it->first) = std::move(*it->second);
+		}
+
+		for(uint64_t i = matched; i < dirLength && input.good(); ++i)
+		{
+			if((!pendingName || i != matched) && !readString(name))
+				return false;
+
+			CVMatTree& subNode = node.getDirNode(name);
+			if(previous.getDirNodeOpt(name))
+				subNode = std::move(previous.getDirNode(name));
+			if(!readNodeInto(subNode))
+				return false;
+		}
+		return input.good();
+	}
+
+	bool CVMatTreeStructBin::readListInto(CVMatTree& node)
+	{
+		const uint64_t listLength = readCount();
+		if(!input.good())
+			return false;
+		if(listLength == 0)                                            // as readList
+		{
+			node.clear();
+			return true;
+		}
+
+		if(node.type() == CVMatTree::Type::List && node.getNodeList().size() > listLength)
+		{
+			// shorter list: the first elements are moved into a new list
+			CVMatTree previous(std::move(node));
+			for(uint64_t i = 0; i < listLength; ++i)
+				node.newListNode() = std::move(previous.getListNode(static_cast<std::size_t>(i)));
+		}
+
+		const std::size_t existing = node.type() == CVMatTree::Type::List ? node.getNodeList().size() : 0;
+		for(uint64_t i = 0; i < listLength; ++i)
+		{
+			CVMatTree& element = i < existing ? node.getListNode(static_cast<std::size_t>(i)) : node.newListNode();
+			if(!readNodeInto(element))
+				return false;
+		}
+		return true;
+	}
+
+	bool CVMatTreeStructBin::handleNodeEvents(EventHandler& handler)
+	{
+		uint32_t type = readBinStream<uint32_t>(input);
+		if(!input.good())
+			return false;
+
+		switch(static_cast<CVMatTree::Type>(type))
+		{
+			case CVMatTree::Type::Undef:
+				return handler.undef();
+			case CVMatTree::Type::Dir:
+			{
+				const uint64_t dirLength = readCount();
+				if(!input.good() || !handler.beginDir(dirLength))
+					return false;
+				std::string name;
+				for(uint64_t i=0; i<dirLength; ++i)
+				{
+					readString(name);
+					if(!input.good() || !handler.key(name) || !handleNodeEvents(handler))
+						return false;
+				}
+				return handler.end();
+			}
+			case CVMatTree::Type::List:
+			{
+				const uint64_t listLength = readCount();
+				if(!input.good() || !handler.beginList(listLength))
+					return false;
+				for(uint64_t i=0; i<listLength; ++i)
+					if(!handleNodeEvents(handler))
+						return false;
+				return handler.end();
+			}
+			case CVMatTree::Type::Mat:
+			{
+				MatHeader header;
+				if(!readMatHeader(header))
+					return false;
+
+				MatPayload payload(input, header, header.payloadSize());
+				std::string decompressed;
+				if(header.codec != CVMatTreeBinCodec::Codec::None)
+				{
+					decompressed.resize(header.payloadSize());
+					if(!readCompressedPayload(header, &decompressed[0]))
+						return false;
+					payload.data = decompressed.data();
+				}
+
+				if(!handler.mat(header, payload))
+					return false;
+				if(!payload.data)
+					skipBinStream(input, payload.remaining());
+				return input.good();
+			}
+			case CVMatTree::Type::String:
+			{
+				std::string str;
+				readString(str);
+				return input.good() && handler.string(str);
+			}
+		}
+		return false;
+	}
+
+	bool CVMatTreeStructBin::readMatHeader(MatHeader& header)
+	{
+		uint32_t values[8] = {};
+		readBinStream<uint32_t>(input, values, 8);
+		if(!input.good() || !decodeMatHeader(values, headerFlags, header))
+			return false;
+
+		for(int i = 2; i < header.dims; ++i)
+			header.size[static_cast<std::size_t>(i)] = static_cast<int>(readBinStream<uint32_t>(input));
+		if(!input.good())
+			return false;
+
+		header.storedSize = storedMatSize(values, header);
+		return true;
+	}
+
+	std::size_t CVMatTreeStructBin::MatHeader::total() const
+	{
+		std::size_t total = 1;
+		for(int i = 0; i < dims; ++i)
+			total *= static_cast<std::size_t>(size[static_cast<std::size_t>(i)]);
+		return total;
+	}
+
+	bool CVMatTreeStructBin::readCompressedPayload(const MatHeader& header, char* data)
+	{
+		if(!CVMatTreeBinCodec::isAvailable(header.codec))
+		{
+			std::cerr << "readMatP: Unhandled codec: " << static_cast<uint32_t>(header.codec) << '\n';
+			return false;
+		}
+
+		const std::size_t storedSize = static_cast<std::size_t>(header.storedSize);
+		std::string buffer;
+		const char* compressed;
+		if(input.inMemory())
+			compressed = input.take(storedSize);
+		else
+		{
+			buffer.resize(storedSize);
+			input.read(&buffer[0], static_cast<std::streamsize>(storedSize));
+			compressed = buffer.data();
+		}
+		if(!input.good())
+			return false;
+
+		const CVMatTreeBinCodec::Layout layout = codecLayout(header.depth, header.channels, header.size[static_cast<std::size_t>(header.dims-1)]);
+		return CVMatTreeBinCodec::decompress(header.codec, header.filters, layout, compressed, storedSize, data, header.payloadSize(), header.chunkBytes);
+	}
+
+	bool CVMatTreeStructBin::MatPayload::read(void* buffer, std::size_t bytes)
+	{
+		if(bytes > remaining())
+			return false;
+		if(data)
+		{
+			std::memcpy(buffer, data + readBytes, bytes);
+			readBytes += bytes;
+			return true;
+		}
+		input.read(static_cast<char*>(buffer), static_cast<std::streamsize>(bytes));
+		readBytes += bytes;
+		return input.good();
+	}
+
+	bool CVMatTreeStructBin::MatPayload::read(cv::Mat& mat)
+	{
+		if(readBytes != 0)
+			return false;
+		createMat(mat, header);
+		return read(mat.data, payloadSize);
+	}
+
+	bool CVMatTreeStructBin::readEvents(std::istream& stream, EventHandler& handler)
+	{
+		CVMatTreeStructBin reader(stream);
+		if(!reader.readHeader())
+			return false;
+		return reader.handleNodeEvents(handler);
+	}
+
+	bool CVMatTreeStructBin::readEvents(const std::string& filename, EventHandler& handler)
+	{
+		std::ifstream stream(filename, std::ios::binary | std::ios::in);
+		if(!stream.good())
+			return false;
+		return readEvents(stream, handler);
+	}
+
+
+	bool CVMatTreeStructBin::readLazy(CVMatTree& node, CVMatTree::Type type)
+	{
+		const std::streampos position = input.tellg();
+
+		const bool ret = type == CVMatTree::Type::Mat ? skipMatP() : skipString();
+		if(ret)
+			node.setLazyPayload(type, lazyLoader, static_cast<uint64_t>(position));
+		if(ret && type == CVMatTree::Type::Mat && matConversion)
+		{
+			const int depth = matConversion->targetDepth(nodePath);   // the path is not known when the payload is loaded
+			if(depth >= 0)
+				lazyLoader->convertDepths[static_cast<uint64_t>(position)] = depth;
+		}
+		return ret;
+	}
+
+	bool CVMatTreeStructBin::skipNode()
+	{
+		uint32_t type = readBinStream<uint32_t>(input);
+		switch(static_cast<CVMatTree::Type>(type))
+		{
+			case CVMatTree::Type::Undef:
+				break;
+			case CVMatTree::Type::Dir:
+			{
+				const uint64_t dirLength = readCount();
+				for(uint64_t i=0; i<dirLength && input.good(); ++i)
+				{
+					skipBinStream(input, static_cast<std::size_t>(readCount()));
+					if(!skipNode())
+						return false;
+				}
+				break;
+			}
+			case CVMatTree::Type::List:
+			{
+				const uint64_t listLength = readCount();
+				for(uint64_t i=0; i<listLength && input.good(); ++i)
+					if(!skipNode())
+						return false;
+				break;
+			}
+			case CVMatTree::Type::Mat:
+				return skipMatP();
+			case CVMatTree::Type::String:
+				return skipString();
+			default:
+				return false;
+		}
+		return input.good();
+	}
+
+	bool CVMatTreeStructBin::skipMatP()
+	{
+		MatHeader header;
+		if(!readMatHeader(header))
+			return false;
+		skipBinStream(input, static_cast<std::size_t>(header.storedSize));
+		return input.good();
+	}
+
+	bool CVMatTreeStructBin::skipString()
+	{
+		skipBinStream(input, static_cast<std::size_t>(readCount()));
+		return input.good();
+	}
+
+	bool CVMatTreeStructBin::seekNode(const std::string& path)
+	{
+		for(const std::string& name : CVMatTreeBinIndex::splitPath(path))
+		{
+			uint32_t type = readBinStream<uint32_t>(input);
+			switch(static_cast<CVMatTree::Type>(type))
+			{
+				case CVMatTree::Type::Dir:
+				{
+					bool found = false;
+					const uint64_t dirLength = readCount();
+					std::string key;
+					for(uint64_t i=0; i<dirLength && input.good(); ++i)
+					{
+						readString(key);
+						if(key == name)
+						{
+							found = true;
+							break;
+						}
+						if(!skipNode())
+							return false;
+					}
+					if(!found)
+						return false;
+					break;
+				}
+				case CVMatTree::Type::List:
+				{
+					if(name.empty() || name.find_first_not_of("0123456789") != std::string::npos)
+						return false;
+					const uint64_t listIndex  = boost::lexical_cast<uint64_t>(name);
+					const uint64_t listLength = readCount();
+					if(listIndex >= listLength)
+						return false;
+					for(uint64_t i=0; i<listIndex; ++i)
+						if(!skipNode())
+							return false;
+					break;
+				}
+				default:
+					return false;
+			}
+		}
+		return input.good();
+	}
+
+	bool CVMatTreeStructBin::readSelected(CVMatTree& node, const PathSelection& selection)
+	{
+		if(selection.complete)
+			return handleNodeRead(node, nullptr);
+
+		uint32_t type = readBinStream<uint32_t>(input);
+		switch(static_cast<CVMatTree::Type>(type))
+		{
+			case CVMatTree::Type::Undef:
+				break;
+			case CVMatTree::Type::Dir:
+			{
+				const uint64_t dirLength = readCount();
+				std::string name;
+				for(uint64_t i=0; i<dirLength && input.good(); ++i)
+				{
+					readString(name);
+					const PathSelection childSelection = selection.child(name);
+					if(childSelection.empty())
+					{
+						if(!skipNode())
+							return false;
+					}
+					else if(childSelection.complete)
+					{
+						if(!readSelected(node.getDirNode(name), childSelection))
+							return false;
+					}
+					else
+					{
+						// the entry is only added if a subnode is selected
+						CVMatTree child;
+						if(!readSelected(child, childSelection))
+							return false;
+						if(child.type() != CVMatTree::Type::Undef)
+							node.getDirNode(name) = std::move(child);
+					}
+				}
+				break;
+			}
+			case CVMatTree::Type::List:
+			{
+				bool selected = false;
+				const uint64_t listLength = readCount();
+				for(uint64_t i=0; i<listLength && input.good(); ++i)
+				{
+					CVMatTree& element = node.newListNode();
+					const PathSelection childSelection = selection.child(boost::lexical_cast<std::string>(i));
+					if(childSelection.empty())
+					{
+						if(!skipNode())
+							return false;
+					}
+					else if(!readSelected(element, childSelection))
+						return false;
+					selected |= childSelection.complete || element.type() != CVMatTree::Type::Undef;
+				}
+				if(!selected)
+					node.clear();
+				break;
+			}
+			case CVMatTree::Type::Mat:                                 // pattern requires subnodes
+				return skipMatP();
+			case CVMatTree::Type::String:
+				return skipString();
+			default:
+				return false;
+		}
+		return input.good();
+	}
+
+	bool CVMatTreeStructBin::readIndexTrailer(CVMatTreeBinIndex& index)
+	{
+		if(!(headerFlags & HeaderFlags::Indexed))
+			return false;
+
+		input.seekg(-static_cast<std::streamoff>(sizeof(uint64_t) + sizeof(indexMagic)-1), std::ios::end);
+		const uint64_t indexPos = readBinStream<uint64_t>(input);
+		char readmagic[sizeof(indexMagic)-1];
+		input.read(readmagic, sizeof(indexMagic)-1);
+		if(!input.good() || std::memcmp(indexMagic, readmagic, sizeof(indexMagic)-1) != 0)
+			return false;
+
+		input.seekg(streamBegin + static_cast<std::streamoff>(indexPos));
+		return readIndexEntries(input, index);
+	}
+
+	bool CVMatTreeStructBin::loadIndex(const std::string& filename, CVMatTreeBinIndex& index)
+	{
+		const std::streampos rootPos = input.tellg();
+		const bool indexed = readIndexTrailer(index) || readIndexSidecar(filename, index);
+		input.clear();
+		input.seekg(rootPos);
+		return indexed;
+	}
+
+	std::string CVMatTreeStructBin::indexSidecarFilename(const std::string& filename)
+	{
+		return filename + ".idx";
+	}
+
+	bool CVMatTreeStructBin::readIndexSidecar(const std::string& filename, CVMatTreeBinIndex& index)
+	{
+		uint64_t fileSize;
+		int64_t  fileTime;
+		if(!readFileStamp(filename, fileSize, fileTime))
+			return false;
+
+		std::ifstream stream(indexSidecarFilename(filename), std::ios::binary | std::ios::in);
+		if(!stream.good())
+			return false;
+
+		char readmagic[sizeof(indexMagic)-1];
+		stream.read(readmagic, sizeof(indexMagic)-1);
+		if(!stream.good() || std::memcmp(indexMagic, readmagic, sizeof(indexMagic)-1) != 0)
+			return false;
+		if(readBinStream<uint32_t>(stream) != sidecarVersion)
+			return false;
+		if(readBinStream<uint64_t>(stream) != fileSize || readBinStream<int64_t>(stream) != fileTime)   // stale
+			return false;
+
+		return readIndexEntries(stream, index);
+	}
+
+	bool CVMatTreeStructBin::writeIndexSidecar(const std::string& filename)
+	{
+		std::ifstream stream(filename, std::ios::binary | std::ios::in);
+		if(!stream.good())
+			return false;
+
+		std::vector<CVMatTreeBinIndex::Entry> entries;
+		CVMatTreeStructBin reader(stream);
+		if(!reader.readHeader() || !reader.scanNode(entries))
+			return false;
+
+		uint64_t fileSize;
+		int64_t  fileTime;
+		if(!readFileStamp(filename, fileSize, fileTime))
+			return false;
+
+		std::ofstream sidecar(indexSidecarFilename(filename), std::ios::binary | std::ios::out);
+		sidecar.write(indexMagic, sizeof(indexMagic)-1);
+		writeBin2Stream<uint32_t>(&sidecar, sidecarVersion);
+		writeBin2Stream<uint64_t>(&sidecar, fileSize);
+		writeBin2Stream<int64_t >(&sidecar, fileTime);
+		writeIndexEntries(&sidecar, entries);
+		return sidecar.good();
+	}
+
+	bool CVMatTreeStructBin::scanNode(std::vector<CVMatTreeBinIndex::Entry>& entries)
+	{
+		const std::size_t entryPos = entries.size();
+		{
+			CVMatTreeBinIndex::Entry entry;
+			entry.path   = nodePath;
+			entry.offset = static_cast<uint64_t>(input.tellg() - streamBegin);
+			entries.push_back(entry);
+		}
+
+		const uint32_t type = readBinStream<uint32_t>(input);
+		entries[entryPos].type = type;
+		const std::size_t pathLength = nodePath.size();
+		switch(static_cast<CVMatTree::Type>(type))
+		{
+			case CVMatTree::Type::Undef:
+				break;
+			case CVMatTree::Type::Dir:
+			{
+				const uint64_t dirLength = readCount();
+				std::string name;
+				for(uint64_t i=0; i<dirLength && input.good(); ++i)
+				{
+					readString(name);
+					CVMatTreeBinIndex::appendPathSegment(nodePath, name);
+					const bool ok = scanNode(entries);
+					nodePath.resize(pathLength);
+					if(!ok)
+						return false;
+				}
+				break;
+			}
+			case CVMatTree::Type::List:
+			{
+				const uint64_t listLength = readCount();
+				for(uint64_t i=0; i<listLength && input.good(); ++i)
+				{
+					CVMatTreeBinIndex::appendPathSegment(nodePath, boost::lexical_cast<std::string>(i));
+					const bool ok = scanNode(entries);
+					nodePath.resize(pathLength);
+					if(!ok)
+						return false;
+				}
+				break;
+			}
+			case CVMatTree::Type::Mat:
+			{
+				MatHeader header;
+				if(!readMatHeader(header))
+					return false;
+				CVMatTreeBinIndex::Entry& entry = entries[entryPos];
+				entry.depth    = static_cast<uint32_t>(header.depth   );
+				entry.channels = static_cast<uint32_t>(header.channels);
+				entry.rows     = static_cast<uint32_t>(header.rows    );
+				entry.cols     = static_cast<uint32_t>(header.cols    );
+				skipBinStream(input, static_cast<std::size_t>(header.storedSize));
+				break;
+			}
+			case CVMatTree::Type::String:
+				if(!skipString())
+					return false;
+				break;
+			default:
+				return false;
+		}
+
+		entries[entryPos].size = static_cast<uint64_t>(input.tellg() - streamBegin) - entries[entryPos].offset;
+		return input.good();
+	}
+
+	bool CVMatTreeStructBin::readFromIndex(CVMatTree& tree, const CVMatTreeBinIndex& index)
+	{
+		const std::vector<CVMatTreeBinIndex::Entry>& entries = index.getEntries();
+		if(entries.empty() || !entries.front().path.empty())
+			return false;
+
+		// entries are in file order, parents before their subnodes
+		std::unordered_map<std::string, std::pair<CVMatTree*, CVMatTree::Type>> containers;
+		for(const CVMatTreeBinIndex::Entry& entry : entries)
+		{
+			CVMatTree* node = &tree;
+			if(&entry != &entries.front())
+			{
+				std::vector<std::string> segments = CVMatTreeBinIndex::splitPath(entry.path);
+				if(segments.empty())
+					return false;
+				const std::string name = std::move(segments.back());
+				segments.pop_back();
+
+				std::string parentPath;
+				for(const std::string& segment : segments)
+					CVMatTreeBinIndex::appendPathSegment(parentPath, segment);
+
+				std::string canonicalPath = parentPath;
+				CVMatTreeBinIndex::appendPathSegment(canonicalPath, name);
+				if(canonicalPath != entry.path)                                // ambiguous path (e.g. an empty name)
+					return false;
+
+				std::unordered_map<std::string, std::pair<CVMatTree*, CVMatTree::Type>>::iterator parentIt = containers.find(parentPath);
+				if(parentIt == containers.end())
+					return false;
+				CVMatTree& parent = *parentIt->second.first;
+				if(parentIt->second.second == CVMatTree::Type::List)
+				{
+					if(name != boost::lexical_cast<std::string>(parent.getNumElements()))
+						return false;
+					node = &parent.newListNode();
+				}
+				else
+				{
+					if(parent.getDirNodeOpt(name))                             // duplicate path
+						return false;
+					node = &parent.getDirNode(name);
+				}
+			}
+
+			const uint64_t position = static_cast<uint64_t>(streamBegin) + entry.offset + sizeof(uint32_t);
+			switch(static_cast<CVMatTree::Type>(entry.type))
+			{
+				case CVMatTree::Type::Undef:
+					break;
+				case CVMatTree::Type::Dir:
+				case CVMatTree::Type::List:
+					if(!containers.emplace(entry.path, std::make_pair(node, static_cast<CVMatTree::Type>(entry.type))).second)   // node type is set by the first subnode
+						return false;
+					break;
+				case CVMatTree::Type::Mat:
+					input.seekg(static_cast<std::streamoff>(position));
+					if(matConversion && matConversion->tracksPath())
+						nodePath = entry.path;
+					if(!readMatP(node->getMat()))                      // payload is deferred (payloadReads)
+						return false;
+					break;
+				case CVMatTree::Type::String:
+					input.seekg(static_cast<std::streamoff>(position));
+					readString(node->getString());
+					break;
+				default:
+					return false;
+			}
+			if(!input.good())
+				return false;
+		}
+		return true;
+	}
+
+	void CVMatTreeStructBin::writeIndex()
+	{
+		const uint64_t indexPos = writePosition();
+
+		writeIndexEntries(ostream, *indexEntries);
+
+		writeBin2Stream<uint64_t>(ostream, indexPos);
+		ostream->write(indexMagic, sizeof(indexMagic)-1);
+	}
+
+	bool CVMatTreeStructBin::readString(std::string& str)
+	{
+		const uint64_t length = readCount();
+		if(!input.good())
+			return false;
+		if(input.inMemory())                                           // the length is checked before the allocation
+		{
+			const char* data = input.take(length);
+			if(!data)
+				return false;
+			str.assign(data, static_cast<std::size_t>(length));
+			return true;
+		}
+		CppFW::readString(input, str, static_cast<std::size_t>(length));
+		return input.good();
+	}
+
+
+	void CVMatTreeStructBin::writeString(const std::string& string)
+	{
+		writeCount(string.size());
+		ostream->write(string.data(), static_cast<std::streamsize>(string.size()));
+	}
+
+
+	void CVMatTreeStructBin::writeCount(uint64_t count)
+	{
+		if(headerFlags & HeaderFlags::Wide)
+		{
+			writeBin2Stream<uint64_t>(ostream, count);
+			return;
+		}
+
+		if(count > std::numeric_limits<uint32_t>::max())       // needs WriteOptions::wideCounts
+			ostream->setstate(std::ios::failbit);
+		writeBin2Stream<uint32_t>(ostream, static_cast<uint32_t>(count));
+	}
+
+	uint64_t CVMatTreeStructBin::readCount()
+	{
+		if(headerFlags & HeaderFlags::Wide)
+			return readBinStream<uint64_t>(input);
+		return readBinStream<uint32_t>(input);
+	}
+
+
+	void CVMatTreeStructBin::writeHeader(uint32_t flags)
+	{
+		streamBegin = ostream->tellp();
+		headerFlags = flags;
+
+		ostream->write(magic, sizeof(magic)-1);
+		writeBin2Stream<uint32_t>(ostream, flags ? versionFlags : version);
+
+		writeBin2Stream<uint32_t>(ostream, flags);
+		writeBin2Stream<uint32_t>(ostream, 0);
+		writeBin2Stream<uint32_t>(ostream, 0);
+		writeBin2Stream<uint32_t>(ostream, 0);
+	}
+	
+	void CVMatTreeStructBin::writeHeader(const WriteOptions& options)
+	{
+		matCodec         = options.codec;
+		compressionLevel = options.compressionLevel;
+		matFilters       = options.filters;
+		dirsByName       = !options.insertionOrder;
+
+		writeHeader(writeHeaderFlags(options));
+	}
+
+	bool CVMatTreeStructBin::readHeader()
+	{
+		streamBegin = input.tellg();
+
+		char readmagic[sizeof(magic)-1];
+		if(!input.read(readmagic, sizeof(magic)-1) || std::memcmp(magic, readmagic, sizeof(magic)-1) != 0)
+			return false;
+
+		uint32_t readedVersion = readBinStream<uint32_t>(input);
+		uint32_t flags         = readBinStream<uint32_t>(input);
+		if(!input.good() || !decodeHeaderFlags(readedVersion, flags, headerFlags))
+			return false;
+
+		uint32_t tmp;
+		readBinStream<uint32_t>(input, &tmp);
+		readBinStream<uint32_t>(input, &tmp);
+		readBinStream<uint32_t>(input, &tmp);
+		return input.good();
+	}
+
+
+	void CVMatTreeStructBin::writeMatP(const cv::Mat& mat)
+	{
+		if(matCodec != CVMatTreeBinCodec::Codec::None && writeCompressedMatP(mat))
+			return;
+
+		writeMatHeader(mat, 0, 0, 0);
+
+		if(payloadChunks && isHandledDepth(static_cast<uint32_t>(mat.depth())))
+		{
+			deferMatPayload(mat);
+			return;
+		}
+
+	#define HandleType(X) case cv::DataType<X>::type: writeMatBin<X>(ostream, mat); break;
+		switch(mat.depth())
+		{
+			HandleType(uint8_t)
+			HandleType(uint16_t)
+//			HandleType(uint32_t)
+// 			HandleType(uint64_t)
+			HandleType(int8_t)
+			HandleType(int16_t)
+			HandleType(int32_t)
+// 			HandleType(int64_t)
+			HandleType(float)
+			HandleType(double)
+			default:
+				std::cerr << "writeMatP: Unhandled Mat-Type: " << mat.type() << " depth: " << mat.depth() << " channels: " << mat.channels() << '\n';
+		}
+	#undef HandleType
+	}
+
+
+	void CVMatTreeStructBin::writeMatHeader(const cv::Mat& mat, uint32_t codecField, uint32_t chunkBytes, uint64_t storedSize)
+	{
+		const bool ndMat = mat.dims > 2;
+		if(ndMat && !(headerFlags & HeaderFlags::NDims))            // needs WriteOptions::ndMats
+			ostream->setstate(std::ios::failbit);
+
+		writeBin2Stream<uint32_t>(ostream, mat.depth());
+		writeBin2Stream<uint32_t>(ostream, mat.channels());
+
+		writeBin2Stream<uint32_t>(ostream, ndMat ? mat.size[0] : mat.rows);
+		writeBin2Stream<uint32_t>(ostream, ndMat ? mat.size[1] : mat.cols);
+
+		writeBin2Stream<uint32_t>(ostream, codecField | (ndMat ? static_cast<uint32_t>(mat.dims) << dimsShift : 0));
+		writeBin2Stream<uint32_t>(ostream, chunkBytes);
+		writeBin2Stream<uint32_t>(ostream, static_cast<uint32_t>(storedSize));
+		writeBin2Stream<uint32_t>(ostream, static_cast<uint32_t>(storedSize >> 32));
+
+		for(int i = 2; i < mat.dims; ++i)
+			writeBin2Stream<uint32_t>(ostream, mat.size[i]);
+	}
+
+	bool CVMatTreeStructBin::writeCompressedMatP(const cv::Mat& mat)
+	{
+		if(!isHandledDepth(static_cast<uint32_t>(mat.depth())) || mat.empty() || !CVMatTreeBinCodec::isAvailable(matCodec))
+			return false;
+
+		const cv::Mat continuous = mat.isContinuous() ? mat : mat.clone();
+		const std::size_t size = continuous.total()*continuous.elemSize();
+
+		const CVMatTreeBinCodec::Layout layout = codecLayout(mat.depth(), mat.channels(), mat.dims <= 2 ? mat.cols : mat.size[mat.dims-1]);
+		std::string compressed;
+		if(!CVMatTreeBinCodec::compress(matCodec, matFilters, layout, compressionLevel, reinterpret_cast<const char*>(continuous.data), size, codecChunkBytes, compressed)
+		 || compressed.size() >= size)
+			return false;                                              // stored uncompressed
+
+		writeMatHeader(mat, static_cast<uint32_t>(matCodec) | (matFilters << codecBits), static_cast<uint32_t>(codecChunkBytes), compressed.size());
+		ostream->write(compressed.data(), static_cast<std::streamsize>(compressed.size()));
+		return true;
+	}
+
+
+	bool CVMatTreeStructBin::readMatP(cv::Mat& mat)
+	{
+		MatHeader header;
+		if(!readMatHeader(header))
+		{
+			std::cerr << "readMatP: Unhandled Mat-Type: " << header.depth << '\n';
+			return false;
+		}
+
+		const int depth = convertedDepth(header.depth);
+		if(depth != header.depth)
+			return readConvertedMatP(mat, header, depth);
+
+		if(header.codec != CVMatTreeBinCodec::Codec::None)
+		{
+			createMat(mat, header);
+			return readCompressedPayload(header, reinterpret_cast<char*>(mat.data));
+		}
+		if(payloadReads)
+			return deferMatRead(mat, header, header.depth);
+		if(input.inMemory())
+			return readMemoryMatP(mat, header);
+
+	#define HandleType(X) case cv::DataType<X>::type: createMat(mat, header); readMatBin<X>(input, mat); break;
+		switch(header.depth)
+		{
+			HandleType(uint8_t)
+			HandleType(uint16_t)
+//			HandleType(uint32_t)
+			HandleType(int8_t)
+			HandleType(int16_t)
+			HandleType(int32_t)
+			HandleType(float)
+			HandleType(double)
+			default:
+				std::cerr << "readMatP: Unhandled Mat-Type: " << header.depth << '\n';
+				return false;
+		}
+	#undef HandleType
+		return true;
+	}
+
+
+	int CVMatTreeStructBin::convertedDepth(int depth) const
+	{
+		if(!matConversion)
+			return depth;
+
+		const int target = matConversion->targetDepth(nodePath);
+		if(target < 0 || !CVMatTreeBinConvert::isSupported(depth, target))
+			return depth;
+		return target;
+	}
+
+	bool CVMatTreeStructBin::readConvertedMatP(cv::Mat& mat, const MatHeader& header, int depth)
+	{
+		const std::size_t values = header.total()*static_cast<std::size_t>(header.channels);
+		if(header.codec != CVMatTreeBinCodec::Codec::None)
+		{
+			convertBuffer.resize(header.payloadSize());
+			if(!readCompressedPayload(header, convertBuffer.data()))
+				return false;
+
+			MatHeader converted = header;
+			converted.depth = depth;
+			createMat(mat, converted);
+			CVMatTreeBinConvert::convert(header.depth, depth, convertBuffer.data(), mat.data, values);
+			return true;
+		}
+		if(payloadReads)
+			return deferMatRead(mat, header, depth);
+
+		MatHeader converted = header;
+		converted.depth = depth;
+		if(input.inMemory())
+		{
+			const char* payload = input.take(header.payloadSize());
+			if(!payload)
+				return false;
+			createMat(mat, converted);
+			CVMatTreeBinConvert::convert(header.depth, depth, payload, mat.data, values);
+			return true;
+		}
+		createMat(mat, converted);                                      // new mats are continuous
+
+		// the stored values are read in blocks, each block is converted while it is in the cache
+		const std::size_t elemSize1    = static_cast<std::size_t>(CV_ELEM_SIZE1(header.depth));
+		const std::size_t matElemSize1 = static_cast<std::size_t>(CV_ELEM_SIZE1(depth));
+		const std::size_t blockValues  = convertBlockBytes/elemSize1;
+		convertBuffer.resize(std::min(values, blockValues)*elemSize1);
+		for(std::size_t pos = 0; pos < values; pos += blockValues)
+		{
+			const std::size_t n = std::min(blockValues, values - pos);
+			input.read(convertBuffer.data(), static_cast<std::streamsize>(n*elemSize1));
+			if(!input.good())
+				return false;
+			CVMatTreeBinConvert::convert(header.depth, depth, convertBuffer.data(), mat.data + pos*matElemSize1, n);
+		}
 		return true;
 	}
 
-	bool CVMatTreeStructBin::writeBin(const std::string& filename, const cv::Mat& mat)
+
+	bool CVMatTreeStructBin::readMemoryMatP(cv::Mat& mat, const MatHeader& header)
 	{
-		std::ofstream stream(filename, std::ios::binary | std::ios::out);
-		if(!stream.good())
+		// the payload is checked against the end of the data before the mat is allocated
+		const std::size_t payloadSize = header.payloadSize();
+		const char*       payload     = input.take(payloadSize);
+		if(!payload)
 			return false;
 
-		CVMatTree tree;
-		tree.getMat() = mat;
+		if(!shareBuffer || payloadSize == 0)
+		{
+			createMat(mat, header);
+			if(payloadSize > 0)
+				std::memcpy(mat.data, payload, payloadSize);
+			return true;
+		}
 
-		return writeBin(stream, tree);
+		if(mappedFile)
+			mat = MappedFileAllocator::createMat(header.dims, header.size.data(), header.type(), payload, std::static_pointer_cast<MappedRegion>(mappedFile));
+		else
+			mat = cv::Mat(header.dims, header.size.data(), header.type(), const_cast<char*>(payload));
+		return true;
 	}
 
 
-	CVMatTree CVMatTreeStructBin::readBin(std::istream& stream, CallbackStepper* callbackStepper)
+	// part of a mat payload, read by the parallel reader
+	struct CVMatTreeStructBin::PayloadRead
 	{
-		CVMatTreeStructBin reader(stream);
-		CVMatTree tree;
+		uint64_t    position = 0;
+		cv::Mat*    mat      = nullptr;
+		std::size_t offset   = 0;                                       // in the mat data
+		std::size_t size     = 0;                                       // in the file
+		int         storedDepth = 0;
+		int         depth       = 0;                                    // of the mat, converted from storedDepth if they differ
+	};
+
+	bool CVMatTreeStructBin::deferMatRead(cv::Mat& mat, const MatHeader& header, int depth)
+	{
+		MatHeader converted = header;
+		converted.depth = depth;
+		createMat(mat, converted);                                      // new mats are continuous
+
+		const std::size_t payloadSize = header.payloadSize();
+		const uint64_t    position    = static_cast<uint64_t>(input.tellg());
+		skipBinStream(input, payloadSize);
+		if(!input.good())
+			return false;
 
-		if(reader.readHeader())
+		const std::size_t elemSize1    = static_cast<std::size_t>(CV_ELEM_SIZE1(header.depth));
+		const std::size_t matElemSize1 = static_cast<std::size_t>(CV_ELEM_SIZE1(depth));
+		for(std::size_t offset = 0; offset < payloadSize; offset += parallelChunkBytes)
 		{
-			reader.handleNodeRead(tree, callbackStepper);
+			PayloadRead read;
+			read.position    = position + offset;
+			read.mat         = &mat;
+			read.offset      = offset/elemSize1*matElemSize1;
+			read.size        = std::min(parallelChunkBytes, payloadSize - offset);
+			read.storedDepth = header.depth;
+			read.depth       = depth;
+			payloadReads->push_back(read);
 		}
+		return true;
+	}
 
-		return tree;
+	bool CVMatTreeStructBin::readPayloadsParallel(const std::string& filename, const std::vector<PayloadRead>& reads)
+	{
+		std::atomic<bool> ok(true);
+		cv::parallel_for_(cv::Range(0, static_cast<int>(reads.size())), [&](const cv::Range& range)
+		{
+			// one stream per task, reads of the size of a chunk bypass the stream buffer
+			std::ifstream stream(filename, std::ios::binary | std::ios::in);
+			std::vector<char> buffer;                                   // stored values of converted mats
+			for(int i = range.start; i < range.end && ok; ++i)
+			{
+				const PayloadRead& read = reads[static_cast<std::size_t>(i)];
+				char* data = reinterpret_cast<char*>(read.mat->data) + read.offset;
+				stream.seekg(static_cast<std::streamoff>(read.position));
+				if(read.depth == read.storedDepth)
+				{
+					stream.read(data, static_cast<std::streamsize>(read.size));
+					if(!stream.good())
+						ok = false;
+					continue;
+				}
+
+				buffer.resize(read.size);
+				stream.read(buffer.data(), static_cast<std::streamsize>(read.size));
+				if(!stream.good())
+					ok = false;
+				else
+					CVMatTreeBinConvert::convert(read.storedDepth, read.depth, buffer.data(), data, read.size/static_cast<std::size_t>(CV_ELEM_SIZE1(read.storedDepth)));
+			}
+		});
+		return ok;
 	}
 
-	CVMatTree CVMatTreeStructBin::readBin(const std::string& filename, Callback* callback)
+
+	namespace
 	{
-		std::size_t filesize = sfs::file_size(filename);
-		CppFW::CallbackStepper callbackStepper(callback, filesize);
+		// output of BufferWriter: a buffer of the exact file size (serializedSize)
+		class MemoryOutput
+		{
+			char* begin;
+			char* out;
+		public:
+			explicit MemoryOutput(char* data) : begin(data), out(data) {}
 
-		std::ifstream stream(filename, std::ios::binary | std::ios::in);
-		if(!stream.good())
-			return CVMatTree();
+			void put(const void* data, std::size_t size)
+			{
+				if(size == 0)
+					return;
+				std::memcpy(out, data, size);
+				out += size;
+			}
 
-		return readBin(stream, &callbackStepper);
-	}
+			void     putPayload(const void* data, std::size_t size)    { put(data, size); }
+			uint64_t position() const                                  { return static_cast<uint64_t>(out - begin); }
+		};
+
+#ifdef CVMATTREE_WRITEV
+#ifdef IOV_MAX
+		const std::size_t maxIovecs = IOV_MAX;
+#else
+		const std::size_t maxIovecs = 16;
+#endif
+		const std::size_t fdHeaderBytes  = 256 << 10;                // collected header bytes before a flush
+		const std::size_t fdPayloadBytes = 4 << 10;                  // smaller payload rows are copied to the headers
+
+		// output of BufferWriter to a file descriptor: the header fields are collected in a buffer, the mat payloads are referenced,
+		// both are passed to the kernel with writev (the payloads go from the mats to the kernel without copy)
+		class FdOutput
+		{
+			struct Fragment
+			{
+				const char* data;                                      // nullptr: bytes of headers at offset
+				std::size_t offset;
+				std::size_t size;
+			};
+
+			int                   fd;
+			std::vector<char>     headers;
+			std::vector<Fragment> fragments;
+			std::vector<iovec>    iovecs;
+			uint64_t              written = 0;
+			uint64_t              pending = 0;
+			bool                  failed  = false;
+
+		public:
+			explicit FdOutput(int fd) : fd(fd) {}
+
+			void put(const void* data, std::size_t size)
+			{
+				if(size == 0)
+					return;
+				if(fragments.empty() || fragments.back().data)
+					fragments.push_back(Fragment{nullptr, headers.size(), 0});
+				const char* bytes = static_cast<const char*>(data);
+				headers.insert(headers.end(), bytes, bytes + size);
+				fragments.back().size += size;
+				pending += size;
+				if(headers.size() >= fdHeaderBytes)
+					flush();
+			}
 
+			void putPayload(const void* data, std::size_t size)
+			{
+				if(size < fdPayloadBytes)
+				{
+					put(data, size);
+					return;
+				}
+				fragments.push_back(Fragment{static_cast<const char*>(data), 0, size});
+				pending += size;
+				if(fragments.size() >= maxIovecs)
+					flush();
+			}
 
+			uint64_t position() const                                  { return written + pending; }
 
+			bool flush()
+			{
+				iovecs.clear();
+				for(const Fragment& fragment : fragments)
+					iovecs.push_back(iovec{const_cast<char*>(fragment.data ? fragment.data : headers.data() + fragment.offset), fragment.size});
 
-	void CVMatTreeStructBin::writeDir(const CVMatTree& node)
-	{
-		const CVMatTree::NodeDir& nodes = node.getNodeDir();
+				// writev can write a part of the fragments
+				std::size_t first = 0;
+				while(first < iovecs.size() && !failed)
+				{
+					const ssize_t ret = ::writev(fd, iovecs.data() + first, static_cast<int>(std::min(iovecs.size() - first, maxIovecs)));
+					if(ret < 0)
+					{
+						failed = errno != EINTR;
+						continue;
+					}
+					written += static_cast<uint64_t>(ret);
+					const std::size_t previous = first;
+					std::size_t done = static_cast<std::size_t>(ret);
+					for(; first < iovecs.size() && done >= iovecs[first].iov_len; ++first)
+						done -= iovecs[first].iov_len;
+					if(ret == 0 && first == previous)                  // nothing written with data pending, retrying would not end
+						failed = true;
+					if(done > 0)
+					{
+						iovecs[first].iov_base = static_cast<char*>(iovecs[first].iov_base) + done;
+						iovecs[first].iov_len -= done;
+					}
+				}
+
+				headers.clear();
+				fragments.clear();
+				pending = 0;
+				return !failed;
+			}
 
-		writeBin2Stream<uint32_t>(ostream, static_cast<uint32_t>(nodes.size()));
-		for(const CVMatTree::NodePair& pair : nodes)
+			bool good() const                                          { return !failed; }
+		};
+
+		// std::ostream onto FdOutput for the stream writer (compressed files), small writes are collected in the header buffer,
+		// large writes are passed to writev directly
+		class FdStreamBuf : public std::streambuf
 		{
-			const std::string& name  = pair.first;
-			const CVMatTree* subNode = pair.second;
+			FdOutput& output;
 
-			writeBin2Stream(ostream, name);
-			handleNodeWrite(*subNode);
-		}
+		public:
+			explicit FdStreamBuf(FdOutput& output) : output(output) {}
+
+		protected:
+			std::streamsize xsputn(const char* data, std::streamsize size) override
+			{
+				if(static_cast<std::size_t>(size) >= fdHeaderBytes)
+				{
+					output.putPayload(data, static_cast<std::size_t>(size));
+					output.flush();                                    // data is only valid during the call
+				}
+				else
+					output.put(data, static_cast<std::size_t>(size));
+				return output.good() ? size : 0;
+			}
+
+			int_type overflow(int_type c) override
+			{
+				if(traits_type::eq_int_type(c, traits_type::eof()))
+					return traits_type::not_eof(c);
+				const char value = traits_type::to_char_type(c);
+				output.put(&value, 1);
+				return output.good() ? c : traits_type::eof();
+			}
+
+			pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override
+			{
+				if(off != 0 || dir != std::ios_base::cur || !(which & std::ios_base::out))
+					return pos_type(off_type(-1));                     // only tellp
+				return pos_type(static_cast<off_type>(output.position()));
+			}
+
+			int sync() override                                        { return output.flush() ? 0 : -1; }
+		};
+#endif
 	}
 
 
-	bool CVMatTreeStructBin::readDir(CVMatTree& node, CallbackStepper* callbackStepper)
+	// emits an uncompressed file with pointer arithmetic into an output (MemoryOutput, FdOutput)
+	template<typename Output>
+	class CVMatTreeStructBin::BufferWriter
 	{
-		bool ret = true;
-		uint32_t dirLength = readBinStream<uint32_t>(*istream);
-		for(uint32_t i=0; i<dirLength; ++i)
-		{
-			std::string name = readBinSting(*istream);
+		Output&     output;
+		uint32_t    headerFlags;
+		bool        dirsByName;                                        // WriteOptions::insertionOrder
+		std::vector<CVMatTreeBinIndex::Entry> indexEntries;
+		std::string nodePath;                                          // for the index
 
-			ret &= handleNodeRead(node.getDirNode(name), callbackStepper);
+		template<typename T>
+		void put(T value)                                              { output.put(&value, sizeof(T)); }
+		void putBytes(const void* data, std::size_t size)              { output.put(data, size); }
+
+		void putCount(uint64_t count)
+		{
+			if(headerFlags & HeaderFlags::Wide)
+				put<uint64_t>(count);
+			else
+				put<uint32_t>(static_cast<uint32_t>(count));
 		}
-		return ret;
-	}
 
+		void putHeader()
+		{
+			putBytes(magic, sizeof(magic)-1);
+			put<uint32_t>(headerFlags ? versionFlags : version);
+			put<uint32_t>(headerFlags);
+			put<uint32_t>(0);
+			put<uint32_t>(0);
+			put<uint32_t>(0);
+		}
 
-	void CVMatTreeStructBin::writeList(const CVMatTree& node)
-	{
-		const CVMatTree::NodeList& nodes = node.getNodeList();
+		void putMat(const cv::Mat& mat)
+		{
+			const bool ndMat = mat.dims > 2;
+			const uint32_t words[8] =
+			{
+				static_cast<uint32_t>(mat.depth()),
+				static_cast<uint32_t>(mat.channels()),
+				static_cast<uint32_t>(ndMat ? mat.size[0] : mat.rows),
+				static_cast<uint32_t>(ndMat ? mat.size[1] : mat.cols),
+				ndMat ? static_cast<uint32_t>(mat.dims) << dimsShift : 0,
+				0, 0, 0
+			};
+			putBytes(words, sizeof(words));
+			for(int i = 2; i < mat.dims; ++i)
+				put<uint32_t>(static_cast<uint32_t>(mat.size[i]));
+
+			if(!isHandledDepth(static_cast<uint32_t>(mat.depth())))
+			{
+				std::cerr << "writeMatP: Unhandled Mat-Type: " << mat.type() << " depth: " << mat.depth() << " channels: " << mat.channels() << '\n';
+				return;
+			}
+			if(mat.isContinuous())
+			{
+				output.putPayload(mat.data, mat.total()*mat.elemSize());
+				return;
+			}
+			const std::size_t rows     = matRows(mat);
+			const std::size_t rowBytes = matRowBytes(mat);
+			for(std::size_t r = 0; r < rows; ++r)
+				output.putPayload(matRow(mat, r), rowBytes);
+		}
 
-		writeBin2Stream<uint32_t>(ostream, static_cast<uint32_t>(nodes.size()));
-		for(const CVMatTree* subNode : nodes)
+		void putSubNode(const CVMatTree& node, const std::string& name)
 		{
-			handleNodeWrite(*subNode);
+			if(!(headerFlags & HeaderFlags::Indexed))
+			{
+				putNode(node);
+				return;
+			}
+			const std::size_t pathLength = nodePath.size();
+			CVMatTreeBinIndex::appendPathSegment(nodePath, name);
+			putNode(node);
+			nodePath.resize(pathLength);
 		}
-	}
 
-	bool CVMatTreeStructBin::readList(CVMatTree& node, CallbackStepper* callbackStepper)
-	{
-		bool ret = true;
-		uint32_t listLength = readBinStream<uint32_t>(*istream);
-		for(uint32_t i=0; i<listLength; ++i)
+		void putNode(const CVMatTree& node)
 		{
-			ret &= handleNodeRead(node.newListNode(), callbackStepper);
+			std::size_t indexPos = 0;
+			if(headerFlags & HeaderFlags::Indexed)
+			{
+				indexPos = indexEntries.size();
+				indexEntries.push_back(indexEntry(node, nodePath, output.position()));
+			}
+
+			put<uint32_t>(static_cast<uint32_t>(node.type()));
+			switch(node.type())
+			{
+				case CVMatTree::Type::Undef:
+					break;
+				case CVMatTree::Type::Dir:
+					putCount(node.getNodeDir().size());
+					forEachDirEntry(node.getNodeDir(), dirsByName, [this](const CVMatTree::NodePair& pair)
+					{
+						const std::string& name = pair.first;
+						putCount(name.size());
+						putBytes(name.data(), name.size());
+						putSubNode(*pair.second, name);
+					});
+					break;
+				case CVMatTree::Type::List:
+				{
+					putCount(node.getNodeList().size());
+					std::size_t listIndex = 0;
+					for(const CVMatTree* subNode : node.getNodeList())
+						putSubNode(*subNode, (headerFlags & HeaderFlags::Indexed) ? boost::lexical_cast<std::string>(listIndex++) : std::string());
+					break;
+				}
+				case CVMatTree::Type::Mat:
+					putMat(node.getMat());
+					break;
+				case CVMatTree::Type::String:
+					putCount(node.getString().size());
+					putBytes(node.getString().data(), node.getString().size());
+					break;
+			}
+
+			if(headerFlags & HeaderFlags::Indexed)
+			{
+				CVMatTreeBinIndex::Entry& entry = indexEntries[indexPos];
+				entry.size = output.position() - entry.offset;
+			}
 		}
-		return ret;
-	}
 
+		void putIndex()
+		{
+			const uint64_t indexPos = output.position();
+
+			put<uint32_t>(indexVersion);
+			put<uint64_t>(indexEntries.size());
+			for(const CVMatTreeBinIndex::Entry& entry : indexEntries)
+			{
+				put<uint32_t>(static_cast<uint32_t>(entry.path.size()));
+				putBytes(entry.path.data(), entry.path.size());
+				put(entry.offset  );
+				put(entry.size    );
+				put(entry.type    );
+				put(entry.depth   );
+				put(entry.channels);
+				put(entry.rows    );
+				put(entry.cols    );
+			}
 
+			put<uint64_t>(indexPos);
+			putBytes(indexMagic, sizeof(indexMagic)-1);
+		}
 
-	void CVMatTreeStructBin::handleNodeWrite(const CVMatTree& node)
-	{
-		writeBin2Stream<uint32_t>(ostream, static_cast<uint32_t>(node.type()));
-		switch(node.type())
+		// node and its index entries (indexed files, pathLength: length of the node path)
+		static uint64_t nodeSize(const CVMatTree& node, uint32_t headerFlags, std::size_t pathLength)
 		{
-			case CVMatTree::Type::Undef:
-				break;
-			case CVMatTree::Type::Dir:
-				writeDir(node);
-				break;
-			case CVMatTree::Type::List:
-				writeList(node);
-				break;
-			case CVMatTree::Type::Mat:
-				writeMatP(node.getMat());
-				break;
-			case CVMatTree::Type::String:
-				writeString(node.getString());
-				break;
+			const bool     indexed   = (headerFlags & HeaderFlags::Indexed) != 0;
+			const uint64_t countSize = (headerFlags & HeaderFlags::Wide) ? sizeof(uint64_t) : sizeof(uint32_t);
+			const std::size_t separator = pathLength > 0 ? 1 : 0;
+			uint64_t size = sizeof(uint32_t) + (indexed ? indexEntryFixedSize + pathLength : 0);
+			switch(node.type())
+			{
+				case CVMatTree::Type::Undef:
+					break;
+				case CVMatTree::Type::Dir:
+					size += countSize;
+					for(const CVMatTree::NodePair& pair : node.getNodeDir())
+					{
+						const std::size_t nameLength = static_cast<const std::string&>(pair.first).size();
+						size += countSize + nameLength + nodeSize(*pair.second, headerFlags, pathLength + separator + nameLength);
+					}
+					break;
+				case CVMatTree::Type::List:
+				{
+					size += countSize;
+					uint64_t listIndex = 0;
+					for(const CVMatTree* subNode : node.getNodeList())
+						size += nodeSize(*subNode, headerFlags, indexed ? pathLength + separator + decimalDigits(listIndex++) : 0);
+					break;
+				}
+				case CVMatTree::Type::Mat:
+				{
+					const cv::Mat& mat = node.getMat();
+					size += 8*sizeof(uint32_t) + (mat.dims > 2 ? static_cast<uint64_t>(mat.dims - 2)*sizeof(uint32_t) : 0);
+					if(isHandledDepth(static_cast<uint32_t>(mat.depth())))
+						size += static_cast<uint64_t>(mat.total())*mat.elemSize();
+					break;
+				}
+				case CVMatTree::Type::String:
+					size += countSize + node.getString().size();
+					break;
+			}
+			return size;
 		}
-	}
-	
 
-	bool CVMatTreeStructBin::handleNodeRead(CVMatTree& node, CallbackStepper* callbackStepper)
-	{
-		assert(node.type() == CVMatTree::Type::Undef);
+	public:
+		BufferWriter(Output& output, uint32_t headerFlags, bool dirsByName) : output(output), headerFlags(headerFlags), dirsByName(dirsByName) {}
 
-		if(callbackStepper)
+		// compressed sizes are not known before compressing, the uncompressed size is an upper bound (incompressible mats are stored uncompressed)
+		static uint64_t fileSize(const CVMatTree& tree, uint32_t headerFlags)
 		{
-			if(!callbackStepper->setStep(istream->tellg()))
-				return false;
+			uint64_t size = sizeof(magic)-1 + 5*sizeof(uint32_t) + nodeSize(tree, headerFlags, 0);
+			if(headerFlags & HeaderFlags::Indexed)
+				size += sizeof(uint32_t) + sizeof(uint64_t)                  // index version, number of entries
+				      + sizeof(uint64_t) + sizeof(indexMagic)-1;             // trailer: index position, magic
+			return size;
 		}
-		
-		uint32_t type = readBinStream<uint32_t>(*istream);
-		switch(static_cast<CVMatTree::Type>(type))
+
+		void write(const CVMatTree& tree)
 		{
-			case CVMatTree::Type::Undef:
-				return true;
-			case CVMatTree::Type::Dir:
-				return readDir(node, callbackStepper);
-			case CVMatTree::Type::List:
-				return readList(node, callbackStepper);
-			case CVMatTree::Type::Mat:
-				return readMatP(node.getMat());
-			case CVMatTree::Type::String:
-				return readString(node.getString());
+			putHeader();
+			putNode(tree);
+			if(headerFlags & HeaderFlags::Indexed)
+				putIndex();
 		}
-		return false;
-	}
+	};
 
-	bool CVMatTreeStructBin::readString(std::string& str)
+	uint64_t CVMatTreeStructBin::serializedSize(const CVMatTree& tree)
 	{
-		str = readBinSting(*istream);
-		return true;
+		return serializedSize(tree, WriteOptions());
 	}
 
-
-	void CVMatTreeStructBin::writeString(const std::string& string)
+	uint64_t CVMatTreeStructBin::serializedSize(const CVMatTree& tree, const WriteOptions& options)
 	{
-		writeBin2Stream(ostream, string);
+		return BufferWriter<MemoryOutput>::fileSize(tree, writeHeaderFlags(withRequiredOptions(options, tree)));
 	}
 
-
-	void CVMatTreeStructBin::writeHeader()
+	std::size_t CVMatTreeStructBin::writeBin(void* data, std::size_t size, const CVMatTree& tree)
 	{
-		ostream->write(magic, sizeof(magic)-1);
-		writeBin2Stream<uint32_t>(ostream, version);
-
-		writeBin2Stream<uint32_t>(ostream, 0);
-		writeBin2Stream<uint32_t>(ostream, 0);
-		writeBin2Stream<uint32_t>(ostream, 0);
-		writeBin2Stream<uint32_t>(ostream, 0);
+		return writeBin(data, size, tree, WriteOptions());
 	}
-	
-	bool CVMatTreeStructBin::readHeader()
+
+	std::size_t CVMatTreeStructBin::writeBin(void* data, std::size_t size, const CVMatTree& tree, const WriteOptions& options)
 	{
-		char readmagic[sizeof(magic)-1];
-		istream->read(readmagic, sizeof(magic)-1);
-		if(std::memcmp(magic, readmagic, sizeof(magic)-1) != 0)
-			return false;
+		const WriteOptions requiredOptions = withRequiredOptions(options, tree);
+		if(requiredOptions.codec != CVMatTreeBinCodec::Codec::None)
+		{
+			// the compressed sizes are known after compressing, the stream writer writes into the buffer
+			boost::interprocess::obufferstream stream(static_cast<char*>(data), size);
+			if(!writeBin(stream, tree, requiredOptions))
+				return 0;
+			return static_cast<std::size_t>(stream.tellp());
+		}
 
-		uint32_t readedVersion = readBinStream<uint32_t>(*istream);
-		if(version != readedVersion)
-			return false;
-		
-		uint32_t tmp;
-		readBinStream<uint32_t>(*istream, &tmp);
-		readBinStream<uint32_t>(*istream, &tmp);
-		readBinStream<uint32_t>(*istream, &tmp);
-		readBinStream<uint32_t>(*istream, &tmp);
-		return true;
-	}
+		const uint32_t flags    = writeHeaderFlags(requiredOptions);
+		const uint64_t fileSize = BufferWriter<MemoryOutput>::fileSize(tree, flags);
+		if(fileSize > size)
+			return 0;
 
+		MemoryOutput output(static_cast<char*>(data));
+		BufferWriter<MemoryOutput> writer(output, flags, !requiredOptions.insertionOrder);
+		writer.write(tree);
+		return static_cast<std::size_t>(fileSize);
+	}
 
-	void CVMatTreeStructBin::writeMatP(const cv::Mat& mat)
+	bool CVMatTreeStructBin::writeBin(std::vector<char>& buffer, const CVMatTree& tree)
 	{
-		writeBin2Stream<uint32_t>(ostream, mat.depth());
-		writeBin2Stream<uint32_t>(ostream, mat.channels());
+		return writeBin(buffer, tree, WriteOptions());
+	}
 
-		writeBin2Stream<uint32_t>(ostream, mat.rows);
-		writeBin2Stream<uint32_t>(ostream, mat.cols);
+	bool CVMatTreeStructBin::writeBin(std::vector<char>& buffer, const CVMatTree& tree, const WriteOptions& options)
+	{
+		buffer.resize(static_cast<std::size_t>(serializedSize(tree, options)));
+		const std::size_t written = writeBin(buffer.data(), buffer.size(), tree, options);
+		buffer.resize(written);
+		return written > 0;
+	}
 
-		writeBin2Stream<uint32_t>(ostream, 0);
-		writeBin2Stream<uint32_t>(ostream, 0);
-		writeBin2Stream<uint32_t>(ostream, 0);
-		writeBin2Stream<uint32_t>(ostream, 0);
+	bool CVMatTreeStructBin::writeBinFd(int fd, const CVMatTree& tree)
+	{
+		return writeBinFd(fd, tree, WriteOptions());
+	}
 
-	#define HandleType(X) case cv::DataType<X>::type: writeMatBin<X>(ostream, mat); break;
-		switch(mat.depth())
+	bool CVMatTreeStructBin::writeBinFd(int fd, const CVMatTree& tree, const WriteOptions& options)
+	{
+#ifdef CVMATTREE_WRITEV
+		const WriteOptions requiredOptions = withRequiredOptions(options, tree);
+		if(requiredOptions.codec == CVMatTreeBinCodec::Codec::None)
 		{
-			HandleType(uint8_t)
-			HandleType(uint16_t)
-//			HandleType(uint32_t)
-// 			HandleType(uint64_t)
-			HandleType(int8_t)
-			HandleType(int16_t)
-			HandleType(int32_t)
-// 			HandleType(int64_t)
-			HandleType(float)
-			HandleType(double)
-			default:
-				std::cerr << "writeMatP: Unhandled Mat-Type: " << mat.type() << " depth: " << mat.depth() << " channels: " << mat.channels() << '\n';
+			FdOutput output(fd);
+			BufferWriter<FdOutput> writer(output, writeHeaderFlags(requiredOptions), !requiredOptions.insertionOrder);
+			writer.write(tree);
+			return output.flush();
 		}
-	#undef HandleType
+
+		// compressed sizes are known after compressing, the stream writer writes through FdOutput
+		FdOutput    output(fd);
+		FdStreamBuf buffer(output);
+		std::ostream stream(&buffer);
+		const bool ret = writeBin(stream, tree, requiredOptions);
+		return output.flush() && ret;
+#else
+		(void)fd;
+		(void)tree;
+		(void)options;
+		return false;
+#endif
 	}
 
+	CVMatTree CVMatTreeStructBin::readBin(const void* data, std::size_t size)
+	{
+		return readBin(data, size, ReadOptions());
+	}
 
-	bool CVMatTreeStructBin::readMatP(cv::Mat& mat)
+	CVMatTree CVMatTreeStructBin::readBin(const void* data, std::size_t size, const ReadOptions& options)
 	{
-		uint32_t depth     = readBinStream<uint32_t>(*istream);
-		uint32_t channels = readBinStream<uint32_t>(*istream);
+		CVMatTree tree = options.arena ? CVMatTree(*options.arena) : CVMatTree();
 
-		uint32_t rows     = readBinStream<uint32_t>(*istream);
-		uint32_t cols     = readBinStream<uint32_t>(*istream);
+		CVMatTreeStructBin reader(static_cast<const char*>(data), size);
+		reader.shareBuffer = options.shareBuffer;
 
-		readBinStream<uint32_t>(*istream);
-		readBinStream<uint32_t>(*istream);
-		readBinStream<uint32_t>(*istream);
-		readBinStream<uint32_t>(*istream);
+		const MatConversion conversion(options);
+		if(conversion.active())
+			reader.matConversion = &conversion;
 
-	#define HandleType(X) case cv::DataType<X>::type: mat.create(rows, cols, CV_MAKETYPE(cv::DataType<X>::depth, channels)); readMatBin<X>(*istream, mat); break;
-		switch(depth)
-		{
-			HandleType(uint8_t)
-			HandleType(uint16_t)
-//			HandleType(uint32_t)
-			HandleType(int8_t)
-			HandleType(int16_t)
-			HandleType(int32_t)
-			HandleType(float)
-			HandleType(double)
-			default:
-				std::cerr << "readMatP: Unhandled Mat-Type: " << depth << '\n';
-				return false;
-		}
-	#undef HandleType
-		return true;
-	}
+		if(reader.readHeader())
+			reader.handleNodeRead(tree, nullptr);
 
+		return tree;
+	}
 
 
 	void CVMatTreeStructBin::writeMatlabReadCode(const char* filename)
@@ -430,28 +3086,35 @@ namespace CppFW
 		stream << "\t	error('not a bin file')\n";
 		stream << "\tend\n";
 		stream << "\tversion  = fread(fileID, 1, 'uint32');\n";
-		stream << "\tassert(version == " << version << ");\n";
-		stream << "\t           fread(fileID, 4, 'uint32');\n";
+		stream << "\tassert(version == " << version << " || version == " << versionFlags << ");\n";
+		stream << "\theader   = fread(fileID, 4, 'uint32=>uint32');\n";
+		stream << "\tcountType = 'uint32';\n";
+		stream << "\tif version == " << versionFlags << "\n";
+		stream << "\t\tassert(bitand(header(1), uint32(" << (~(HeaderFlags::Indexed | HeaderFlags::Wide | HeaderFlags::NDims)) << ")) == 0, 'unsupported format flags');\n";
+		stream << "\t\tif bitand(header(1), uint32(" << HeaderFlags::Wide << ")) ~= 0\n";
+		stream << "\t\t\tcountType = 'uint64';\n";
+		stream << "\t\tend\n";
+		stream << "\tend\n";
 
-		stream << "\ts  = readNode(fileID);\n";
+		stream << "\ts  = readNode(fileID, countType);\n";
 		stream << "\tfclose(fileID);\n";
 		stream << "end\n\n\n";
 
 
-		stream << "function [node] = readNode(fileID)\n";
+		stream << "function [node] = readNode(fileID, countType)\n";
 		stream << "\ttype  = fread(fileID, 1, 'uint32');\n";
 		stream << "\tswitch(type)\n";
 		stream << "\t\tcase " << static_cast<uint32_t>(CVMatTree::Type::Undef ) << '\n';
 		stream << "\t\t\t% node not written because unhandled type\n";
 		stream << "\t\t\tnode = [];\n";
 		stream << "\t\tcase " << static_cast<uint32_t>(CVMatTree::Type::Dir   ) << '\n';
-		stream << "\t\t\tnode = readDir(fileID);\n";
+		stream << "\t\t\tnode = readDir(fileID, countType);\n";
 		stream << "\t\tcase " << static_cast<uint32_t>(CVMatTree::Type::Mat   ) << '\n';
 		stream << "\t\t\tnode = readMat(fileID);\n";
 		stream << "\t\tcase " << static_cast<uint32_t>(CVMatTree::Type::List  ) << '\n';
-		stream << "\t\t\tnode = readList(fileID);\n";
+		stream << "\t\t\tnode = readList(fileID, countType);\n";
 		stream << "\t\tcase " << static_cast<uint32_t>(CVMatTree::Type::String) << '\n';
-		stream << "\t\t\tnode = readString(fileID);\n";
+		stream << "\t\t\tnode = readString(fileID, countType);\n";
 		stream << "\t\totherwise\n";
 		stream << "\t\t\tfprintf('unknown node type %d\\n', type);\n";
 		stream << "\t\t\tnode = [];\n";
@@ -459,26 +3122,26 @@ namespace CppFW
 		stream << "end\n\n";
 
 
-		stream << "function [node] = readDir(fileID)\n";
-		stream << "\tdirLength  = fread(fileID, 1, 'uint32');\n";
+		stream << "function [node] = readDir(fileID, countType)\n";
+		stream << "\tdirLength  = fread(fileID, 1, countType);\n";
 		stream << "\tfor i=1:dirLength\n";
-		stream << "\t\tname        = readString(fileID);\n";
-		stream << "\t\tnode.(name) = readNode(fileID);\n";
+		stream << "\t\tname        = readString(fileID, countType);\n";
+		stream << "\t\tnode.(name) = readNode(fileID, countType);\n";
 		stream << "\tend\n";
 		stream << "end\n\n";
 
 
-		stream << "function [node] = readList(fileID)\n";
-		stream << "\tdirLength  = fread(fileID, 1, 'uint32');\n";
+		stream << "function [node] = readList(fileID, countType)\n";
+		stream << "\tdirLength  = fread(fileID, 1, countType);\n";
 		stream << "\tnode = cell(1, dirLength);\n";
 		stream << "\tfor i=1:dirLength\n";
-		stream << "\t\tnode{i} = readNode(fileID);\n";
+		stream << "\t\tnode{i} = readNode(fileID, countType);\n";
 		stream << "\tend\n";
 		stream << "end\n\n";
 
 
-		stream << "function [string] = readString(fileID)\n";
-		stream << "\tstringLength  = fread(fileID, 1, 'uint32');\n";
+		stream << "function [string] = readString(fileID, countType)\n";
+		stream << "\tstringLength  = fread(fileID, 1, countType);\n";
 		stream << "\tstr    = fread(fileID, stringLength, 'char');\n";
 		stream << "\tstring = convertChar2String(str);\n";
 		stream << "end\n\n";
@@ -496,7 +3159,14 @@ namespace CppFW
 		stream << "\tchannels = data(2);\n";
 		stream << "\trows     = data(3);\n";
 		stream << "\tcols     = data(4);\n";
-		stream << "\t% data(5) - data(8) unused\n";
+		stream << "\tdims     = bitshift(data(5), -" << dimsShift << ");\n";
+		stream << "\t% data(6) - data(8) unused\n";
+		stream << "\tif dims > 2\n";
+		stream << "\t\t% read as 2d mat with rows of the last dimension\n";
+		stream << "\t\tsizes = [double(rows) double(cols) fread(fileID, double(dims)-2, 'uint32')'];\n";
+		stream << "\t\trows  = prod(sizes(1:end-1));\n";
+		stream << "\t\tcols  = sizes(end);\n";
+		stream << "\tend\n";
 
 #define MatlabSwtichType(X, Y) 	stream << "		case " << boost::lexical_cast<std::string>(cv::DataType<X>::depth) << " % OpenCV type for "#X"\n\t\t\tmat = fread(fileID, [cols rows*channels], '"#Y"=>"#Y"')';\n";
 		stream << "	switch depth\n";
@@ -519,6 +3189,11 @@ namespace CppFW
 		stream << "\n\t\tB = reshape(A', [cols, rows, channels]);";
 		stream << "\n\t\tmat = permute(B, [2,1,3]);";
 		stream << "\n\tend";
+		stream << "\n\tif dims > 2";
+		stream << "\n\t\tmat = permute(mat, [2,1,3]);";
+		stream << "\n\t\tmat = reshape(mat, [fliplr(sizes) double(channels)]);";
+		stream << "\n\t\tmat = permute(mat, [dims:-1:1 dims+1]);";
+		stream << "\n\tend";
 		stream << "\nend\n";
 	}
 
@@ -17,7 +17,17 @@
 
 #pragma once
 
+#include <array>
 #include <iostream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include <cstdint>
+
+#include "treestructbinindex.h"
+#include "treestructbincodec.h"
+#include "cvmattreestruct.h"
 
 
 namespace cv { class Mat; }
@@ -26,45 +36,338 @@ namespace cv { class Mat; }
 
 namespace CppFW
 {
-	class CVMatTree;
 	class CallbackStepper;
 	class Callback;
 
 	class CVMatTreeStructBin
 	{
+		class Input;
+	public:
+		struct WriteOptions
+		{
+			bool index    = false;                                     // write format version 2 with a trailing table of contents (CVMatTreeBinIndex)
+			// serialize mat payloads in chunks on parallel tasks (cv::parallel_for_), output is identical
+			// only for stream and compressed writes, uncompressed files (filename, fd) are written with writev and buffers directly
+			bool parallel = false;
+			CVMatTreeBinCodec::Codec codec = CVMatTreeBinCodec::Codec::None; // compress mat payloads (format version 2), mats that do not get smaller are stored uncompressed
+			int  compressionLevel = -1;                                // zlib level 1-9, -1 is the zlib default
+			uint32_t filters = 0;                                      // CVMatTreeBinCodec::Filter flags applied before the codec, e.g. Delta | Shuffle for uint16 and float volumes
+			bool wideCounts  = false;                                  // 64 bit dir, list and string lengths (format version 2), writeBin enables it for trees that need it
+			bool ndMats      = false;                                  // mats with more than 2 dims (format version 2), writeBin enables it for trees that need it
+			bool insertionOrder = false;                               // write dir entries in insertion order (no sorting), the file then depends on how the tree was built
+		};
+
+		struct ReadOptions
+		{
+			// read only the structure, mat and string payloads are read on first access (file stays open)
+			// loading a payload modifies the node, a lazy tree is not safe for concurrent reads of the same node (const access included)
+			bool lazy  = false;
+			CVMatTreeArena* arena = nullptr;                           // allocate all nodes in the arena, the arena must outlive the tree
+			// read the structure first, then the mat payloads in chunks on parallel tasks (cv::parallel_for_)
+			// the tree is empty if a payload cannot be read (e.g. a truncated file)
+			bool parallel = false;
+
+			// mats are converted to CV_32F or CV_64F while reading (instead of convertTo after reading), -1 keeps the stored depth
+			// convertPaths: depth per path pattern (as the readBin selector, e.g. "bscans/*"), the first matching pattern overrides convertDepth
+			int convertDepth = -1;
+			std::vector<std::pair<std::string, int>> convertPaths;
+
+			bool shareBuffer = false;                                  // readBin(data, size): uncompressed mats refer to data without copy (data must outlive them, changes of the mats change data)
+		};
+
+		struct MatHeader
+		{
+			int depth    = 0;
+			int channels = 0;
+			int rows     = 0;                                          // size[0]
+			int cols     = 0;                                          // size[1]
+			int dims     = 2;
+			std::array<int, CV_MAX_DIM> size{};                        // size of each dimension, the payload is row-major
+
+			CVMatTreeBinCodec::Codec codec = CVMatTreeBinCodec::Codec::None; // stored payload
+			uint32_t filters    = 0;                                   // compressed payloads only
+			uint32_t chunkBytes = 0;
+			uint64_t storedSize = 0;                                   // bytes of the payload in the file
+
+			int type() const                                           { return CV_MAKETYPE(depth, channels); }
+			std::size_t total() const;                                 // number of elements
+			std::size_t payloadSize() const                            { return static_cast<std::size_t>(CV_ELEM_SIZE1(depth))*channels*total(); }
+		};
+
+		// sequential access to the row-major payload of a mat in readEvents, unread bytes are skipped afterwards
+		class MatPayload
+		{
+			friend class CVMatTreeStructBin;
+
+			Input&        input;
+			MatHeader     header;
+			std::size_t   payloadSize;
+			std::size_t   readBytes = 0;
+			const char*   data      = nullptr;                         // decompressed payload of compressed mats
+
+			MatPayload(Input& input, const MatHeader& header, std::size_t payloadSize)
+			: input(input), header(header), payloadSize(payloadSize) {}
+		public:
+			std::size_t size     () const                              { return payloadSize; }
+			std::size_t remaining() const                              { return payloadSize - readBytes; }
+
+			bool read(void* buffer, std::size_t bytes);                // next bytes of the payload
+			bool read(cv::Mat& mat);                                   // complete payload (nothing read before), mat is created with the header
+		};
+
+		// events of readEvents (SAX style), a handler returning false stops the reading
+		class EventHandler
+		{
+		public:
+			virtual ~EventHandler()                                    = default;
+
+			virtual bool beginDir (uint64_t /*numEntries*/)            { return true; }
+			virtual bool key      (const std::string& /*name*/)        { return true; } // before the node of each dir entry
+			virtual bool beginList(uint64_t /*numElements*/)           { return true; }
+			virtual bool end      ()                                   { return true; } // end of a dir or list
+			virtual bool mat      (const MatHeader& /*header*/, MatPayload& /*payload*/) { return true; }
+			virtual bool string   (const std::string& /*str*/)         { return true; }
+			virtual bool undef    ()                                   { return true; }
+		};
+
+		// writes a file incrementally without building a CVMatTree, e.g.
+		//   beginDir(); key("name"); writeString("scan"); key("bscans"); beginList(); writeMat(bscan) ...; end(); end(); finish();
+		// the element counts of dirs and lists are backpatched when the container is closed, the stream must be seekable
+		// after an error (wrong call order, stream failure) all further calls return false
+		class StreamWriter
+		{
+		public:
+			explicit StreamWriter(      std::ostream& stream );
+			explicit StreamWriter(const std::string& filename);
+			StreamWriter(      std::ostream& stream , const WriteOptions& options); // options.parallel is ignored
+			StreamWriter(const std::string& filename, const WriteOptions& options);
+			~StreamWriter();                                           // calls finish()
+
+			bool beginDir ();
+			bool beginList();
+			bool key      (const std::string& name);                   // name of the next node in a dir, dir entries are written in call order
+			bool end      ();                                          // closes the innermost dir or list
+
+			bool writeMat   (const cv::Mat& mat);
+			bool writeString(const std::string& str);
+			bool writeTree  (const CVMatTree& tree);                   // complete subtree as next node
+
+			bool finish();                                             // closes the open containers (and writes the index)
+			bool good() const                                          { return !failed; }
+
+		private:
+			StreamWriter(const StreamWriter&)            = delete;
+			StreamWriter& operator=(const StreamWriter&) = delete;
+
+			struct Container;
+
+			std::unique_ptr<std::ostream>          file;
+			std::unique_ptr<CVMatTreeStructBin>    writer;
+			std::vector<CVMatTreeBinIndex::Entry>  indexEntries;
+			std::vector<Container>                 containers;
+			std::string                            pendingKey;
+			bool                                   rootWritten = false;
+			bool                                   finished    = false;
+			bool                                   failed      = false;
+
+			void init(std::ostream& stream, const WriteOptions& options);
+			bool beginNode();
+			bool beginContainer(CVMatTree::Type type);
+			bool fail()                                                { failed = true; return false; }
+		};
+
+	private:
+		class LazyLoader;
+		struct PayloadChunk;
+		struct PayloadRead;
+		struct PathSelection;
+		struct MatConversion;
+		template<typename Output> class BufferWriter;
+
+		// input of the reader: a stream or a file in memory (readBin(data, size), mapBin)
+		// memory is read with pointer arithmetic instead of stream calls, the functions are the used subset of std::istream
+		class Input
+		{
+			std::istream* stream = nullptr;
+			const char*   begin  = nullptr;
+			const char*   pos    = nullptr;
+			const char*   end    = nullptr;
+			bool          failed = false;                              // memory: read or seek beyond the end (failbit)
+		public:
+			Input() = default;
+			explicit Input(std::istream& stream) : stream(&stream) {}
+			Input(const char* data, std::size_t size) : begin(data), pos(data), end(data + size) {}
+
+			bool inMemory() const                                      { return !stream; }
+			const char* take(uint64_t size);                           // memory: the next size bytes without copy, nullptr beyond the end
+
+			bool read(char* data, std::streamsize size);
+			bool good() const;
+			void clear();
+
+			std::streampos tellg() const;
+			void seekg(std::streampos position);
+			void seekg(std::streamoff offset, std::ios::seekdir dir);
+		};
+
 		std::ostream* ostream = nullptr;
-		std::istream* istream = nullptr;
+		Input         input;
+
+		std::streampos        streamBegin;                             // position of the magic, offsets in the index are relative to it
+		uint32_t              headerFlags  = 0;
+		std::vector<CVMatTreeBinIndex::Entry>* indexEntries = nullptr; // collects the index while writing
+		std::string           nodePath;
+
+		std::vector<PayloadChunk>* payloadChunks = nullptr;           // parallel writer: mat payloads are deferred instead of written
+		uint64_t              deferredBytes = 0;
+
+		std::vector<PayloadRead>* payloadReads = nullptr;             // parallel reader: mats are allocated, payloads are read later
+
+		CVMatTreeBinCodec::Codec matCodec = CVMatTreeBinCodec::Codec::None;
+		int                   compressionLevel = -1;
+		uint32_t              matFilters       = 0;
+		bool                  dirsByName       = true;                // WriteOptions::insertionOrder
+
+		bool                  shareBuffer  = false;                    // ReadOptions::shareBuffer, mats refer to the input in memory
+		std::shared_ptr<void> mappedFile;                              // mapBin: the mapping of the input, kept alive by the mats
+
+		std::shared_ptr<LazyLoader> lazyLoader;
+
+		const MatConversion*  matConversion = nullptr;                // ReadOptions::convertDepth, the path of the node is tracked in nodePath for convertPaths
+		std::vector<char>     convertBuffer;                           // stored values read from the stream before the conversion
 
 		// writer functions
-		void writeHeader();
+		void writeHeader(uint32_t flags);
+		void writeCount (uint64_t count);                          // dir, list and string lengths, 32 or 64 bit by headerFlags
+		void writeHeader(const WriteOptions& options);
+		void writeIndex ();
 		void writeMatP  (const cv::Mat& mat);
+		void writeMatHeader(const cv::Mat& mat, uint32_t codecField, uint32_t chunkBytes, uint64_t storedSize);
+		bool writeCompressedMatP(const cv::Mat& mat);
 		void writeDir   (const CVMatTree& node);
 		void writeList  (const CVMatTree& node);
 		void writeString(const std::string& str);
 
-		void handleNodeWrite(const CVMatTree& node);
+		void handleNodeWrite    (const CVMatTree& node);
+		void handleNodeWriteData(const CVMatTree& node);
+
+		uint64_t writePosition() const;
+		void deferMatPayload(const cv::Mat& mat);
+		static bool writeBinParallel(std::ostream& stream, const CVMatTree& tree, const WriteOptions& options);
 		
 		// reader functions
 		bool readHeader();
+		uint64_t readCount();
 		bool readMatP  (cv::Mat& mat);
+		bool readConvertedMatP(cv::Mat& mat, const MatHeader& header, int depth);
+		int  convertedDepth(int depth) const;
+		bool readMemoryMatP(cv::Mat& mat, const MatHeader& header);
 		bool readDir   (CVMatTree& node, CallbackStepper* callbackStepper);
 		bool readList  (CVMatTree& node, CallbackStepper* callbackStepper);
 		bool readString(std::string& str);
 
 		bool handleNodeRead(CVMatTree& node, CallbackStepper* callbackStepper);
+		bool readNodeInto  (CVMatTree& node);
+		bool readDirInto   (CVMatTree& node);
+		bool readListInto  (CVMatTree& node);
+		bool handleNodeEvents(EventHandler& handler);
+		bool readMatHeader (MatHeader& header);
+		bool readCompressedPayload(const MatHeader& header, char* data);
+		bool readLazy      (CVMatTree& node, CVMatTree::Type type);
+
+		bool skipNode();
+		bool skipMatP();
+		bool skipString();
+		bool seekNode(const std::string& path);
+		bool readSelected(CVMatTree& node, const PathSelection& selection);
+		bool readIndexTrailer(CVMatTreeBinIndex& index);
+		bool loadIndex(const std::string& filename, CVMatTreeBinIndex& index);   // trailer or sidecar, keeps the stream position
+		bool scanNode(std::vector<CVMatTreeBinIndex::Entry>& entries);
+		bool readFromIndex(CVMatTree& tree, const CVMatTreeBinIndex& index);       // false for an ambiguous index (duplicate paths), the caller reads sequentially
+		static bool readIndexSidecar(const std::string& filename, CVMatTreeBinIndex& index);
+		bool deferMatRead(cv::Mat& mat, const MatHeader& header, int depth);   // depth of the mat, converted from header.depth
+		static bool readPayloadsParallel(const std::string& filename, const std::vector<PayloadRead>& reads);
 
 		
 		CVMatTreeStructBin(std::ostream& stream) : ostream(&stream) {}
-		CVMatTreeStructBin(std::istream& stream) : istream(&stream) {}
+		CVMatTreeStructBin(std::istream& stream) : input(stream) {}
+		CVMatTreeStructBin(const char* data, std::size_t size) : input(data, size) {}
 		
 	public:
 		static bool writeBin(      std::ostream& stream , const CVMatTree& tree);
 		static bool writeBin(const std::string& filename, const CVMatTree& tree);
 		static bool writeBin(const std::string& filename, const cv::Mat& mat);
+		static bool writeBin(      std::ostream& stream , const CVMatTree& tree, const WriteOptions& options);
+		static bool writeBin(const std::string& filename, const CVMatTree& tree, const WriteOptions& options);
 		
 		static CVMatTree readBin(const std::string& filename, Callback* callback = nullptr);
+		static CVMatTree readBin(const std::string& filename, const ReadOptions& options, Callback* callback = nullptr);
 		static CVMatTree readBin(std::istream& stream, CallbackStepper* callbackStepper = nullptr);
 
+		// files in memory (e.g. for IPC and caches), the fields are parsed and emitted with pointer arithmetic instead of stream calls
+		// writeBin overwrites the buffer and reuses its capacity, compressed files are serialized through a stream into the buffer
+		// readBin ignores ReadOptions::lazy and parallel, see ReadOptions::shareBuffer
+		// note: the payload of a shared mat is not necessarily aligned to its element size
+		static bool writeBin(std::vector<char>& buffer, const CVMatTree& tree);
+		static bool writeBin(std::vector<char>& buffer, const CVMatTree& tree, const WriteOptions& options);
+
+		// exact size of the file written by writeBin with these options (one traversal, the payloads are not touched)
+		// with WriteOptions::codec it is an upper bound, mats are stored compressed only if they get smaller
+		static uint64_t serializedSize(const CVMatTree& tree);
+		static uint64_t serializedSize(const CVMatTree& tree, const WriteOptions& options);
+
+		// writes into a caller provided buffer (e.g. shared memory) of serializedSize bytes without further allocation of the payload size
+		// returns the written size, 0 if the buffer is too small (options.parallel is ignored without codec)
+		static std::size_t writeBin(void* data, std::size_t size, const CVMatTree& tree);
+		static std::size_t writeBin(void* data, std::size_t size, const CVMatTree& tree, const WriteOptions& options);
+
+		// writes to an open file descriptor with writev (POSIX, returns false on other systems): the header fields are collected in a buffer,
+		// the mat payloads are passed from the mats to the kernel without copy (writeBin to a filename uses it for uncompressed files)
+		// compressed files are written by the stream writer through the same output, without serializing the file into memory
+		static bool writeBinFd(int fd, const CVMatTree& tree);
+		static bool writeBinFd(int fd, const CVMatTree& tree, const WriteOptions& options);
+		static CVMatTree readBin(const void* data, std::size_t size);
+		static CVMatTree readBin(const void* data, std::size_t size, const ReadOptions& options);
+
+		// reads the file into an existing tree, its nodes, mats and strings are reused where the file has the same structure,
+		// mat size and type, differing nodes are replaced (reloading a file of unchanged structure from a stream allocates no memory)
+		// the data of reused mats is overwritten in place, also for mats sharing it
+		// returns false for an invalid file, the tree is then partially read
+		static bool readBinInto(CVMatTree& tree, const std::string& filename);
+		static bool readBinInto(CVMatTree& tree, std::istream& stream);
+
+		// reads only the nodes matching one of the path patterns (e.g. "meta/*" or "bscans/*/segmentation") with their subtrees
+		// a pattern segment matches a dir name or list index with the wildcards * and ?, "**" matches any number of segments
+		// all other nodes are skipped without reading their payload, skipped list elements stay undef to keep the indices,
+		// dirs and lists without selected subnodes are omitted
+		static CVMatTree readBin(const std::string& filename, const std::vector<std::string>& selector);
+		static CVMatTree readBin(std::istream& stream       , const std::vector<std::string>& selector);
+
+		// reads the file node by node and calls the handler without building a CVMatTree (constant memory)
+		// returns false if the file is invalid or the handler stopped the reading
+		static bool readEvents(const std::string& filename, EventHandler& handler);
+		static bool readEvents(std::istream& stream       , EventHandler& handler);
+
+		// maps the file into memory, the mats in the tree refer to the mapping without copy
+		// (copy on write, changes are not written back), the mapping lives as long as one of the mats
+		// note: the payload of a mat is not necessarily aligned to its element size
+		static CVMatTree mapBin (const std::string& filename, Callback* callback = nullptr);
+
+		// reads only the node with the given path (e.g. "a/b/3/c", escaped as in CVMatTreeBinIndex)
+		// uses the index of version 2 files, version 1 files are scanned without reading the skipped payloads
+		// returns an empty tree if the node does not exist
+		static CVMatTree readNode(const std::string& filename, const std::string& path);
+		static CVMatTree readNode(std::istream& stream       , const std::string& path);
+
+		// returns the table of contents of an indexed file or its sidecar index (empty for files without index)
+		static CVMatTreeBinIndex readIndex(const std::string& filename);
+
+		// scans a file header by header, seeking over the payloads, and writes its index into the sidecar file indexSidecarFilename()
+		// for files without index (version 1), readIndex, readNode and the parallel readBin use a sidecar that is not stale
+		// (size and modification time of the bin file are stored in the sidecar)
+		static bool writeIndexSidecar(const std::string& filename);
+		static std::string indexSidecarFilename(const std::string& filename);   // filename + ".idx"
+
 		static void writeMatlabReadCode (const char* filename);
 		static void writeMatlabWriteCode(const char* filename);
 	};
@@ -0,0 +1,453 @@
+/*
+ * Copyright (c) 2018 Kay Gawlik <kaydev@amarunet.de> <kay.gawlik@beuth-hochschule.de> <kay.gawlik@charite.de>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "treestructbincodec.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+#ifdef WITH_ZLIB
+#include <zlib.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CVMATTREE_SSE2
+#endif
+
+
+namespace CppFW
+{
+
+	namespace
+	{
+		std::size_t numChunks(std::size_t size, std::size_t chunkBytes)
+		{
+			return (size + chunkBytes - 1)/chunkBytes;
+		}
+
+		// ---- delta filter ----
+		// values of a row segment, the first channels values are kept, the others become the difference to the previous pixel
+
+#ifdef CVMATTREE_SSE2
+		template<typename T> struct Simd;
+		template<> struct Simd<uint8_t >
+		{
+			static __m128i sub (__m128i a, __m128i b)                { return _mm_sub_epi8 (a, b); }
+			static __m128i add (__m128i a, __m128i b)                { return _mm_add_epi8 (a, b); }
+			static __m128i set1(uint8_t  v)                          { return _mm_set1_epi8 (static_cast<char>(v)); }
+		};
+		template<> struct Simd<uint16_t>
+		{
+			static __m128i sub (__m128i a, __m128i b)                { return _mm_sub_epi16(a, b); }
+			static __m128i add (__m128i a, __m128i b)                { return _mm_add_epi16(a, b); }
+			static __m128i set1(uint16_t v)                          { return _mm_set1_epi16(static_cast<short>(v)); }
+		};
+		template<> struct Simd<uint32_t>
+		{
+			static __m128i sub (__m128i a, __m128i b)                { return _mm_sub_epi32(a, b); }
+			static __m128i add (__m128i a, __m128i b)                { return _mm_add_epi32(a, b); }
+			static __m128i set1(uint32_t v)                          { return _mm_set1_epi32(static_cast<int>(v)); }
+		};
+		template<> struct Simd<uint64_t>
+		{
+			static __m128i sub (__m128i a, __m128i b)                { return _mm_sub_epi64(a, b); }
+			static __m128i add (__m128i a, __m128i b)                { return _mm_add_epi64(a, b); }
+			static __m128i set1(uint64_t v)                          { return _mm_set1_epi64x(static_cast<long long>(v)); }
+		};
+
+		// inclusive prefix sum of the lanes
+		template<typename T>
+		inline __m128i prefixSum(__m128i x)
+		{
+			if(sizeof(T) <= 1) x = Simd<T>::add(x, _mm_slli_si128(x, 1));
+			if(sizeof(T) <= 2) x = Simd<T>::add(x, _mm_slli_si128(x, 2));
+			if(sizeof(T) <= 4) x = Simd<T>::add(x, _mm_slli_si128(x, 4));
+			return Simd<T>::add(x, _mm_slli_si128(x, 8));
+		}
+#endif
+
+		template<typename T>
+		void deltaEncode(const T* in, T* out, std::size_t n, std::size_t channels)
+		{
+			const std::size_t keep = std::min(n, channels);
+			std::memcpy(out, in, keep*sizeof(T));
+			std::size_t i = keep;
+#ifdef CVMATTREE_SSE2
+			const std::size_t lanes = 16/sizeof(T);
+			for(; i + lanes <= n; i += lanes)
+			{
+				const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+				const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i - channels));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), Simd<T>::sub(a, b));
+			}
+#endif
+			for(; i < n; ++i)
+				out[i] = static_cast<T>(in[i] - in[i - channels]);
+		}
+
+		template<typename T>
+		void deltaDecode(T* data, std::size_t n, std::size_t channels)
+		{
+			std::size_t i = std::min(n, channels);
+#ifdef CVMATTREE_SSE2
+			if(channels == 1 && n > 0)
+			{
+				const std::size_t lanes = 16/sizeof(T);
+				T last = data[0];
+				for(; i + lanes <= n; i += lanes)
+				{
+					__m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+					x = Simd<T>::add(prefixSum<T>(x), Simd<T>::set1(last));
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(data + i), x);
+					last = data[i + lanes - 1];
+				}
+			}
+#endif
+			for(; i < n; ++i)
+				data[i] = static_cast<T>(data[i] + data[i - channels]);
+		}
+
+		// calls kernel(begin, end) for the row segments of the chunk [offset, offset+size) of the payload
+		template<typename Kernel>
+		void forRowSegments(const CVMatTreeBinCodec::Layout& layout, std::size_t offset, std::size_t size, Kernel kernel)
+		{
+			std::size_t pos = 0;
+			while(pos < size)
+			{
+				const std::size_t inRow = (offset + pos) % layout.rowBytes;
+				const std::size_t end   = std::min(size, pos + layout.rowBytes - inRow);
+				kernel(pos, end);
+				pos = end;
+			}
+		}
+
+		template<typename T>
+		void deltaEncodeChunk(const CVMatTreeBinCodec::Layout& layout, std::size_t offset, const char* in, char* out, std::size_t size)
+		{
+			forRowSegments(layout, offset, size, [&](std::size_t begin, std::size_t end)
+			{
+				deltaEncode(reinterpret_cast<const T*>(in + begin), reinterpret_cast<T*>(out + begin), (end - begin)/sizeof(T), layout.channels);
+			});
+		}
+
+		template<typename T>
+		void deltaDecodeChunk(const CVMatTreeBinCodec::Layout& layout, std::size_t offset, char* data, std::size_t size)
+		{
+			forRowSegments(layout, offset, size, [&](std::size_t begin, std::size_t end)
+			{
+				deltaDecode(reinterpret_cast<T*>(data + begin), (end - begin)/sizeof(T), layout.channels);
+			});
+		}
+
+		void deltaEncodeChunk(const CVMatTreeBinCodec::Layout& layout, std::size_t offset, const char* in, char* out, std::size_t size)
+		{
+			switch(layout.elemSize1)
+			{
+				case 1: deltaEncodeChunk<uint8_t >(layout, offset, in, out, size); break;
+				case 2: deltaEncodeChunk<uint16_t>(layout, offset, in, out, size); break;
+				case 4: deltaEncodeChunk<uint32_t>(layout, offset, in, out, size); break;
+				case 8: deltaEncodeChunk<uint64_t>(layout, offset, in, out, size); break;
+			}
+		}
+
+		void deltaDecodeChunk(const CVMatTreeBinCodec::Layout& layout, std::size_t offset, char* data, std::size_t size)
+		{
+			switch(layout.elemSize1)
+			{
+				case 1: deltaDecodeChunk<uint8_t >(layout, offset, data, size); break;
+				case 2: deltaDecodeChunk<uint16_t>(layout, offset, data, size); break;
+				case 4: deltaDecodeChunk<uint32_t>(layout, offset, data, size); break;
+				case 8: deltaDecodeChunk<uint64_t>(layout, offset, data, size); break;
+			}
+		}
+
+		// ---- shuffle filter ----
+		// n values of S bytes, out[k*n + i] = byte k of value i
+
+#ifdef CVMATTREE_SSE2
+		// even and odd bytes of the 32 bytes a, b
+		inline void splitBytes(__m128i a, __m128i b, __m128i& even, __m128i& odd)
+		{
+			const __m128i mask = _mm_set1_epi16(0x00FF);
+			even = _mm_packus_epi16(_mm_and_si128(a, mask), _mm_and_si128(b, mask));
+			odd  = _mm_packus_epi16(_mm_srli_epi16(a, 8)  , _mm_srli_epi16(b, 8)  );
+		}
+#endif
+
+		template<std::size_t S>
+		void shuffle(const char* in, char* out, std::size_t n)
+		{
+			std::size_t i = 0;
+#ifdef CVMATTREE_SSE2
+			// 16 values per step, log2(S) rounds of even/odd splits give the byte planes
+			for(; i + 16 <= n; i += 16)
+			{
+				__m128i r[S];
+				for(std::size_t k = 0; k < S; ++k)
+					r[k] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i*S + 16*k));
+				for(std::size_t round = 1; round < S; round *= 2)
+				{
+					__m128i split[S];
+					for(std::size_t j = 0; j < S/2; ++j)
+						splitBytes(r[2*j], r[2*j + 1], split[j], split[j + S/2]);
+					std::copy(split, split + S, r);
+				}
+				for(std::size_t k = 0; k < S; ++k)
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(out + k*n + i), r[k]);
+			}
+#endif
+			for(; i < n; ++i)
+				for(std::size_t k = 0; k < S; ++k)
+					out[k*n + i] = in[i*S + k];
+		}
+
+		template<std::size_t S>
+		void unshuffle(const char* in, char* out, std::size_t n)
+		{
+			std::size_t i = 0;
+#ifdef CVMATTREE_SSE2
+			for(; i + 16 <= n; i += 16)
+			{
+				__m128i r[S];
+				for(std::size_t k = 0; k < S; ++k)
+					r[k] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + k*n + i));
+				for(std::size_t round = 1; round < S; round *= 2)
+				{
+					__m128i merged[S];
+					for(std::size_t j = 0; j < S/2; ++j)
+					{
+						merged[2*j    ] = _mm_unpacklo_epi8(r[j], r[j + S/2]);
+						merged[2*j + 1] = _mm_unpackhi_epi8(r[j], r[j + S/2]);
+					}
+					std::copy(merged, merged + S, r);
+				}
+				for(std::size_t k = 0; k < S; ++k)
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i*S + 16*k), r[k]);
+			}
+#endif
+			for(; i < n; ++i)
+				for(std::size_t k = 0; k < S; ++k)
+					out[i*S + k] = in[k*n + i];
+		}
+
+		void shuffleChunk(std::size_t elemSize1, const char* in, char* out, std::size_t size)
+		{
+			switch(elemSize1)
+			{
+				case 2 : shuffle<2>(in, out, size/2); break;
+				case 4 : shuffle<4>(in, out, size/4); break;
+				case 8 : shuffle<8>(in, out, size/8); break;
+				default: std::memcpy(out, in, size); break;
+			}
+		}
+
+		void unshuffleChunk(std::size_t elemSize1, const char* in, char* out, std::size_t size)
+		{
+			switch(elemSize1)
+			{
+				case 2 : unshuffle<2>(in, out, size/2); break;
+				case 4 : unshuffle<4>(in, out, size/4); break;
+				case 8 : unshuffle<8>(in, out, size/8); break;
+				default: std::memcpy(out, in, size); break;
+			}
+		}
+
+		bool isValidFilterLayout(uint32_t filters, const CVMatTreeBinCodec::Layout& layout, std::size_t chunkBytes)
+		{
+			if(filters & ~CVMatTreeBinCodec::KnownFilters)
+				return false;
+			if(filters == 0)
+				return true;
+			const std::size_t elemSize1 = layout.elemSize1;
+			return (elemSize1 == 1 || elemSize1 == 2 || elemSize1 == 4 || elemSize1 == 8)
+			    && layout.channels > 0
+			    && layout.rowBytes > 0 && layout.rowBytes % elemSize1 == 0
+			    && chunkBytes % elemSize1 == 0;
+		}
+
+		// ---- codecs ----
+
+#ifdef WITH_ZLIB
+		bool deflateChunk(int level, const char* data, std::size_t size, std::string& out)
+		{
+			uLongf outSize = compressBound(static_cast<uLong>(size));
+			out.resize(outSize);
+			if(compress2(reinterpret_cast<Bytef*>(&out[0]), &outSize, reinterpret_cast<const Bytef*>(data), static_cast<uLong>(size), level) != Z_OK)
+				return false;
+			out.resize(outSize);
+			return true;
+		}
+
+		bool inflateChunk(const char* compressed, std::size_t compressedSize, char* data, std::size_t size)
+		{
+			uLongf outSize = static_cast<uLongf>(size);
+			return uncompress(reinterpret_cast<Bytef*>(data), &outSize, reinterpret_cast<const Bytef*>(compressed), static_cast<uLong>(compressedSize)) == Z_OK
+			    && outSize == size;
+		}
+#endif
+	}
+
+
+	bool CVMatTreeBinCodec::isAvailable(Codec codec)
+	{
+		switch(codec)
+		{
+			case Codec::None:
+				return true;
+			case Codec::Deflate:
+#ifdef WITH_ZLIB
+				return true;
+#else
+				return false;
+#endif
+		}
+		return false;
+	}
+
+	bool CVMatTreeBinCodec::compress(Codec codec, uint32_t filters, const Layout& layout, int level, const char* data, std::size_t size, std::size_t chunkBytes, std::string& compressed)
+	{
+		if(codec != Codec::Deflate || !isAvailable(codec) || chunkBytes == 0 || !isValidFilterLayout(filters, layout, chunkBytes))
+			return false;
+
+#ifdef WITH_ZLIB
+		const std::size_t chunks = numChunks(size, chunkBytes);
+		std::vector<std::string> buffers(chunks);
+		std::atomic<bool> ok(true);
+		cv::parallel_for_(cv::Range(0, static_cast<int>(chunks)), [&](const cv::Range& range)
+		{
+			std::string deltaBuffer;
+			std::string shuffleBuffer;
+			for(int i = range.start; i < range.end; ++i)
+			{
+				const std::size_t begin     = static_cast<std::size_t>(i)*chunkBytes;
+				const std::size_t chunkSize = std::min(chunkBytes, size - begin);
+
+				const char* chunk = data + begin;
+				if(filters & Delta)
+				{
+					deltaBuffer.resize(chunkSize);
+					deltaEncodeChunk(layout, begin, chunk, &deltaBuffer[0], chunkSize);
+					chunk = deltaBuffer.data();
+				}
+				if(filters & Shuffle)
+				{
+					shuffleBuffer.resize(chunkSize);
+					shuffleChunk(layout.elemSize1, chunk, &shuffleBuffer[0], chunkSize);
+					chunk = shuffleBuffer.data();
+				}
+
+				if(!deflateChunk(level, chunk, chunkSize, buffers[static_cast<std::size_t>(i)]))
+					ok = false;
+			}
+		});
+		if(!ok)
+			return false;
+
+		std::size_t compressedSize = sizeof(uint32_t)*(chunks + 1);
+		for(const std::string& buffer : buffers)
+			compressedSize += buffer.size();
+
+		compressed.resize(compressedSize);
+		char* out = &compressed[0];
+		const uint32_t numChunksValue = static_cast<uint32_t>(chunks);
+		std::memcpy(out, &numChunksValue, sizeof(uint32_t));
+		out += sizeof(uint32_t);
+		for(const std::string& buffer : buffers)
+		{
+			const uint32_t chunkSize = static_cast<uint32_t>(buffer.size());
+			std::memcpy(out, &chunkSize, sizeof(uint32_t));
+			out += sizeof(uint32_t);
+		}
+		for(const std::string& buffer : buffers)
+		{
+			std::memcpy(out, buffer.data(), buffer.size());
+			out += buffer.size();
+		}
+		return true;
+#else
+		(void)level;
+		(void)data;
+		(void)compressed;
+		return false;
+#endif
+	}
+
+	bool CVMatTreeBinCodec::decompress(Codec codec, uint32_t filters, const Layout& layout, const char* compressed, std::size_t compressedSize, char* data, std::size_t size, std::size_t chunkBytes)
+	{
+		if(codec != Codec::Deflate || !isAvailable(codec) || chunkBytes == 0 || compressedSize < sizeof(uint32_t) || !isValidFilterLayout(filters, layout, chunkBytes))
+			return false;
+
+#ifdef WITH_ZLIB
+		uint32_t chunks;
+		std::memcpy(&chunks, compressed, sizeof(uint32_t));
+		if(chunks != numChunks(size, chunkBytes) || compressedSize < sizeof(uint32_t)*(chunks + 1u))
+			return false;
+
+		// offsets of the compressed chunks
+		std::vector<std::size_t> offsets(chunks + 1u);
+		offsets[0] = sizeof(uint32_t)*(chunks + 1u);
+		for(uint32_t i = 0; i < chunks; ++i)
+		{
+			uint32_t chunkSize;
+			std::memcpy(&chunkSize, compressed + sizeof(uint32_t)*(i + 1u), sizeof(uint32_t));
+			offsets[i + 1u] = offsets[i] + chunkSize;
+		}
+		if(offsets.back() != compressedSize)
+			return false;
+
+		std::atomic<bool> ok(true);
+		cv::parallel_for_(cv::Range(0, static_cast<int>(chunks)), [&](const cv::Range& range)
+		{
+			std::string shuffleBuffer;
+			for(int i = range.start; i < range.end && ok; ++i)
+			{
+				const std::size_t chunk     = static_cast<std::size_t>(i);
+				const std::size_t begin     = chunk*chunkBytes;
+				const std::size_t chunkSize = std::min(chunkBytes, size - begin);
+
+				char* out = data + begin;
+				if(filters & Shuffle)
+				{
+					shuffleBuffer.resize(chunkSize);
+					out = &shuffleBuffer[0];
+				}
+
+				if(!inflateChunk(compressed + offsets[chunk], offsets[chunk + 1] - offsets[chunk], out, chunkSize))
+				{
+					ok = false;
+					break;
+				}
+
+				if(filters & Shuffle)
+					unshuffleChunk(layout.elemSize1, out, data + begin, chunkSize);
+				if(filters & Delta)
+					deltaDecodeChunk(layout, begin, data + begin, chunkSize);
+			}
+		});
+		return ok;
+#else
+		(void)data;
+		return false;
+#endif
+	}
+
+}
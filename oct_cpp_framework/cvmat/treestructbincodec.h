@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2018 Kay Gawlik <kaydev@amarunet.de> <kay.gawlik@beuth-hochschule.de> <kay.gawlik@charite.de>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+
+namespace CppFW
+{
+	// compression of mat payloads in the bin format (see CVMatTreeStructBin::WriteOptions::codec)
+	// the payload is split into chunks of chunkBytes, which are filtered and compressed independently on parallel tasks (cv::parallel_for_)
+	// compressed layout: uint32 number of chunks, uint32 compressed size of each chunk, compressed chunks
+	class CVMatTreeBinCodec
+	{
+	public:
+		enum class Codec : uint32_t { None = 0, Deflate = 1 };
+
+		// reversible pre-filters, applied to each chunk before the codec (SSE2 kernels with scalar fallback)
+		enum Filter : uint32_t
+		{
+			Delta   = 1 << 0,                                        // difference to the previous pixel (same channel) in the row, integer arithmetic on the bit pattern
+			Shuffle = 1 << 1,                                        // bytes grouped by significance (byte 0 of all values, byte 1, ...)
+			KnownFilters = Delta | Shuffle
+		};
+
+		// element layout of the payload, used by the filters
+		struct Layout
+		{
+			std::size_t elemSize1 = 1;                               // bytes of one channel value (1, 2, 4 or 8)
+			std::size_t channels  = 1;
+			std::size_t rowBytes  = 0;
+		};
+
+		static bool isAvailable(Codec codec);                        // Deflate requires zlib (WITH_ZLIB)
+
+		// level: zlib compression level, -1 is the zlib default
+		static bool compress  (Codec codec, uint32_t filters, const Layout& layout, int level, const char* data, std::size_t size, std::size_t chunkBytes, std::string& compressed);
+		static bool decompress(Codec codec, uint32_t filters, const Layout& layout, const char* compressed, std::size_t compressedSize, char* data, std::size_t size, std::size_t chunkBytes);
+	};
+
+}
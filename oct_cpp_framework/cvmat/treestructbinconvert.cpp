@@ -0,0 +1,175 @@
+/*
+ * Copyright (c) 2018 Kay Gawlik <kaydev@amarunet.de> <kay.gawlik@beuth-hochschule.de> <kay.gawlik@charite.de>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "treestructbinconvert.h"
+
+#include <cstdint>
+
+#include <opencv2/core/core.hpp>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CVMATTREE_SSE2
+#endif
+
+
+namespace CppFW
+{
+
+	namespace
+	{
+#ifdef CVMATTREE_SSE2
+		// loads 8 values widened to int32 (lo: values 0-3, hi: values 4-7)
+		template<typename T> struct Widen                            { static const bool available = false; };
+		template<> struct Widen<uint8_t>
+		{
+			static const bool available = true;
+			static void load8(const uint8_t* src, __m128i& lo, __m128i& hi)
+			{
+				const __m128i zero = _mm_setzero_si128();
+				const __m128i v    = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(src)), zero);
+				lo = _mm_unpacklo_epi16(v, zero);
+				hi = _mm_unpackhi_epi16(v, zero);
+			}
+		};
+		template<> struct Widen<int8_t>
+		{
+			static const bool available = true;
+			static void load8(const int8_t* src, __m128i& lo, __m128i& hi)
+			{
+				__m128i v = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src));
+				v  = _mm_srai_epi16(_mm_unpacklo_epi8(v, v), 8);      // sign extension by arithmetic shift of the duplicated byte
+				lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+				hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+			}
+		};
+		template<> struct Widen<uint16_t>
+		{
+			static const bool available = true;
+			static void load8(const uint16_t* src, __m128i& lo, __m128i& hi)
+			{
+				const __m128i zero = _mm_setzero_si128();
+				const __m128i v    = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+				lo = _mm_unpacklo_epi16(v, zero);
+				hi = _mm_unpackhi_epi16(v, zero);
+			}
+		};
+		template<> struct Widen<int16_t>
+		{
+			static const bool available = true;
+			static void load8(const int16_t* src, __m128i& lo, __m128i& hi)
+			{
+				const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+				lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+				hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+			}
+		};
+		template<> struct Widen<int32_t>
+		{
+			static const bool available = true;
+			static void load8(const int32_t* src, __m128i& lo, __m128i& hi)
+			{
+				lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+				hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 4));
+			}
+		};
+
+		inline void store8(float* dst, __m128i lo, __m128i hi)
+		{
+			_mm_storeu_ps(dst    , _mm_cvtepi32_ps(lo));
+			_mm_storeu_ps(dst + 4, _mm_cvtepi32_ps(hi));
+		}
+
+		inline void store8(double* dst, __m128i lo, __m128i hi)
+		{
+			_mm_storeu_pd(dst    , _mm_cvtepi32_pd(lo));
+			_mm_storeu_pd(dst + 2, _mm_cvtepi32_pd(_mm_unpackhi_epi64(lo, lo)));
+			_mm_storeu_pd(dst + 4, _mm_cvtepi32_pd(hi));
+			_mm_storeu_pd(dst + 6, _mm_cvtepi32_pd(_mm_unpackhi_epi64(hi, hi)));
+		}
+#endif
+
+		template<typename Src, typename Dst>
+		void convertValues(const void* srcData, void* dstData, std::size_t n)
+		{
+			const Src* src = static_cast<const Src*>(srcData);
+			Dst*       dst = static_cast<Dst*>(dstData);
+			std::size_t i = 0;
+#ifdef CVMATTREE_SSE2
+			if constexpr(Widen<Src>::available)
+			{
+				for(; i + 8 <= n; i += 8)
+				{
+					__m128i lo;
+					__m128i hi;
+					Widen<Src>::load8(src + i, lo, hi);
+					store8(dst + i, lo, hi);
+				}
+			}
+#endif
+			for(; i < n; ++i)
+				dst[i] = static_cast<Dst>(src[i]);
+		}
+
+		template<typename Dst>
+		void convertTo(int srcDepth, const void* src, void* dst, std::size_t n)
+		{
+			switch(srcDepth)
+			{
+				case CV_8U : convertValues<uint8_t , Dst>(src, dst, n); break;
+				case CV_8S : convertValues<int8_t  , Dst>(src, dst, n); break;
+				case CV_16U: convertValues<uint16_t, Dst>(src, dst, n); break;
+				case CV_16S: convertValues<int16_t , Dst>(src, dst, n); break;
+				case CV_32S: convertValues<int32_t , Dst>(src, dst, n); break;
+				case CV_32F: convertValues<float   , Dst>(src, dst, n); break;
+				case CV_64F: convertValues<double  , Dst>(src, dst, n); break;
+				default:
+					break;
+			}
+		}
+	}
+
+
+	bool CVMatTreeBinConvert::isSupported(int srcDepth, int dstDepth)
+	{
+		if(dstDepth != CV_32F && dstDepth != CV_64F)
+			return false;
+
+		switch(srcDepth)
+		{
+			case CV_8U:
+			case CV_8S:
+			case CV_16U:
+			case CV_16S:
+			case CV_32S:
+			case CV_32F:
+			case CV_64F:
+				return true;
+			default:
+				return false;
+		}
+	}
+
+	void CVMatTreeBinConvert::convert(int srcDepth, int dstDepth, const void* src, void* dst, std::size_t n)
+	{
+		if(dstDepth == CV_32F)
+			convertTo<float >(srcDepth, src, dst, n);
+		else if(dstDepth == CV_64F)
+			convertTo<double>(srcDepth, src, dst, n);
+	}
+
+}
@@ -0,0 +1,37 @@
+/*
+ * Copyright (c) 2018 Kay Gawlik <kaydev@amarunet.de> <kay.gawlik@beuth-hochschule.de> <kay.gawlik@charite.de>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+
+
+namespace CppFW
+{
+	// depth conversion of mat payloads while reading (see CVMatTreeStructBin::ReadOptions::convertDepth)
+	// the values are converted from the read buffer into the destination mat (SSE2 kernels for 8, 16 and 32 bit integers with scalar fallback)
+	class CVMatTreeBinConvert
+	{
+	public:
+		// dstDepth CV_32F or CV_64F, srcDepth a depth of the bin format
+		static bool isSupported(int srcDepth, int dstDepth);
+
+		// n values (channels counted separately), src and dst do not overlap
+		static void convert(int srcDepth, int dstDepth, const void* src, void* dst, std::size_t n);
+	};
+
+}
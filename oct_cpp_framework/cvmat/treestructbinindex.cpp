@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2018 Kay Gawlik <kaydev@amarunet.de> <kay.gawlik@beuth-hochschule.de> <kay.gawlik@charite.de>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "treestructbinindex.h"
+
+
+namespace CppFW
+{
+
+	void CVMatTreeBinIndex::appendPathSegment(std::string& path, std::string_view name)
+	{
+		if(!path.empty())
+			path += '/';
+		for(char c : name)
+		{
+			if(c == '/' || c == '\\')
+				path += '\\';
+			path += c;
+		}
+	}
+
+	std::vector<std::string> CVMatTreeBinIndex::splitPath(const std::string& path)
+	{
+		std::vector<std::string> segments;
+		std::string segment;
+		for(std::size_t i = 0; i < path.size(); ++i)
+		{
+			const char c = path[i];
+			if(c == '\\' && i + 1 < path.size())
+				segment += path[++i];
+			else if(c == '/')
+			{
+				if(!segment.empty())
+					segments.push_back(segment);
+				segment.clear();
+			}
+			else
+				segment += c;
+		}
+		if(!segment.empty())
+			segments.push_back(segment);
+		return segments;
+	}
+
+	std::string CVMatTreeBinIndex::normalizePath(const std::string& path)
+	{
+		std::string result;
+		for(const std::string& segment : splitPath(path))
+			appendPathSegment(result, segment);
+		return result;
+	}
+
+	void CVMatTreeBinIndex::addEntry(const Entry& entry)
+	{
+		pathMap.emplace(entry.path, entries.size());                 // the first entry wins for a path
+		entries.push_back(entry);
+	}
+
+	void CVMatTreeBinIndex::clear()
+	{
+		entries.clear();
+		pathMap.clear();
+	}
+
+	const CVMatTreeBinIndex::Entry* CVMatTreeBinIndex::find(const std::string& path) const
+	{
+		std::unordered_map<std::string, std::size_t>::const_iterator it = pathMap.find(path);
+		if(it == pathMap.end())
+			return nullptr;
+		return &entries[it->second];
+	}
+
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2018 Kay Gawlik <kaydev@amarunet.de> <kay.gawlik@beuth-hochschule.de> <kay.gawlik@charite.de>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <cstdint>
+
+
+namespace CppFW
+{
+	// table of contents of a bin file: node path -> position in the file
+	// paths are the dir names and list indices joined by '/', e.g. "a/b/3/c", the root node has the path ""
+	// '/' and '\' in dir names are escaped with '\', e.g. the key "a/b" has the path "a\/b"
+	class CVMatTreeBinIndex
+	{
+	public:
+		static void appendPathSegment(std::string& path, std::string_view name);   // appends '/' (not for the root) and the escaped name
+		static std::vector<std::string> splitPath(const std::string& path);          // unescaped segments, empty segments are skipped
+		static std::string normalizePath(const std::string& path);                   // canonical escaping of the segments
+
+		struct Entry
+		{
+			std::string path;
+			uint64_t    offset   = 0;                                  // position of the node (type field), relative to the file begin
+			uint64_t    size     = 0;                                  // bytes of the complete node inclusive subnodes
+			uint32_t    type     = 0;                                  // CVMatTree::Type
+
+			uint32_t    depth    = 0;                                  // mat nodes only
+			uint32_t    channels = 0;
+			uint32_t    rows     = 0;                                  // first two dims of mats with more than 2 dims
+			uint32_t    cols     = 0;
+		};
+
+		void addEntry(const Entry& entry);
+		void clear();
+
+		const Entry* find(const std::string& path) const;
+		const std::vector<Entry>& getEntries() const                 { return entries; }
+		bool empty() const                                           { return entries.empty(); }
+
+	private:
+		std::vector<Entry>                           entries;
+		std::unordered_map<std::string, std::size_t> pathMap;
+	};
+
+}
@@ -17,6 +17,9 @@
 
 #include "zipcpp.h"
 
+#include <algorithm>
+#include <limits>
+
 
 
 #ifdef WITH_ZLIB
@@ -42,7 +45,10 @@ namespace CppFW
 	{
 		zip_fileinfo zinfo{};
 
-		/*int code = */zipOpenNewFileInZip(file,
+		// zip64 extensions are only written for files that need them
+		const bool zip64 = bufflen >= 0xffffffffu;
+
+		/*int code = */zipOpenNewFileInZip64(file,
 		                       zipPath.c_str(),
 		                       &zinfo,
 		                       nullptr,
@@ -51,9 +57,18 @@ namespace CppFW
 		                       0,
 		                       nullptr,
 		                       compress?Z_DEFLATED:0,
-		                       Z_DEFAULT_COMPRESSION);
+		                       Z_DEFAULT_COMPRESSION,
+		                       zip64 ? 1 : 0);
 
-		zipWriteInFileInZip(file, buff, static_cast<unsigned>(bufflen));
+		// zipWriteInFileInZip takes an unsigned length
+		const std::size_t maxWriteLength = std::numeric_limits<unsigned>::max();
+		while(bufflen > 0)
+		{
+			const std::size_t writeLength = std::min(bufflen, maxWriteLength);
+			zipWriteInFileInZip(file, buff, static_cast<unsigned>(writeLength));
+			buff    += writeLength;
+			bufflen -= writeLength;
+		}
 		zipCloseFileInZip(file);
 	}
 }
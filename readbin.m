@@ -0,0 +1,118 @@
+function [ s ] = readbin(filename)
+% [ s ] = readbin(filename)
+% read a bin file writen by C++ class CVMatTreeStructBin
+% Input  : a bin file
+% Output : a data structure contains strings, scalare, 2D matrics, cellarrays, structures
+
+% this file is generated by CVMatTreeStructBin::writeMatlabReadCode
+	fileID = fopen(filename);
+	if fileID == -1
+		error(['cant open file ' filename]);
+	end
+
+	magic    = fread(fileID, 8, 'char');
+	if strcmp(convertChar2String(magic), 'CVMatBin') == false
+		error('not a bin file')
+	end
+	version  = fread(fileID, 1, 'uint32');
+	assert(version == 1 || version == 2);
+	header   = fread(fileID, 4, 'uint32=>uint32');
+	countType = 'uint32';
+	if version == 2
+		assert(bitand(header(1), uint32(4294967282)) == 0, 'unsupported format flags');
+		if bitand(header(1), uint32(4)) ~= 0
+			countType = 'uint64';
+		end
+	end
+	s  = readNode(fileID, countType);
+	fclose(fileID);
+end
+
+
+function [node] = readNode(fileID, countType)
+	type  = fread(fileID, 1, 'uint32');
+	switch(type)
+		case 0
+			% node not written because unhandled type
+			node = [];
+		case 1
+			node = readDir(fileID, countType);
+		case 3
+			node = readMat(fileID);
+		case 2
+			node = readList(fileID, countType);
+		case 4
+			node = readString(fileID, countType);
+		otherwise
+			fprintf('unknown node type %d\n', type);
+			node = [];
+	end
+end
+
+function [node] = readDir(fileID, countType)
+	dirLength  = fread(fileID, 1, countType);
+	for i=1:dirLength
+		name        = readString(fileID, countType);
+		node.(name) = readNode(fileID, countType);
+	end
+end
+
+function [node] = readList(fileID, countType)
+	dirLength  = fread(fileID, 1, countType);
+	node = cell(1, dirLength);
+	for i=1:dirLength
+		node{i} = readNode(fileID, countType);
+	end
+end
+
+function [string] = readString(fileID, countType)
+	stringLength  = fread(fileID, 1, countType);
+	str    = fread(fileID, stringLength, 'char');
+	string = convertChar2String(str);
+end
+
+function [string] = convertChar2String(str)
+	string = sprintf('%s', str);
+end
+
+function [mat] = readMat(fileID)
+	data     = fread(fileID, 8, 'uint32=>uint32');
+	depth    = data(1);
+	channels = data(2);
+	rows     = data(3);
+	cols     = data(4);
+	dims     = bitshift(data(5), -24);
+	% data(6) - data(8) unused
+	if dims > 2
+		% read as 2d mat with rows of the last dimension
+		sizes = [double(rows) double(cols) fread(fileID, double(dims)-2, 'uint32')'];
+		rows  = prod(sizes(1:end-1));
+		cols  = sizes(end);
+	end
+	switch depth
+		case 0 % OpenCV type for uint8_t
+			mat = fread(fileID, [cols rows*channels], 'uint8=>uint8')';
+		case 2 % OpenCV type for uint16_t
+			mat = fread(fileID, [cols rows*channels], 'uint16=>uint16')';
+		case 1 % OpenCV type for int8_t
+			mat = fread(fileID, [cols rows*channels], 'int8=>int8')';
+		case 3 % OpenCV type for int16_t
+			mat = fread(fileID, [cols rows*channels], 'int16=>int16')';
+		case 4 % OpenCV type for int32_t
+			mat = fread(fileID, [cols rows*channels], 'int32=>int32')';
+		case 5 % OpenCV type for float
+			mat = fread(fileID, [cols rows*channels], 'single=>single')';
+		case 6 % OpenCV type for double
+			mat = fread(fileID, [cols rows*channels], 'double=>double')';
+	end
+	if channels > 1
+		A = reshape(mat', [channels cols*rows]);
+		B = reshape(A', [cols, rows, channels]);
+		mat = permute(B, [2,1,3]);
+	end
+	if dims > 2
+		mat = permute(mat, [2,1,3]);
+		mat = reshape(mat, [fliplr(sizes) double(channels)]);
+		mat = permute(mat, [dims:-1:1 dims+1]);
+	end
+end
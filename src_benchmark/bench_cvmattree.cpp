@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) 2018 Kay Gawlik <kaydev@amarunet.de> <kay.gawlik@beuth-hochschule.de> <kay.gawlik@charite.de>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <cvmat/cvmattreestruct.h>
+#include <cvmat/cvmattreearena.h>
+#include <cvmat/cvmattreestructextra.h>
+#include <cvmat/treestructbin.h>
+
+#include <opencv2/opencv.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <string>
+
+// build, lookup, read and destroy time of trees with many small nodes (e.g. per A-scan metadata)
+// with and without CVMatTreeArena
+// usage: bench_cvmattree [numEntries]
+
+namespace
+{
+	typedef std::chrono::steady_clock Clock;
+
+	double seconds(Clock::time_point start)
+	{
+		return std::chrono::duration<double>(Clock::now() - start).count();
+	}
+
+	template<typename T>
+	void setScalar(CppFW::CVMatTree& node, T value)
+	{
+		cv::Mat& mat = node.getMat();
+		mat.create(1, 1, cv::DataType<T>::type);
+		mat.at<T>(0, 0) = value;
+	}
+
+	void fillTree(CppFW::CVMatTree& tree, int numEntries)
+	{
+		for(int i = 0; i < numEntries; ++i)
+		{
+			CppFW::CVMatTree& entry = tree.newListNode();
+			setScalar<int   >(entry.getDirNode("index"           ), i      );
+			setScalar<double>(entry.getDirNode("quality"         ), i*0.5  );
+			setScalar<double>(entry.getDirNode("segmentation_ilm"), i*0.25 );
+			setScalar<double>(entry.getDirNode("segmentation_bm" ), i*0.75 );
+			entry.getDirNode("name").getString() = "ascan";
+		}
+	}
+
+	void printResult(const char* name, const char* step, int numEntries, double sec)
+	{
+		std::cout << name << "\t" << step << "\t" << sec*1e3 << " ms\t" << static_cast<double>(numEntries)/sec/1e6 << " M entries/s\n";
+	}
+
+	void benchBuild(const char* name, int numEntries, bool useArena)
+	{
+		Clock::time_point start = Clock::now();
+		std::unique_ptr<CppFW::CVMatTreeArena> arena(useArena ? new CppFW::CVMatTreeArena : nullptr);
+		std::unique_ptr<CppFW::CVMatTree> tree(useArena ? new CppFW::CVMatTree(*arena) : new CppFW::CVMatTree);
+		fillTree(*tree, numEntries);
+		printResult(name, "build  ", numEntries, seconds(start));
+
+		start = Clock::now();
+		double sum = 0;
+		for(const CppFW::CVMatTree* entry : tree->getNodeList())
+		{
+			sum += CppFW::CVMatTreeExtra::getCvScalar(entry, "index"           , 0.);
+			sum += CppFW::CVMatTreeExtra::getCvScalar(entry, "segmentation_bm" , 0.);
+			sum += CppFW::CVMatTreeExtra::getCvScalar(entry, "missing"         , 0.);
+		}
+		printResult(name, "lookup ", numEntries, seconds(start));
+		if(sum < 0)
+			std::cerr << "unexpected lookup result\n";
+
+		start = Clock::now();
+		tree .reset();
+		arena.reset();
+		printResult(name, "destroy", numEntries, seconds(start));
+	}
+
+	void benchRead(const char* name, const std::string& filename, int numEntries, bool useArena)
+	{
+		Clock::time_point start = Clock::now();
+		std::unique_ptr<CppFW::CVMatTreeArena> arena(useArena ? new CppFW::CVMatTreeArena : nullptr);
+		CppFW::CVMatTreeStructBin::ReadOptions options;
+		options.arena = arena.get();
+		std::unique_ptr<CppFW::CVMatTree> tree(new CppFW::CVMatTree(CppFW::CVMatTreeStructBin::readBin(filename, options)));
+		printResult(name, "read   ", numEntries, seconds(start));
+
+		start = Clock::now();
+		tree .reset();
+		arena.reset();
+		printResult(name, "destroy", numEntries, seconds(start));
+	}
+}
+
+
+int main(int argc, char* argv[])
+{
+	const int numEntries = argc > 1 ? std::stoi(argv[1]) : 100000;
+
+	benchBuild("heap ", numEntries, false);
+	benchBuild("arena", numEntries, true );
+
+	const std::string filename = "bench_cvmattree.bin";
+	{
+		CppFW::CVMatTree tree;
+		fillTree(tree, numEntries);
+		CppFW::CVMatTreeStructBin::writeBin(filename, tree);
+	}
+	benchRead("heap ", filename, numEntries, false);
+	benchRead("arena", filename, numEntries, true );
+	std::remove(filename.c_str());
+
+	return 0;
+}
@@ -0,0 +1,235 @@
+/*
+ * Copyright (c) 2018 Kay Gawlik <kaydev@amarunet.de> <kay.gawlik@beuth-hochschule.de> <kay.gawlik@charite.de>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cvmat/cvmattreestruct.h>
+#include <cvmat/treestructbin.h>
+
+#include <opencv2/opencv.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// throughput of CVMatTreeStructBin for OCT like volumes (list of B-scans)
+// usage: bench_treestructbin [numBScans] [rows] [cols]
+
+namespace
+{
+	typedef std::chrono::steady_clock Clock;
+
+	template<typename T>
+	void createVolume(CppFW::CVMatTree& tree, int numBScans, int rows, int cols)
+	{
+		for(int i = 0; i < numBScans; ++i)
+		{
+			cv::Mat& mat = tree.newListNode().getMat();
+			mat.create(rows, cols, cv::DataType<T>::type);
+			for(int r = 0; r < rows; ++r)
+			{
+				T* p = mat.ptr<T>(r);
+				for(int c = 0; c < cols; ++c)
+					p[c] = static_cast<T>(r*cols + c + i);
+			}
+		}
+	}
+
+	double seconds(Clock::time_point start)
+	{
+		return std::chrono::duration<double>(Clock::now() - start).count();
+	}
+
+	void printResult(const char* name, const char* step, std::size_t bytes, double sec)
+	{
+		std::cout << name << "\t" << step << "\t" << static_cast<double>(bytes)/1e6 << " MB\t"
+		          << sec*1e3 << " ms\t" << static_cast<double>(bytes)/sec/1e9 << " GB/s\n";
+	}
+
+	template<typename T>
+	void benchType(const char* name, int numBScans, int rows, int cols)
+	{
+		CppFW::CVMatTree tree;
+		createVolume<T>(tree, numBScans, rows, cols);
+
+		std::stringstream sstream;
+		Clock::time_point start = Clock::now();
+		CppFW::CVMatTreeStructBin::writeBin(sstream, tree);
+		double writeTime = seconds(start);
+		const std::size_t bytes = sstream.str().size();
+		printResult(name, "write stream", bytes, writeTime);
+
+		sstream.seekg(0);
+		start = Clock::now();
+		CppFW::CVMatTree readTree = CppFW::CVMatTreeStructBin::readBin(sstream);
+		printResult(name, "read stream ", bytes, seconds(start));
+
+		sstream.clear();
+		sstream.seekg(0);
+		start = Clock::now();
+		const bool readInto = CppFW::CVMatTreeStructBin::readBinInto(readTree, sstream);   // reuses the mats of readTree
+		printResult(name, "read into   ", bytes, seconds(start));
+
+		// in memory without iostream
+		std::vector<char> buffer;
+		start = Clock::now();
+		CppFW::CVMatTreeStructBin::writeBin(buffer, tree);
+		printResult(name, "write buffer", bytes, seconds(start));
+
+		start = Clock::now();
+		const uint64_t serializedSize = CppFW::CVMatTreeStructBin::serializedSize(tree);
+		printResult(name, "size        ", bytes, seconds(start));
+
+		start = Clock::now();
+		CppFW::CVMatTree bufferTree = CppFW::CVMatTreeStructBin::readBin(buffer.data(), buffer.size());
+		printResult(name, "read buffer ", bytes, seconds(start));
+
+		CppFW::CVMatTreeStructBin::ReadOptions shareOptions;
+		shareOptions.shareBuffer = true;
+		start = Clock::now();
+		CppFW::CVMatTree sharedTree = CppFW::CVMatTreeStructBin::readBin(buffer.data(), buffer.size(), shareOptions);
+		printResult(name, "read shared ", bytes, seconds(start));
+		const bool equalBuffer = bufferTree == tree && sharedTree == tree && serializedSize == buffer.size();
+
+		CppFW::CVMatTreeStructBin::WriteOptions parallelOptions;
+		parallelOptions.parallel = true;
+		std::stringstream parallelStream;
+		start = Clock::now();
+		CppFW::CVMatTreeStructBin::writeBin(parallelStream, tree, parallelOptions);
+		printResult(name, "write par   ", bytes, seconds(start));
+
+		const std::string filename = std::string("bench_") + name + ".bin";
+		start = Clock::now();
+		CppFW::CVMatTreeStructBin::writeBin(filename, tree);
+		printResult(name, "write file  ", bytes, seconds(start));
+
+		start = Clock::now();
+		CppFW::CVMatTreeStructBin::writeBin(filename, tree, parallelOptions);
+		printResult(name, "write file p", bytes, seconds(start));
+
+		// through the stream buffer of an ofstream (writeBin to a filename uses writev for uncompressed files)
+		start = Clock::now();
+		{
+			std::ofstream fileStream(filename, std::ios::binary | std::ios::out);
+			CppFW::CVMatTreeStructBin::writeBin(fileStream, tree);
+		}
+		printResult(name, "write ofstr ", bytes, seconds(start));
+
+		start = Clock::now();
+		CppFW::CVMatTree fileTree = CppFW::CVMatTreeStructBin::readBin(filename);
+		printResult(name, "read file   ", bytes, seconds(start));
+
+		CppFW::CVMatTreeStructBin::ReadOptions readOptions;
+		readOptions.parallel = true;
+		start = Clock::now();
+		CppFW::CVMatTree parallelTree = CppFW::CVMatTreeStructBin::readBin(filename, readOptions);
+		printResult(name, "read file p ", bytes, seconds(start));
+
+		// float volume: convertTo after reading versus conversion while reading
+		start = Clock::now();
+		CppFW::CVMatTree convertTree = CppFW::CVMatTreeStructBin::readBin(filename);
+		for(std::size_t i = 0; i < convertTree.getNumElements(); ++i)
+		{
+			cv::Mat& mat = convertTree.getListNode(i).getMat();
+			mat.convertTo(mat, CV_32F);
+		}
+		printResult(name, "read convTo ", bytes, seconds(start));
+
+		CppFW::CVMatTreeStructBin::ReadOptions convertOptions;
+		convertOptions.convertDepth = CV_32F;
+		start = Clock::now();
+		CppFW::CVMatTree convertedTree = CppFW::CVMatTreeStructBin::readBin(filename, convertOptions);
+		printResult(name, "read f32    ", bytes, seconds(start));
+		const bool equalConverted = convertedTree == convertTree;
+
+		// the same volume as one 3d mat (one header, one allocation, one read)
+		CppFW::CVMatTree volumeTree;
+		const int volumeSize[] = { numBScans, rows, cols };
+		cv::Mat& volume = volumeTree.getMat();
+		volume.create(3, volumeSize, cv::DataType<T>::type);
+		for(int i = 0; i < numBScans; ++i)
+			std::memcpy(volume.ptr(i), tree.getListNode(static_cast<std::size_t>(i)).getMat().ptr(), static_cast<std::size_t>(rows)*cols*sizeof(T));
+		const std::string volumeFilename = std::string("bench_") + name + "_3d.bin";
+		start = Clock::now();
+		CppFW::CVMatTreeStructBin::writeBin(volumeFilename, volumeTree);
+		printResult(name, "write 3d    ", bytes, seconds(start));
+
+		start = Clock::now();
+		CppFW::CVMatTree readVolume = CppFW::CVMatTreeStructBin::readBin(volumeFilename);
+		printResult(name, "read 3d     ", bytes, seconds(start));
+		const bool equalVolume = readVolume == volumeTree;
+		std::remove(volumeFilename.c_str());
+
+		CppFW::CVMatTreeStructBin::WriteOptions deflateOptions;
+		deflateOptions.codec = CppFW::CVMatTreeBinCodec::Codec::Deflate;
+		bool equalDeflate = true;
+		for(uint32_t filters : { 0u, static_cast<uint32_t>(CppFW::CVMatTreeBinCodec::Delta | CppFW::CVMatTreeBinCodec::Shuffle) })
+		{
+			if(!CppFW::CVMatTreeBinCodec::isAvailable(deflateOptions.codec))
+				break;
+
+			deflateOptions.filters = filters;
+			const std::string deflateFilename = std::string("bench_") + name + "_deflate.bin";
+			start = Clock::now();
+			CppFW::CVMatTreeStructBin::writeBin(deflateFilename, tree, deflateOptions);
+			printResult(name, filters ? "write defl f" : "write deflat", bytes, seconds(start));
+
+			start = Clock::now();
+			CppFW::CVMatTree deflateTree = CppFW::CVMatTreeStructBin::readBin(deflateFilename);
+			printResult(name, filters ? "read defl f " : "read deflate", bytes, seconds(start));
+
+			std::cout << name << (filters ? "\tdefl f ratio\t" : "\tdeflate ratio\t") << static_cast<double>(bytes)/static_cast<double>(std::filesystem::file_size(deflateFilename)) << '\n';
+			equalDeflate = equalDeflate && deflateTree == tree;
+			std::remove(deflateFilename.c_str());
+		}
+
+		start = Clock::now();
+		const bool equal = readTree == tree;
+		printResult(name, "compare     ", bytes, seconds(start));
+
+		CppFW::CVMatTree::CompareOptions compareOptions;
+		compareOptions.parallel = true;
+		start = Clock::now();
+		const bool equalParallel = fileTree.isEqual(tree, compareOptions);
+		printResult(name, "compare par ", bytes, seconds(start));
+
+		start = Clock::now();
+		const uint64_t hash = tree.contentHash();
+		printResult(name, "hash        ", bytes, seconds(start));
+
+		if(!readInto || !equalBuffer || !equalConverted || !equal || !equalParallel || !equalDeflate || !equalVolume || fileTree.contentHash() != hash || parallelTree.contentHash() != hash)
+			std::cerr << name << ": read tree differs from written tree\n";
+		std::remove(filename.c_str());
+	}
+}
+
+
+int main(int argc, char* argv[])
+{
+	const int numBScans = argc > 1 ? std::stoi(argv[1]) : 128;
+	const int rows      = argc > 2 ? std::stoi(argv[2]) : 1024;
+	const int cols      = argc > 3 ? std::stoi(argv[3]) : 512;
+
+	benchType<uint16_t>("uint16", numBScans, rows, cols);
+	benchType<float   >("float" , numBScans, rows, cols);
+
+	return 0;
+}
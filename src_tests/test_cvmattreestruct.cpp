@@ -1,8 +1,11 @@
 #include <cvmat/cvmattreestruct.h>
+#include <cvmat/cvmattreearena.h>
 
 #include <boost/test/unit_test.hpp>
 #include <opencv2/opencv.hpp>
 
+#include <limits>
+
 namespace
 {
 	template<typename T>
@@ -126,6 +129,189 @@ BOOST_AUTO_TEST_CASE( CVMatTree_clear_becoms_undef )
 	BOOST_CHECK( tree.getNumElements() == 0 );
 }
 
+BOOST_AUTO_TEST_CASE( CVMatTree_dir_order_and_lookup )
+{
+	CppFW::CVMatTree tree;
+	CppFW::CVMatTree treeReverse;
+	const int numEntries = 100;
+	for(int i = 0; i < numEntries; ++i)
+	{
+		tree       .getDirNode("node" + std::to_string(i             )).getString() = std::to_string(i             );
+		treeReverse.getDirNode("node" + std::to_string(numEntries-1-i)).getString() = std::to_string(numEntries-1-i);
+	}
+
+	BOOST_CHECK_EQUAL( tree.getNumElements(), numEntries );
+	BOOST_CHECK( tree == treeReverse );
+
+	int index = 0;
+	for(const CppFW::CVMatTree::NodePair& pair : tree.getNodeDir())
+		BOOST_CHECK_EQUAL( pair.first, "node" + std::to_string(index++) );
+
+	const std::vector<const CppFW::CVMatTree::NodePair*> sorted = treeReverse.getNodeDir().sorted();
+	BOOST_REQUIRE_EQUAL( sorted.size(), numEntries );
+	for(std::size_t i = 1; i < sorted.size(); ++i)
+		BOOST_CHECK( sorted[i-1]->first < sorted[i]->first );
+
+	const std::string_view name("node42_suffix", 6);
+	BOOST_REQUIRE( tree.getDirNodeOpt(name) );
+	BOOST_CHECK_EQUAL( tree.getDirNodeOpt(name)->getString(), "42" );
+	BOOST_CHECK( tree.getDirNodeOpt("node100") == nullptr );
+	BOOST_CHECK_EQUAL( &tree.getDirNode(name), tree.getDirNodeOpt("node42") );
+	BOOST_CHECK_EQUAL( tree.getNumElements(), numEntries );
+}
+
+
+BOOST_AUTO_TEST_CASE( CVMatTree_interned_keys )
+{
+	const CppFW::CVMatTreeKey key(std::string("segmentation"));
+	BOOST_CHECK( key == CppFW::CVMatTreeKey("segmentation") );
+	BOOST_CHECK( key != CppFW::CVMatTreeKey("segmentation2") );
+	BOOST_CHECK( key == "segmentation" );
+	BOOST_CHECK_EQUAL( &key.str(), &CppFW::CVMatTreeKey("segmentation").str() );
+	BOOST_CHECK( CppFW::CVMatTreeKey() == "" );
+
+	// names are removed from the pool with the last key
+	const std::size_t poolSize = CppFW::CVMatTreeKey::poolSize();
+	{
+		CppFW::CVMatTree temporary;
+		temporary.getDirNode("temporary_name").getDirNode("segmentation");
+		CppFW::CVMatTreeKey copy(CppFW::CVMatTreeKey("temporary_name"));
+		BOOST_CHECK_EQUAL( CppFW::CVMatTreeKey::poolSize(), poolSize + 1 );
+		BOOST_CHECK( temporary.getDirNodeOpt("other_name") == nullptr );
+		BOOST_CHECK_EQUAL( CppFW::CVMatTreeKey::poolSize(), poolSize + 1 );
+	}
+	BOOST_CHECK_EQUAL( CppFW::CVMatTreeKey::poolSize(), poolSize );
+
+	CppFW::CVMatTree tree;
+	tree.newListNode().getDirNode("segmentation").getString() = "a";
+	tree.newListNode().getDirNode(key).getString() = "b";
+
+	const CppFW::CVMatTree::NodeList& list = tree.getNodeList();
+	BOOST_CHECK_EQUAL( &list[0]->getNodeDir().begin()->first.str(), &list[1]->getNodeDir().begin()->first.str() );
+	BOOST_REQUIRE( list[1]->getDirNodeOpt(key) );
+	BOOST_CHECK_EQUAL( list[1]->getDirNodeOpt(key)->getString(), "b" );
+}
+
+
+BOOST_AUTO_TEST_CASE( CVMatTree_content_hash )
+{
+	CppFW::CVMatTree tree1;
+	createMat<float>(tree1.getDirNode("a").getMat(), 4, 3);
+	tree1.getDirNode("b").newListNode().getString() = "text";
+	tree1.getDirNode("c");
+
+	CppFW::CVMatTree tree2;
+	tree2.getDirNode("c");
+	tree2.getDirNode("b").newListNode().getString() = "text";
+	createMat<float>(tree2.getDirNode("a").getMat(), 4, 3);
+
+	BOOST_CHECK_EQUAL( CppFW::CVMatTree().contentHash(), CppFW::CVMatTree().contentHash() );
+	BOOST_CHECK_EQUAL( tree1.contentHash(), tree2.contentHash() );
+	BOOST_CHECK( tree1.isContentHashCached() );
+	BOOST_CHECK( tree1.getDirNodeOpt("b")->isContentHashCached() );
+
+	const uint64_t hash = tree1.contentHash();
+	tree1.getDirNode("b").getListNode(0).getString() = "other text";
+	BOOST_CHECK( !tree1.isContentHashCached() );
+	BOOST_CHECK( tree1.getDirNodeOpt("a")->isContentHashCached() );
+	BOOST_CHECK_NE( tree1.contentHash(), hash );
+	BOOST_CHECK( tree1 != tree2 );
+
+	tree1.getDirNode("b").getListNode(0).getString() = "text";
+	BOOST_CHECK_EQUAL( tree1.contentHash(), hash );
+
+	tree2.getDirNode("a").getMat().at<float>(0, 0) = -0.f;
+	tree1.getDirNode("a").getMat().at<float>(0, 0) =  0.f;
+	BOOST_CHECK( tree1 == tree2 );
+	BOOST_CHECK_EQUAL( tree1.contentHash(), tree2.contentHash() );
+
+	CppFW::CVMatTree moved(std::move(tree1.getDirNode("b")));
+	BOOST_CHECK_NE( tree1.contentHash(), tree2.contentHash() );
+	BOOST_CHECK_EQUAL( moved.contentHash(), tree2.getDirNodeOpt("b")->contentHash() );
+
+	// a stale hash is only used for comparison on request
+	cv::Mat shared = tree2.getDirNode("a").getMat();
+	const uint64_t hashA = tree2.getDirNodeOpt("a")->contentHash();
+	shared.at<float>(1, 1) = 42.f;
+	BOOST_CHECK_EQUAL( tree2.getDirNodeOpt("a")->contentHash(), hashA );
+	CppFW::CVMatTree tree3;
+	tree2.getDirNodeOpt("a")->getMat().copyTo(tree3.getMat());
+	BOOST_CHECK_NE( tree3.contentHash(), hashA );
+	BOOST_CHECK( *tree2.getDirNodeOpt("a") == tree3 );
+
+	CppFW::CVMatTree::CompareOptions options;
+	options.cachedHashes = true;
+	BOOST_CHECK( !tree2.getDirNodeOpt("a")->isEqual(tree3, options) );
+}
+
+
+BOOST_AUTO_TEST_CASE( CVMatTree_arena )
+{
+	CppFW::CVMatTreeArena arena;
+	CppFW::CVMatTree tree(arena);
+	CppFW::CVMatTree treeHeap;
+
+	for(int i = 0; i < 100; ++i)
+	{
+		for(CppFW::CVMatTree* t : { &tree, &treeHeap })
+		{
+			CppFW::CVMatTree& node = t->newListNode();
+			createMat<uint16_t>(node.getDirNode("mat").getMat(), 3, 2);
+			node.getDirNode("a long key which does not fit in the small string buffer").getString() = "a long string which does not fit in the small string buffer";
+		}
+	}
+	BOOST_CHECK( tree == treeHeap );
+
+	CppFW::CVMatTree moved(std::move(tree));
+	BOOST_CHECK( tree.type() == CppFW::CVMatTree::Type::Undef );
+	BOOST_CHECK( moved == treeHeap );
+
+	moved.getListNode(5).clear();
+	BOOST_CHECK( moved.getListNode(5).type() == CppFW::CVMatTree::Type::Undef );
+	BOOST_CHECK_NO_THROW(moved.getListNode(5).getDirNode("new"));
+	BOOST_CHECK_EQUAL( moved.getNumElements(), 100 );
+
+	// the keys of dirs in an arena are released with the arena
+	const std::size_t poolSize = CppFW::CVMatTreeKey::poolSize();
+	{
+		CppFW::CVMatTreeArena keyArena;
+		CppFW::CVMatTree keyTree(keyArena);
+		keyTree.getDirNode("arena outer key").getDirNode("arena inner key").getDirNode("arena leaf key");
+		BOOST_CHECK_EQUAL( CppFW::CVMatTreeKey::poolSize(), poolSize + 3 );
+	}
+	BOOST_CHECK_EQUAL( CppFW::CVMatTreeKey::poolSize(), poolSize );
+}
+
+
+BOOST_AUTO_TEST_CASE( CVMatTree_move )
+{
+	CppFW::CVMatTree tree;
+	createMat<float>(tree.getDirNode("mat").getMat(), 4, 3);
+	tree.getDirNode("str").getString() = "a long string which does not fit in the small string buffer";
+	tree.getDirNode("list").newListNode().getString() = "list entry";
+
+	CppFW::CVMatTree reference;
+	createMat<float>(reference.getDirNode("mat").getMat(), 4, 3);
+	reference.getDirNode("str").getString() = "a long string which does not fit in the small string buffer";
+	reference.getDirNode("list").newListNode().getString() = "list entry";
+
+	CppFW::CVMatTree moved(std::move(tree));
+	BOOST_CHECK( tree.type() == CppFW::CVMatTree::Type::Undef );
+	BOOST_CHECK( moved == reference );
+
+	CppFW::CVMatTree assigned;
+	assigned.getString() = "old content";
+	assigned = std::move(moved.getDirNode("str"));
+	BOOST_CHECK_EQUAL( assigned.getString(), "a long string which does not fit in the small string buffer" );
+	BOOST_CHECK( moved.getDirNode("str").type() == CppFW::CVMatTree::Type::Undef );
+
+	assigned = std::move(moved);
+	BOOST_CHECK( moved.type() == CppFW::CVMatTree::Type::Undef );
+	BOOST_CHECK( assigned.type() == CppFW::CVMatTree::Type::Dir );
+	BOOST_CHECK( assigned.getDirNode("mat") == reference.getDirNode("mat") );
+}
+
+
 	BOOST_AUTO_TEST_SUITE(Compare)
 
 		BOOST_AUTO_TEST_CASE( empty_trees_are_equale )
@@ -228,6 +414,59 @@ BOOST_AUTO_TEST_CASE( CVMatTree_clear_becoms_undef )
 			BOOST_CHECK( tree1 != tree2 );
 		}
 
+		BOOST_AUTO_TEST_CASE( mat_trees_compare_float_tolerance_and_nan )
+		{
+			CppFW::CVMatTree tree1;
+			CppFW::CVMatTree tree2;
+			createMat<float>(tree1.getMat(), 3, 4);
+			createMat<float>(tree2.getMat(), 3, 4);
+			BOOST_CHECK( tree1 == tree2 );
+
+			tree2.getMat().at<float>(2, 3) += 0.001f;
+			BOOST_CHECK( tree1 != tree2 );
+
+			CppFW::CVMatTree::CompareOptions options;
+			options.absTolerance = 0.01;
+			BOOST_CHECK( tree1.isEqual(tree2, options) );
+			options.absTolerance = 0;
+			options.relTolerance = 0.01;
+			BOOST_CHECK( tree1.isEqual(tree2, options) );
+
+			tree1.getMat().at<float>(0, 1) = std::numeric_limits<float>::quiet_NaN();
+			tree2.getMat().at<float>(0, 1) = std::numeric_limits<float>::quiet_NaN();
+			BOOST_CHECK( !tree1.isEqual(tree2, options) );
+			options.nanEqual = true;
+			BOOST_CHECK( tree1.isEqual(tree2, options) );
+		}
+
+		BOOST_AUTO_TEST_CASE( mat_trees_compare_parallel )
+		{
+			CppFW::CVMatTree tree1;
+			CppFW::CVMatTree tree2;
+			for(int i = 0; i < 8; ++i)
+			{
+				createMat<int32_t>(tree1.newListNode().getDirNode("mat").getMat(), 600, 500);
+				createMat<int32_t>(tree2.newListNode().getDirNode("mat").getMat(), 600, 500);
+			}
+			createMat<double>(tree1.getListNode(3).getDirNode("roi").getMat(), 1000, 600);
+			createMat<double>(tree2.getListNode(3).getDirNode("roi").getMat(), 1000, 600);
+			tree1.getListNode(3).getDirNode("roi").getMat() = tree1.getListNode(3).getDirNode("roi").getMat()(cv::Range(0, 1000), cv::Range(1, 599));
+			tree2.getListNode(3).getDirNode("roi").getMat() = tree2.getListNode(3).getDirNode("roi").getMat()(cv::Range(0, 1000), cv::Range(1, 599));
+
+			CppFW::CVMatTree::CompareOptions options;
+			options.parallel = true;
+			BOOST_CHECK( tree1.isEqual(tree2, options) );
+
+			tree2.getListNode(6).getDirNode("mat").getMat().at<int32_t>(599, 499) = -1;
+			BOOST_CHECK( !tree1.isEqual(tree2, options) );
+			BOOST_CHECK( tree1 != tree2 );
+
+			tree2.getListNode(6).getDirNode("mat").getMat().at<int32_t>(599, 499) = tree1.getListNode(6).getDirNode("mat").getMat().at<int32_t>(599, 499);
+			tree2.getListNode(3).getDirNode("roi").getMat().at<double>(999, 2) = -1;
+			BOOST_CHECK( !tree1.isEqual(tree2, options) );
+			BOOST_CHECK( tree1 != tree2 );
+		}
+
 	BOOST_AUTO_TEST_SUITE_END()
 
 BOOST_AUTO_TEST_SUITE_END()
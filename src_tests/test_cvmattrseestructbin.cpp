@@ -1,10 +1,17 @@
 #include <cvmat/cvmattreestruct.h>
 #include <cvmat/treestructbin.h>
+#include <cvmat/treestructbinindex.h>
+#include <cvmat/cvmattreearena.h>
 
 #include <boost/test/unit_test.hpp>
 
 #include <opencv2/opencv.hpp>
 #include <sstream>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <filesystem>
 
 namespace
 {
@@ -24,6 +31,35 @@ namespace
 		}
 
 	}
+
+	// rebuilds the tree from the events of readEvents
+	class TreeBuilder : public CppFW::CVMatTreeStructBin::EventHandler
+	{
+	public:
+		CppFW::CVMatTree tree;
+		std::size_t numEvents = 0;
+
+		bool beginDir (uint64_t) override                      { stack.emplace_back(&nextNode(), false); ++numEvents; return true; }
+		bool beginList(uint64_t) override                      { stack.emplace_back(&nextNode(), true ); ++numEvents; return true; }
+		bool key      (const std::string& name) override       { nextKey = name; ++numEvents; return true; }
+		bool end      () override                              { stack.pop_back(); ++numEvents; return true; }
+		bool string   (const std::string& str) override        { nextNode().getString() = str; ++numEvents; return true; }
+		bool mat      (const CppFW::CVMatTreeStructBin::MatHeader&, CppFW::CVMatTreeStructBin::MatPayload& payload) override
+		                                                       { ++numEvents; return payload.read(nextNode().getMat()); }
+
+	private:
+		std::vector<std::pair<CppFW::CVMatTree*, bool>> stack;   // open dirs and lists (true)
+		std::string nextKey;
+
+		CppFW::CVMatTree& nextNode()
+		{
+			if(stack.empty())
+				return tree;
+			if(stack.back().second)
+				return stack.back().first->newListNode();
+			return stack.back().first->getDirNode(nextKey);
+		}
+	};
 }
 
 
@@ -72,6 +108,24 @@ BOOST_AUTO_TEST_SUITE(CVMatTreeBin)
 	}
 
 
+	BOOST_AUTO_TEST_CASE( CVMatTreeBin_rw_submat )
+	{
+		cv::Mat mat;
+		createMat<uint16_t>(mat, 7, 9);
+
+		CppFW::CVMatTree tree1;
+		tree1.getMat() = mat(cv::Range(1, 6), cv::Range(2, 5));
+		BOOST_REQUIRE( !tree1.getMat().isContinuous() );
+
+		std::stringstream sstream;
+		CppFW::CVMatTreeStructBin::writeBin(sstream, tree1);
+
+		CppFW::CVMatTree tree2 = CppFW::CVMatTreeStructBin::readBin(sstream);
+
+		BOOST_CHECK( tree1 == tree2 );
+	}
+
+
 	BOOST_AUTO_TEST_CASE( CVMatTreeBin_rw_more_complex_trees )
 	{
 		CppFW::CVMatTree tree1;
@@ -102,6 +156,1112 @@ BOOST_AUTO_TEST_SUITE(CVMatTreeBin)
 	}
 
 
+	BOOST_AUTO_TEST_CASE( CVMatTreeBin_map_file )
+	{
+		CppFW::CVMatTree tree1;
+
+		createMat<uint16_t>(tree1.getDirNode("volume").newListNode().getMat(), 16, 8);
+		createMat<float   >(tree1.getDirNode("volume").newListNode().getMat(), 4, 5);
+		tree1.getDirNode("name").getString() = "Test String";
+		tree1.getDirNode("empty").getMat();
+
+		CppFW::CVMatTreeStructBin::writeBin("test_map.bin", tree1);
+
+		cv::Mat mapped;
+		{
+			CppFW::CVMatTree tree2 = CppFW::CVMatTreeStructBin::mapBin("test_map.bin");
+			BOOST_CHECK( tree1 == tree2 );
+
+			mapped = tree2.getDirNode("volume").getListNode(0).getMat();
+		}
+		// mapping is still alive after the tree is destroyed
+		BOOST_CHECK_EQUAL( mapped.at<uint16_t>(15, 7), 16*8-1 );
+
+		// copy on write, the file is not changed
+		mapped.at<uint16_t>(0, 0) = 42;
+		CppFW::CVMatTree tree3 = CppFW::CVMatTreeStructBin::readBin("test_map.bin");
+		BOOST_CHECK( tree1 == tree3 );
+	}
+
+
+	BOOST_AUTO_TEST_CASE( CVMatTreeBin_read_node )
+	{
+		CppFW::CVMatTree tree1;
+
+		CppFW::CVMatTree& tree1bla  = tree1.getDirNode("bla");
+		createMat<double>(tree1bla.newListNode().getMat(), 5 ,10);
+		createMat<int   >(tree1bla.newListNode().getMat(), 5 ,5);
+		CppFW::CVMatTree& tree1bla3 = tree1bla.newListNode();
+		tree1bla3.getDirNode("name").getString() = "Matrix-Name";
+		createMat<float>(tree1bla3.getDirNode("mat").getMat(), 5 ,3);
+		tree1.getDirNode("blub").getString() = "Test String";
+
+		for(bool index : {false, true})
+		{
+			CppFW::CVMatTreeStructBin::WriteOptions options;
+			options.index = index;
+
+			std::stringstream sstream;
+			CppFW::CVMatTreeStructBin::writeBin(sstream, tree1, options);
+
+			sstream.seekg(0);
+			BOOST_CHECK( CppFW::CVMatTreeStructBin::readBin(sstream) == tree1 );
+
+			const CppFW::CVMatTree& expectedMat = tree1bla3.getDirNode("mat");
+			sstream.seekg(0);
+			BOOST_CHECK( CppFW::CVMatTreeStructBin::readNode(sstream, "bla/2/mat") == expectedMat );
+
+			sstream.seekg(0);
+			BOOST_CHECK( CppFW::CVMatTreeStructBin::readNode(sstream, "bla/2") == tree1bla3 );
+
+			sstream.seekg(0);
+			BOOST_CHECK( CppFW::CVMatTreeStructBin::readNode(sstream, "blub") == tree1.getDirNode("blub") );
+
+			sstream.seekg(0);
+			BOOST_CHECK( CppFW::CVMatTreeStructBin::readNode(sstream, "") == tree1 );
+
+			sstream.seekg(0);
+			BOOST_CHECK( CppFW::CVMatTreeStructBin::readNode(sstream, "bla/3").type() == CppFW::CVMatTree::Type::Undef );
+		}
+	}
+
+	BOOST_AUTO_TEST_CASE( CVMatTreeBin_read_index )
+	{
+		CppFW::CVMatTree tree1;
+		createMat<uint16_t>(tree1.getDirNode("volume").newListNode().getMat(), 6, 4);
+		tree1.getDirNode("name").getString() = "Test String";
+
+		CppFW::CVMatTreeStructBin::WriteOptions options;
+		options.index = true;
+		CppFW::CVMatTreeStructBin::writeBin("test_index.bin", tree1, options);
+
+		CppFW::CVMatTreeBinIndex index = CppFW::CVMatTreeStructBin::readIndex("test_index.bin");
+		BOOST_CHECK_EQUAL( index.getEntries().size(), 4 );
+
+		const CppFW::CVMatTreeBinIndex::Entry* entry = index.find("volume/0");
+		BOOST_REQUIRE( entry );
+		BOOST_CHECK_EQUAL( entry->type, static_cast<uint32_t>(CppFW::CVMatTree::Type::Mat) );
+		BOOST_CHECK_EQUAL( entry->depth, cv::DataType<uint16_t>::depth );
+		BOOST_CHECK_EQUAL( entry->rows , 6 );
+		BOOST_CHECK_EQUAL( entry->cols , 4 );
+		BOOST_CHECK_EQUAL( entry->size , 4*9 + 6*4*2 );
+
+		BOOST_CHECK( CppFW::CVMatTreeStructBin::readBin("test_index.bin") == tree1 );
+		BOOST_CHECK( CppFW::CVMatTreeStructBin::mapBin ("test_index.bin") == tree1 );
+	}
+
+	BOOST_AUTO_TEST_CASE( CVMatTreeBin_escaped_paths )
+	{
+		CppFW::CVMatTree tree1;
+		tree1.getDirNode("a/b").getString() = "key with slash";
+		tree1.getDirNode("a").getDirNode("b").getString() = "sub node";
+		tree1.getDirNode("c\\d").getString() = "key with backslash";
+
+		CppFW::CVMatTreeStructBin::WriteOptions options;
+		options.index = true;
+		CppFW::CVMatTreeStructBin::writeBin("test_escaped.bin", tree1, options);
+
+		CppFW::CVMatTreeBinIndex index = CppFW::CVMatTreeStructBin::readIndex("test_escaped.bin");
+		BOOST_CHECK_EQUAL( index.getEntries().size(), 5 );
+		BOOST_CHECK( index.find("a\\/b") );
+		BOOST_CHECK( index.find("a/b"  ) );
+		BOOST_CHECK( index.find("c\\\\d") );
+		BOOST_CHECK( index.find("a\\/b") != index.find("a/b") );
+
+		BOOST_CHECK( CppFW::CVMatTreeStructBin::readNode("test_escaped.bin", "a\\/b" ) == tree1.getDirNode("a/b") );
+		BOOST_CHECK( CppFW::CVMatTreeStructBin::readNode("test_escaped.bin", "a/b"   ) == tree1.getDirNode("a").getDirNode("b") );
+		BOOST_CHECK( CppFW::CVMatTreeStructBin::readNode("test_escaped.bin", "c\\\\d") == tree1.getDirNode("c\\d") );
+
+		std::stringstream sstream;
+		CppFW::CVMatTreeStructBin::writeBin(sstream, tree1);
+		sstream.seekg(0);
+		BOOST_CHECK( CppFW::CVMatTreeStructBin::readNode(sstream, "a\\/b") == tree1.getDirNode("a/b") );
+
+		sstream.seekg(0);
+		CppFW::CVMatTree selected = CppFW::CVMatTreeStructBin::readBin(sstream, std::vector<std::string>{"a\\/b"});
+		BOOST_CHECK( selected.getDirNodeOpt("a/b") );
+		BOOST_CHECK( !selected.getDirNodeOpt("a") );
+	}
+
+
+	BOOST_AUTO_TEST_CASE( CVMatTreeBin_index_sidecar )
+	{
+		CppFW::CVMatTree tree1;
+		for(int i = 0; i < 3; ++i)
+			createMat<uint16_t>(tree1.getDirNode("volume").newListNode().getMat(), 6+i, 4);
+		createMat<float>(tree1.getDirNode("large").getMat(), 3000, 500);
+		tree1.getDirNode("info").getDirNode("name").getString() = "Test String";
+		tree1.getDirNode("info").getDirNode("undef");
+
+		CppFW::CVMatTreeStructBin::WriteOptions options;
+		options.index = true;
+		CppFW::CVMatTreeStructBin::writeBin("test_sidecar_v2.bin", tree1, options);
+		const CppFW::CVMatTreeBinIndex expected = CppFW::CVMatTreeStructBin::readIndex("test_sidecar_v2.bin");
+
+		const std::string sidecar = CppFW::CVMatTreeStructBin::indexSidecarFilename("test_sidecar.bin");
+		std::remove(sidecar.c_str());
+		CppFW::CVMatTreeStructBin::writeBin("test_sidecar.bin", tree1);
+		BOOST_CHECK( CppFW::CVMatTreeStructBin::readIndex("test_sidecar.bin").empty() );
+
+		BOOST_REQUIRE( CppFW::CVMatTreeStructBin::writeIndexSidecar("test_sidecar.bin") );
+		const CppFW::CVMatTreeBinIndex index = CppFW::CVMatTreeStructBin::readIndex("test_sidecar.bin");
+		BOOST_REQUIRE_EQUAL( index.getEntries().size(), expected.getEntries().size() );
+		for(std::size_t i = 0; i < index.getEntries().size(); ++i)   // the header of version 1 and 2 has the same size
+		{
+			const CppFW::CVMatTreeBinIndex::Entry& entry         = index   .getEntries()[i];
+			const CppFW::CVMatTreeBinIndex::Entry& expectedEntry = expected.getEntries()[i];
+			BOOST_CHECK_EQUAL( entry.path    , expectedEntry.path     );
+			BOOST_CHECK_EQUAL( entry.offset  , expectedEntry.offset   );
+			BOOST_CHECK_EQUAL( entry.size    , expectedEntry.size     );
+			BOOST_CHECK_EQUAL( entry.type    , expectedEntry.type     );
+			BOOST_CHECK_EQUAL( entry.depth   , expectedEntry.depth    );
+			BOOST_CHECK_EQUAL( entry.channels, expectedEntry.channels );
+			BOOST_CHECK_EQUAL( entry.rows    , expectedEntry.rows     );
+			BOOST_CHECK_EQUAL( entry.cols    , expectedEntry.cols     );
+		}
+
+		BOOST_CHECK( CppFW::CVMatTreeStructBin::readNode("test_sidecar.bin", "volume/2") == tree1.getDirNode("volume").getListNode(2) );
+		BOOST_CHECK( CppFW::CVMatTreeStructBin::readNode("test_sidecar.bin", "info") == tree1.getDirNode("info") );
+		BOOST_CHECK( CppFW::CVMatTreeStructBin::readNode("test_sidecar.bin", "missing").type() == CppFW::CVMatTree::Type::Undef );
+
+		CppFW::CVMatTreeStructBin::ReadOptions readOptions;
+		readOptions.parallel = true;
+		BOOST_CHECK( CppFW::CVMatTreeStructBin::readBin("test_sidecar.bin", readOptions) == tree1 );
+
+		// a changed file makes the sidecar stale
+		tree1.getDirNode("info").getDirNode("name").getString() = "Changed";
+		CppFW::CVMatTreeStructBin::writeBin("test_sidecar.bin", tree1);
+		BOOST_CHECK( CppFW::CVMatTreeStructBin::readIndex("test_sidecar.bin").empty() );
+		BOOST_CHECK( CppFW::CVMatTreeStructBin::readNode("test_sidecar.bin", "info") == tree1.getDirNode("info") );
+		BOOST_CHECK( CppFW::CVMatTreeStructBin::readBin("test_sidecar.bin", readOptions) == tree1 );
+	}
+
+	BOOST_AUTO_TEST_CASE( CVMatTreeBin_read_lazy )
+	{
+		CppFW::CVMatTree tree1;
+		createMat<uint16_t>(tree1.getDirNode("volume").newListNode().getMat(), 6, 4);
+		createMat<float   >(tree1.getDirNode("volume").newListNode().getMat(), 3, 7);
+		tree1.getDirNode("name").getString() = "Test String";
+
+		CppFW::CVMatTreeStructBin::writeBin("test_lazy.bin", tree1);
+
+		CppFW::CVMatTreeStructBin::ReadOptions options;
+		options.lazy = true;
+		CppFW::CVMatTree tree2 = CppFW::CVMatTreeStructBin::readBin("test_lazy.bin", options);
+
+		const CppFW::CVMatTree& volume1 = tree2.getDirNode("volume").getListNode(1);
+		BOOST_CHECK( volume1.type() == CppFW::CVMatTree::Type::Mat );
+		BOOST_CHECK( !volume1.isPayloadLoaded() );
+		BOOST_CHECK_EQUAL( volume1.getMat().rows, 3 );
+		BOOST_CHECK( volume1.isPayloadLoaded() );
+		BOOST_CHECK( !tree2.getDirNode("name").isPayloadLoaded() );
+
+		BOOST_CHECK( tree1 == tree2 );
+
+		// payload no longer in the file
+		CppFW::CVMatTree tree3 = CppFW::CVMatTreeStructBin::readBin("test_lazy.bin", options);
+		std::filesystem::resize_file("test_lazy.bin", 32);
+		const CppFW::CVMatTree& volume0 = tree3.getDirNode("volume").getListNode(0);
+		BOOST_CHECK_THROW( volume0.getMat(), CppFW::CVMatTree::PayloadLoadError );
+		BOOST_CHECK( !volume0.isPayloadLoaded() );
+		BOOST_CHECK_THROW( tree3.getDirNode("name").getString(), CppFW::CVMatTree::PayloadLoadError );
+	}
+
+
+	BOOST_AUTO_TEST_CASE( CVMatTreeBin_read_arena )
+	{
+		CppFW::CVMatTree tree1;
+		createMat<uint16_t>(tree1.getDirNode("volume").newListNode().getMat(), 6, 4);
+		createMat<float   >(tree1.getDirNode("volume").newListNode().getMat(), 3, 7);
+		tree1.getDirNode("name").getString() = "Test String";
+
+		CppFW::CVMatTreeStructBin::writeBin("test_arena.bin", tree1);
+
+		CppFW::CVMatTreeArena arena;
+		CppFW::CVMatTreeStructBin::ReadOptions options;
+		options.arena = &arena;
+		CppFW::CVMatTree tree2 = CppFW::CVMatTreeStructBin::readBin("test_arena.bin", options);
+
+		BOOST_CHECK( tree1 == tree2 );
+	}
+
+	BOOST_AUTO_TEST_CASE( CVMatTreeBin_write_parallel )
+	{
+		CppFW::CVMatTree tree;
+		for(int i = 0; i < 5; ++i)
+			createMat<uint16_t>(tree.getDirNode("volume").newListNode().getMat(), 40, 30);
+		createMat<float>(tree.getDirNode("large").getMat(), 3000, 500);   // more than one chunk
+		cv::Mat roi;
+		createMat<double>(roi, 20, 30);
+		tree.getDirNode("roi").getMat() = roi(cv::Range(2, 18), cv::Range(3, 27));
+		tree.getDirNode("name").getString() = "Test String";
+		tree.getDirNode("empty");
+
+		for(bool index : { false, true })
+		{
+			CppFW::CVMatTreeStructBin::WriteOptions options;
+			options.index = index;
+			std::stringstream sequential;
+			CppFW::CVMatTreeStructBin::writeBin(sequential, tree, options);
+
+			options.parallel = true;
+			std::stringstream parallel;
+			BOOST_CHECK( CppFW::CVMatTreeStructBin::writeBin(parallel, tree, options) );
+
+			BOOST_CHECK( sequential.str() == parallel.str() );
+		}
+	}
+
+	BOOST_AUTO_TEST_CASE( CVMatTreeBin_read_parallel )
+	{
+		CppFW::CVMatTree tree1;
+		for(int i = 0; i < 5; ++i)
+			createMat<uint16_t>(tree1.getDirNode("volume").newListNode().getMat(), 40, 30);
+		createMat<float>(tree1.getDirNode("large").getMat(), 3000, 500);   // more than one chunk
+		createMat<int8_t>(tree1.getDirNode("empty mat").getMat(), 0, 0);
+		tree1.getDirNode("name").getString() = "Test String";
+		createMat<double>(tree1.getDirNode("a/b").getMat(), 4, 3);          // same segments as a -> b
+		createMat<double>(tree1.getDirNode("a").getDirNode("b").getMat(), 3, 4);
+
+		CppFW::CVMatTreeStructBin::ReadOptions options;
+		options.parallel = true;
+
+		for(bool index : { false, true })
+		{
+			CppFW::CVMatTreeStructBin::WriteOptions writeOptions;
+			writeOptions.index = index;
+			CppFW::CVMatTreeStructBin::writeBin("test_parallel.bin", tree1, writeOptions);
+
+			CppFW::CVMatTree tree2 = CppFW::CVMatTreeStructBin::readBin("test_parallel.bin", options);
+			BOOST_CHECK( tree1 == tree2 );
+		}
+
+		BOOST_REQUIRE( CppFW::CVMatTreeStructBin::writeIndexSidecar("test_parallel.bin") );
+		BOOST_CHECK( CppFW::CVMatTreeStructBin::readBin("test_parallel.bin", options) == tree1 );
+
+		// an empty name has the path of its parent, the index is ambiguous and the tree is read sequentially
+		tree1.getDirNode("").getString() = "empty name";
+		CppFW::CVMatTreeStructBin::WriteOptions writeOptions;
+		writeOptions.index = true;
+		CppFW::CVMatTreeStructBin::writeBin("test_parallel.bin", tree1, writeOptions);
+		BOOST_CHECK( CppFW::CVMatTreeStructBin::readBin("test_parallel.bin", options) == tree1 );
+
+		// the payload of the last mat is truncated, the structure is complete
+		CppFW::CVMatTreeStructBin::writeBin("test_parallel.bin", tree1);
+		std::filesystem::resize_file("test_parallel.bin", std::filesystem::file_size("test_parallel.bin") - 100);
+		BOOST_CHECK( CppFW::CVMatTreeStructBin::readBin("test_parallel.bin", options).type() == CppFW::CVMatTree::Type::Undef );
+	}
+
+	BOOST_AUTO_TEST_CASE( CVMatTreeBin_read_events )
+	{
+		CppFW::CVMatTree tree1;
+		createMat<double>(tree1.getDirNode("a").getMat(), 5, 10);
+		CppFW::CVMatTree& list = tree1.getDirNode("list");
+		createMat<uint16_t>(list.newListNode().getMat(), 4, 3);
+		list.newListNode().getDirNode("name").getString() = "Matrix-Name";
+		list.newListNode().getMat();
+		createMat<int8_t>(tree1.getDirNode("z").getMat(), 2, 2);
+
+		std::stringstream sstream;
+		CppFW::CVMatTreeStructBin::writeBin(sstream, tree1);
+
+		TreeBuilder builder;
+		BOOST_CHECK( CppFW::CVMatTreeStructBin::readEvents(sstream, builder) );
+		BOOST_CHECK( tree1 == builder.tree );
+		BOOST_CHECK_EQUAL( builder.numEvents, 15 );
+
+		// unread payloads are skipped, partial reads are possible
+		class HeaderCollector : public CppFW::CVMatTreeStructBin::EventHandler
+		{
+		public:
+			std::vector<int> rows;
+			double first = 0;
+			bool mat(const CppFW::CVMatTreeStructBin::MatHeader& header, CppFW::CVMatTreeStructBin::MatPayload& payload) override
+			{
+				rows.push_back(header.rows);
+				cv::Mat mat;
+				if(header.depth == CV_64F)
+					return payload.read(&first, sizeof(first)) && !payload.read(mat);
+				return true;
+			}
+			bool string(const std::string& str) override               { return str != "stop"; }
+		} collector;
+
+		sstream.clear();
+		sstream.seekg(0);
+		BOOST_CHECK( CppFW::CVMatTreeStructBin::readEvents(sstream, collector) );
+		BOOST_CHECK( (collector.rows == std::vector<int>{ 5, 4, 0, 2 }) );
+
+		// handler stops the reading
+		list.getListNode(1).getDirNode("name").getString() = "stop";
+		std::stringstream stopStream;
+		CppFW::CVMatTreeStructBin::writeBin(stopStream, tree1);
+		HeaderCollector stopCollector;
+		BOOST_CHECK( !CppFW::CVMatTreeStructBin::readEvents(stopStream, stopCollector) );
+		BOOST_CHECK( (stopCollector.rows == std::vector<int>{ 5, 4 }) );
+	}
+
+	BOOST_AUTO_TEST_CASE( CVMatTreeBin_stream_writer )
+	{
+		CppFW::CVMatTree tree;
+		tree.getDirNode("name").getString() = "scan";
+		CppFW::CVMatTree& bscans = tree.getDirNode("bscans");
+		for(int i = 0; i < 4; ++i)
+			createMat<uint16_t>(bscans.newListNode().getMat(), 6+i, 5);
+		createMat<float>(tree.getDirNode("info").getDirNode("pos").getMat(), 2, 3);
+		tree.getDirNode("info").getDirNode("empty");
+
+		for(bool index : { false, true })
+		{
+			CppFW::CVMatTreeStructBin::WriteOptions options;
+			options.index = index;
+
+			std::stringstream expected;
+			CppFW::CVMatTreeStructBin::writeBin(expected, tree, options);
+
+			std::stringstream streamed;
+			{
+				CppFW::CVMatTreeStructBin::StreamWriter writer(streamed, options);
+				BOOST_CHECK( writer.beginDir() );                          // keys in name order as writeBin
+				BOOST_CHECK( writer.key("bscans") );
+				BOOST_CHECK( writer.beginList() );
+				for(const CppFW::CVMatTree* bscan : bscans.getNodeList())
+					BOOST_CHECK( writer.writeMat(bscan->getMat()) );
+				BOOST_CHECK( writer.end() );
+				BOOST_CHECK( writer.key("info") );
+				BOOST_CHECK( writer.writeTree(tree.getDirNode("info")) );
+				BOOST_CHECK( writer.key("name") );
+				BOOST_CHECK( writer.writeString("scan") );
+				BOOST_CHECK( writer.finish() );                            // closes the root dir
+			}
+			BOOST_CHECK( expected.str() == streamed.str() );
+
+			if(index)
+			{
+				CppFW::CVMatTree pos = CppFW::CVMatTreeStructBin::readNode(streamed, "info/pos");
+				BOOST_CHECK( pos == tree.getDirNode("info").getDirNode("pos") );
+			}
+		}
+
+		// wrong call order
+		std::stringstream stream;
+		CppFW::CVMatTreeStructBin::StreamWriter writer(stream);
+		BOOST_CHECK( writer.beginDir() );
+		BOOST_CHECK( !writer.writeString("without key") );
+		BOOST_CHECK( !writer.good() );
+		BOOST_CHECK( !writer.key("a") );
+		BOOST_CHECK( !writer.finish() );
+
+		std::stringstream listStream;
+		CppFW::CVMatTreeStructBin::StreamWriter listWriter(listStream);
+		BOOST_CHECK( listWriter.beginList() );
+		BOOST_CHECK( !listWriter.key("key in list") );
+	}
+
+	BOOST_AUTO_TEST_CASE( CVMatTreeBin_read_selected )
+	{
+		CppFW::CVMatTree tree1;
+		tree1.getDirNode("meta").getDirNode("name").getString() = "scan";
+		createMat<double>(tree1.getDirNode("meta").getDirNode("pos").getMat(), 1, 3);
+		CppFW::CVMatTree& bscans = tree1.getDirNode("bscans");
+		for(int i = 0; i < 3; ++i)
+		{
+			CppFW::CVMatTree& bscan = bscans.newListNode();
+			createMat<uint8_t>(bscan.getDirNode("image").getMat(), 20, 10);
+			createMat<float>(bscan.getDirNode("segmentation").getDirNode("ILM").getMat(), 1, 10);
+			createMat<float>(bscan.getDirNode("segmentation").getDirNode("BM" ).getMat(), 1, 10);
+		}
+		tree1.getDirNode("name").getString() = "Test";
+
+		std::stringstream sstream;
+		CppFW::CVMatTreeStructBin::writeBin(sstream, tree1);
+		auto readSelected = [&sstream](const std::vector<std::string>& selector)
+		{
+			sstream.clear();
+			sstream.seekg(0);
+			return CppFW::CVMatTreeStructBin::readBin(sstream, selector);
+		};
+
+		CppFW::CVMatTree segmentations = readSelected({ "meta/*", "bscans/*/segmentation" });
+		BOOST_CHECK( segmentations.getDirNode("meta") == tree1.getDirNode("meta") );
+		BOOST_CHECK( segmentations.getDirNodeOpt("name") == nullptr );
+		BOOST_REQUIRE_EQUAL( segmentations.getDirNode("bscans").getNumElements(), 3 );
+		for(std::size_t i = 0; i < 3; ++i)
+		{
+			const CppFW::CVMatTree& bscan = segmentations.getDirNode("bscans").getListNode(i);
+			BOOST_CHECK_EQUAL( bscan.getNumElements(), 1 );
+			BOOST_CHECK( bscan.getDirNode("segmentation") == tree1.getDirNode("bscans").getListNode(i).getDirNode("segmentation") );
+		}
+
+		// list indices are kept, wildcards inside segments, ** over several segments
+		CppFW::CVMatTree second = readSelected({ "bscans/1/image" });
+		BOOST_REQUIRE_EQUAL( second.getDirNode("bscans").getNumElements(), 3 );
+		BOOST_CHECK( second.getDirNode("bscans").getListNode(0).type() == CppFW::CVMatTree::Type::Undef );
+		BOOST_CHECK( second.getDirNode("bscans").getListNode(1).getDirNode("image") == tree1.getDirNode("bscans").getListNode(1).getDirNode("image") );
+
+		CppFW::CVMatTree ilm = readSelected({ "**/I?M", "na*" });
+		BOOST_CHECK_EQUAL( ilm.getDirNode("name").getString(), "Test" );
+		BOOST_CHECK_EQUAL( ilm.getDirNode("bscans").getListNode(2).getDirNode("segmentation").getNumElements(), 1 );
+		BOOST_CHECK( ilm.getDirNodeOpt("meta") == nullptr );
+
+		BOOST_CHECK( readSelected({ "" }) == tree1 );
+		BOOST_CHECK( readSelected({ "**" }) == tree1 );
+		BOOST_CHECK( readSelected({}).type() == CppFW::CVMatTree::Type::Undef );
+		BOOST_CHECK( readSelected({ "name/x", "bscans/*/x" }).type() == CppFW::CVMatTree::Type::Undef );
+	}
+
+	BOOST_AUTO_TEST_CASE( CVMatTreeBin_read_into )
+	{
+		CppFW::CVMatTree tree1;
+		tree1.getDirNode("name").getString() = "calibration";
+		CppFW::CVMatTree& list = tree1.getDirNode("list");
+		for(int i = 0; i < 3; ++i)
+			createMat<uint16_t>(list.newListNode().getMat(), 4+i, 3);
+		createMat<float>(tree1.getDirNode("info").getDirNode("pos").getMat(), 2, 3);
+		tree1.getDirNode("info").getDirNode("scale").getString() = "a string longer than the small string buffer";
+
+		auto readInto = [](CppFW::CVMatTree& target, const CppFW::CVMatTree& source)
+		{
+			std::stringstream stream;
+			CppFW::CVMatTreeStructBin::writeBin(stream, source);
+			return CppFW::CVMatTreeStructBin::readBinInto(target, stream);
+		};
+
+		CppFW::CVMatTree target;
+		BOOST_CHECK( readInto(target, tree1) );
+		BOOST_CHECK( target == tree1 );
+		const uint64_t hash1 = target.contentHash();
+
+		// same structure: nodes, mats and strings are reused
+		const CppFW::CVMatTree* listNode  = &target.getDirNode("list");
+		const unsigned char*    list0Data = target.getDirNode("list").getListNode(0).getMat().data;
+		const unsigned char*    posData   = target.getDirNode("info").getDirNode("pos").getMat().data;
+		const char*             scaleData = target.getDirNode("info").getDirNode("scale").getString().data();
+
+		list.getListNode(0).getMat().at<uint16_t>(1, 1) = 1000;
+		tree1.getDirNode("info").getDirNode("scale").getString() = "a string longer than the small string buffe!";
+		BOOST_CHECK( readInto(target, tree1) );
+		BOOST_CHECK( target == tree1 );
+		BOOST_CHECK( target.contentHash() == tree1.contentHash() );
+		BOOST_CHECK( target.contentHash() != hash1 );
+		BOOST_CHECK( &target.getDirNode("list") == listNode );
+		BOOST_CHECK( target.getDirNode("list").getListNode(0).getMat().data == list0Data );
+		BOOST_CHECK( target.getDirNode("info").getDirNode("pos").getMat().data == posData );
+		BOOST_CHECK( target.getDirNode("info").getDirNode("scale").getString().data() == scaleData );
+
+		// changed structure: differing nodes are replaced, mats of moved nodes are kept
+		tree1.getDirNode("info").getDirNode("new").getString() = "new";
+		createMat<uint16_t>(list.getListNode(1).getMat(), 8, 8);
+		list.getListNode(2).clear();
+		list.getListNode(2).getString() = "no mat";
+		BOOST_CHECK( readInto(target, tree1) );
+		BOOST_CHECK( target == tree1 );
+		BOOST_CHECK( target.getDirNode("list").getListNode(0).getMat().data == list0Data );
+		BOOST_CHECK( target.getDirNode("info").getDirNode("pos").getMat().data == posData );
+
+		// renamed entry, longer and shorter lists
+		CppFW::CVMatTree tree2;
+		tree2.getDirNode("name").getString() = "renamed";
+		tree2.getDirNode("list2").getMat();
+		createMat<uint16_t>(tree2.getDirNode("list").newListNode().getMat(), 4, 3);
+		tree2.getDirNode("info").getDirNode("pos");
+		BOOST_CHECK( readInto(target, tree2) );
+		BOOST_CHECK( target == tree2 );
+		BOOST_CHECK( target.getDirNode("list").getListNode(0).getMat().data == list0Data );
+
+		BOOST_CHECK( readInto(target, tree1) );
+		BOOST_CHECK( target == tree1 );
+
+		std::stringstream invalid("no bin file");
+		BOOST_CHECK( !CppFW::CVMatTreeStructBin::readBinInto(target, invalid) );
+	}
+
+	BOOST_AUTO_TEST_CASE( CVMatTreeBin_compressed )
+	{
+		if(!CppFW::CVMatTreeBinCodec::isAvailable(CppFW::CVMatTreeBinCodec::Codec::Deflate))
+			return;
+
+		CppFW::CVMatTree tree1;
+		cv::Mat& volume = tree1.getDirNode("volume").getMat();
+		volume.create(1000, 512, cv::DataType<uint16_t>::type);               // more than one chunk
+		for(int r = 0; r < volume.rows; ++r)
+			for(int c = 0; c < volume.cols; ++c)
+				volume.at<uint16_t>(r, c) = static_cast<uint16_t>((r/10 + c/20) % 7);
+
+		cv::Mat& noise = tree1.getDirNode("noise").getMat();                 // does not compress, stored uncompressed
+		noise.create(64, 64, cv::DataType<uint8_t>::type);
+		uint32_t state = 12345;
+		for(int r = 0; r < noise.rows; ++r)
+			for(int c = 0; c < noise.cols; ++c)
+			{
+				state = state*1664525u + 1013904223u;
+				noise.at<uint8_t>(r, c) = static_cast<uint8_t>(state >> 24);
+			}
+
+		cv::Mat large;
+		createMat<float>(large, 40, 30);
+		tree1.getDirNode("submat").getMat() = large(cv::Range(2, 32), cv::Range(3, 23));
+		tree1.getDirNode("empty").getMat();
+		tree1.getDirNode("name").getString() = "compressed";
+
+		CppFW::CVMatTreeStructBin::WriteOptions options;
+		options.codec = CppFW::CVMatTreeBinCodec::Codec::Deflate;
+		options.index = true;
+		CppFW::CVMatTreeStructBin::writeBin("test_compressed.bin", tree1, options);
+		CppFW::CVMatTreeStructBin::writeBin("test_uncompressed.bin", tree1);
+		BOOST_CHECK_LT( std::filesystem::file_size("test_compressed.bin"), std::filesystem::file_size("test_uncompressed.bin")/4 );
+
+		BOOST_CHECK( CppFW::CVMatTreeStructBin::readBin("test_compressed.bin") == tree1 );
+		BOOST_CHECK( CppFW::CVMatTreeStructBin::mapBin ("test_compressed.bin") == tree1 );
+		BOOST_CHECK( CppFW::CVMatTreeStructBin::readNode("test_compressed.bin", "volume") == tree1.getDirNode("volume") );
+
+		CppFW::CVMatTreeStructBin::ReadOptions readOptions;
+		readOptions.parallel = true;
+		BOOST_CHECK( CppFW::CVMatTreeStructBin::readBin("test_compressed.bin", readOptions) == tree1 );
+		readOptions.parallel = false;
+		readOptions.lazy     = true;
+		BOOST_CHECK( CppFW::CVMatTreeStructBin::readBin("test_compressed.bin", readOptions) == tree1 );
+		BOOST_CHECK( CppFW::CVMatTreeStructBin::readBin("test_compressed.bin", std::vector<std::string>{ "volume" }).getDirNode("volume") == tree1.getDirNode("volume") );
+
+		std::stringstream sstream;
+		options.parallel = true;
+		CppFW::CVMatTreeStructBin::writeBin(sstream, tree1, options);
+		TreeBuilder builder;
+		BOOST_CHECK( CppFW::CVMatTreeStructBin::readEvents(sstream, builder) );
+		BOOST_CHECK( builder.tree == tree1 );
+	}
+
+	BOOST_AUTO_TEST_CASE( CVMatTreeBin_compression_filters )
+	{
+		if(!CppFW::CVMatTreeBinCodec::isAvailable(CppFW::CVMatTreeBinCodec::Codec::Deflate))
+			return;
+
+		// smooth images, rows are not aligned to the compression chunks, odd sizes for the scalar tails
+		CppFW::CVMatTree tree1;
+		auto addImage = [&tree1](const char* name, int rows, int cols, int type)
+		{
+			cv::Mat& mat = tree1.getDirNode(name).getMat();
+			mat.create(rows, cols, type);
+			const int values = cols*mat.channels();
+			for(int r = 0; r < rows; ++r)
+			{
+				uint8_t* row = mat.ptr(r);
+				for(int c = 0; c < values; ++c)
+				{
+					const double value = 1000 + 300*std::sin(r*0.05 + c*0.02) + (c*7 + r*13) % 5;
+					switch(mat.depth())
+					{
+						case CV_8U : row[c] = static_cast<uint8_t>(static_cast<int>(value) & 0xFF); break;
+						case CV_16U: reinterpret_cast<uint16_t*>(row)[c] = static_cast<uint16_t>(value); break;
+						case CV_32S: reinterpret_cast<int32_t *>(row)[c] = static_cast<int32_t >(value) - 2000; break;
+						case CV_32F: reinterpret_cast<float   *>(row)[c] = static_cast<float   >(value*0.001); break;
+						case CV_64F: reinterpret_cast<double  *>(row)[c] = value*0.001; break;
+					}
+				}
+			}
+		};
+		addImage("u8"    , 301, 777, cv::DataType<uint8_t >::type);
+		addImage("u16"   , 500, 613, cv::DataType<uint16_t>::type);
+		addImage("u16c3" , 97 , 311, CV_MAKETYPE(cv::DataType<uint16_t>::depth, 3));
+		addImage("s32"   , 129, 257, cv::DataType<int32_t >::type);
+		addImage("f32"   , 300, 509, cv::DataType<float   >::type);
+		addImage("f64"   , 111, 333, cv::DataType<double  >::type);
+
+		std::size_t plainSize = 0;
+		for(uint32_t filters = 0; filters <= CppFW::CVMatTreeBinCodec::KnownFilters; ++filters)
+		{
+			CppFW::CVMatTreeStructBin::WriteOptions options;
+			options.codec   = CppFW::CVMatTreeBinCodec::Codec::Deflate;
+			options.filters = filters;
+
+			std::stringstream sstream;
+			CppFW::CVMatTreeStructBin::writeBin(sstream, tree1, options);
+			BOOST_CHECK_MESSAGE( CppFW::CVMatTreeStructBin::readBin(sstream) == tree1, "filters " << filters );
+
+			if(filters == 0)
+				plainSize = sstream.str().size();
+			if(filters == (CppFW::CVMatTreeBinCodec::Delta | CppFW::CVMatTreeBinCodec::Shuffle))
+				BOOST_CHECK_LT( sstream.str().size(), plainSize );
+		}
+	}
+
+	BOOST_AUTO_TEST_CASE( CVMatTreeBin_wide_counts )
+	{
+		CppFW::CVMatTree tree1;
+		tree1.getDirNode("name").getString() = "wide";
+		CppFW::CVMatTree& list = tree1.getDirNode("list");
+		for(int i = 0; i < 3; ++i)
+			createMat<uint16_t>(list.newListNode().getMat(), 4+i, 3);
+		list.newListNode().getDirNode("a").getString() = "element";
+		createMat<float>(tree1.getDirNode("info").getDirNode("pos").getMat(), 2, 3);
+
+		CppFW::CVMatTreeStructBin::WriteOptions options;
+		options.wideCounts = true;
+		options.index      = true;
+		CppFW::CVMatTreeStructBin::writeBin("test_wide.bin", tree1, options);
+		CppFW::CVMatTreeStructBin::writeBin("test_narrow.bin", tree1);
+		// 3 dirs, 1 list, 7 names and strings
+		BOOST_CHECK_GT( std::filesystem::file_size("test_wide.bin"), std::filesystem::file_size("test_narrow.bin") + 11*4 );
+
+		BOOST_CHECK( CppFW::CVMatTreeStructBin::readBin("test_wide.bin") == tree1 );
+		BOOST_CHECK( CppFW::CVMatTreeStructBin::mapBin ("test_wide.bin") == tree1 );
+		BOOST_CHECK( CppFW::CVMatTreeStructBin::readNode("test_wide.bin", "list/3/a") == tree1.getDirNode("list").getListNode(3).getDirNode("a") );
+		BOOST_CHECK_EQUAL( CppFW::CVMatTreeStructBin::readIndex("test_wide.bin").getEntries().size(), 10 );
+		BOOST_CHECK( CppFW::CVMatTreeStructBin::readBin("test_wide.bin", std::vector<std::string>{ "info/*" }).getDirNode("info") == tree1.getDirNode("info") );
+
+		CppFW::CVMatTreeStructBin::ReadOptions readOptions;
+		readOptions.lazy = true;
+		BOOST_CHECK( CppFW::CVMatTreeStructBin::readBin("test_wide.bin", readOptions) == tree1 );
+		readOptions.lazy     = false;
+		readOptions.parallel = true;
+		BOOST_CHECK( CppFW::CVMatTreeStructBin::readBin("test_wide.bin", readOptions) == tree1 );
+
+		std::stringstream sstream;
+		options.parallel = true;
+		CppFW::CVMatTreeStructBin::writeBin(sstream, tree1, options);
+		TreeBuilder builder;
+		BOOST_CHECK( CppFW::CVMatTreeStructBin::readEvents(sstream, builder) );
+		BOOST_CHECK( builder.tree == tree1 );
+
+		std::stringstream expected;
+		options.parallel = false;
+		CppFW::CVMatTreeStructBin::writeBin(expected, tree1, options);
+		BOOST_CHECK( expected.str() == sstream.str() );
+
+		std::stringstream streamed;
+		{
+			CppFW::CVMatTreeStructBin::StreamWriter writer(streamed, options);
+			BOOST_CHECK( writer.writeTree(tree1) );
+		}
+		BOOST_CHECK( expected.str() == streamed.str() );
+	}
+
+	BOOST_AUTO_TEST_CASE( CVMatTreeBin_nd_mats )
+	{
+		const int volumeSize[] = { 5, 7, 9 };
+		CppFW::CVMatTree tree1;
+		cv::Mat& volume = tree1.getDirNode("volume").getMat();
+		volume.create(3, volumeSize, cv::DataType<uint16_t>::type);
+		for(std::size_t i = 0; i < volume.total(); ++i)
+			volume.ptr<uint16_t>()[i] = static_cast<uint16_t>(i*7 % 1000);
+
+		// 4 dims, 2 channels, not continuous (padded rows)
+		const int    size4d[] = { 2, 3, 4, 5 };
+		const size_t step4d[] = { 3*4*64, 4*64, 64, 2*sizeof(float) };
+		static float data4d[2*3*4*64/sizeof(float)];
+		for(std::size_t i = 0; i < sizeof(data4d)/sizeof(float); ++i)
+			data4d[i] = static_cast<float>(i)*0.5f;
+		tree1.getDirNode("4d").getMat() = cv::Mat(4, size4d, CV_MAKETYPE(CV_32F, 2), data4d, step4d);
+		BOOST_CHECK( !tree1.getDirNode("4d").getMat().isContinuous() );
+		createMat<double>(tree1.getDirNode("2d").getMat(), 3, 4);
+
+		CppFW::CVMatTreeStructBin::writeBin("test_nd.bin", tree1);            // ndMats is enabled for the tree
+		CppFW::CVMatTree read1 = CppFW::CVMatTreeStructBin::readBin("test_nd.bin");
+		BOOST_CHECK( read1 == tree1 );
+		BOOST_CHECK_EQUAL( read1.getDirNode("volume").getMat().dims, 3 );
+		BOOST_CHECK( read1.contentHash() == tree1.contentHash() );
+		BOOST_CHECK( CppFW::CVMatTreeStructBin::mapBin("test_nd.bin") == tree1 );
+		BOOST_CHECK( CppFW::CVMatTreeStructBin::readNode("test_nd.bin", "4d") == tree1.getDirNode("4d") );
+		BOOST_CHECK( CppFW::CVMatTreeStructBin::readBin("test_nd.bin", std::vector<std::string>{ "volume" }).getDirNode("volume") == tree1.getDirNode("volume") );
+
+		CppFW::CVMatTreeStructBin::ReadOptions readOptions;
+		readOptions.lazy = true;
+		BOOST_CHECK( CppFW::CVMatTreeStructBin::readBin("test_nd.bin", readOptions) == tree1 );
+		readOptions.lazy     = false;
+		readOptions.parallel = true;
+		BOOST_CHECK( CppFW::CVMatTreeStructBin::readBin("test_nd.bin", readOptions) == tree1 );
+
+		std::stringstream expected;
+		CppFW::CVMatTreeStructBin::writeBin(expected, tree1);
+		std::stringstream parallel;
+		CppFW::CVMatTreeStructBin::WriteOptions options;
+		options.parallel = true;
+		CppFW::CVMatTreeStructBin::writeBin(parallel, tree1, options);
+		BOOST_CHECK( expected.str() == parallel.str() );
+
+		TreeBuilder builder;
+		BOOST_CHECK( CppFW::CVMatTreeStructBin::readEvents(parallel, builder) );
+		BOOST_CHECK( builder.tree == tree1 );
+
+		if(CppFW::CVMatTreeBinCodec::isAvailable(CppFW::CVMatTreeBinCodec::Codec::Deflate))
+		{
+			std::stringstream compressed;
+			options.parallel = false;
+			options.codec    = CppFW::CVMatTreeBinCodec::Codec::Deflate;
+			options.filters  = CppFW::CVMatTreeBinCodec::Delta | CppFW::CVMatTreeBinCodec::Shuffle;
+			CppFW::CVMatTreeStructBin::writeBin(compressed, tree1, options);
+			BOOST_CHECK( CppFW::CVMatTreeStructBin::readBin(compressed) == tree1 );
+		}
+
+		// the format option is needed when the tree is not known in advance
+		std::stringstream streamed;
+		CppFW::CVMatTreeStructBin::StreamWriter writer(streamed);
+		BOOST_CHECK( writer.beginList() );
+		BOOST_CHECK( writer.writeMat(tree1.getDirNode("2d").getMat()) );
+		BOOST_CHECK( !writer.writeMat(volume) );
+
+		// files without N-d mats are unchanged
+		CppFW::CVMatTree tree2;
+		createMat<double>(tree2.getMat(), 3, 4);
+		std::stringstream stream2;
+		CppFW::CVMatTreeStructBin::writeBin(stream2, tree2);
+		uint32_t version = 0;
+		std::memcpy(&version, stream2.str().data() + 8, sizeof(version));
+		BOOST_CHECK_EQUAL( version, 1 );
+	}
+
+	BOOST_AUTO_TEST_CASE( CVMatTreeBin_convert_depth )
+	{
+		// odd sizes for the scalar tails of the conversion kernels
+		CppFW::CVMatTree tree1;
+		for(int i = 0; i < 3; ++i)
+		{
+			cv::Mat& bscan = tree1.getDirNode("bscans").newListNode().getMat();
+			bscan.create(13, 37, cv::DataType<uint16_t>::type);
+			for(int r = 0; r < bscan.rows; ++r)
+				for(int c = 0; c < bscan.cols; ++c)
+					bscan.at<uint16_t>(r, c) = static_cast<uint16_t>(65535 - r*1000 - c*17 - i);
+		}
+		cv::Mat& int16 = tree1.getDirNode("int16").getMat();
+		int16.create(3, 11, cv::DataType<int16_t>::type);
+		for(int r = 0; r < int16.rows; ++r)
+			for(int c = 0; c < int16.cols; ++c)
+				int16.at<int16_t>(r, c) = static_cast<int16_t>(-32768 + (r*11 + c)*2000);
+		cv::Mat& int8 = tree1.getDirNode("int8").getMat();
+		int8.create(2, 9, cv::DataType<int8_t>::type);
+		for(int r = 0; r < int8.rows; ++r)
+			for(int c = 0; c < int8.cols; ++c)
+				int8.at<int8_t>(r, c) = static_cast<int8_t>(-128 + (r*9 + c)*15);
+		createMat<uint8_t>(tree1.getDirNode("uint8").getMat(), 5, 19);
+		createMat<int32_t>(tree1.getDirNode("int32").getMat(), 4, 5);
+		createMat<float  >(tree1.getDirNode("float").getMat(), 3, 3);
+		const int volumeSize[] = { 3, 4, 5 };
+		cv::Mat& volume = tree1.getDirNode("volume").getMat();
+		volume.create(3, volumeSize, cv::DataType<uint16_t>::type);
+		for(std::size_t i = 0; i < volume.total(); ++i)
+			volume.ptr<uint16_t>()[i] = static_cast<uint16_t>(i*1009);
+		tree1.getDirNode("name").getString() = "convert";
+
+		// expected trees, bscans to bscanDepth and the other mats to depth (-1: unchanged)
+		const std::vector<std::string> matNames = { "int16", "int8", "uint8", "int32", "float", "volume" };
+		auto converted = [&](int depth, int bscanDepth)
+		{
+			CppFW::CVMatTree expected;
+			for(std::size_t i = 0; i < 3; ++i)
+				tree1.getDirNode("bscans").getListNode(i).getMat().convertTo(expected.getDirNode("bscans").newListNode().getMat(), bscanDepth);
+			for(const std::string& name : matNames)
+				tree1.getDirNode(name).getMat().convertTo(expected.getDirNode(name).getMat(), depth);
+			expected.getDirNode("name").getString() = "convert";
+			return expected;
+		};
+		const CppFW::CVMatTree allFloat  = converted(CV_32F, CV_32F);
+		const CppFW::CVMatTree perPath   = converted(CV_32F, CV_64F);
+		const CppFW::CVMatTree onlyPath  = converted(-1    , CV_64F);
+		BOOST_CHECK( allFloat.getDirNode("int16").getMat().at<float>(0, 0) == -32768.f );
+
+		CppFW::CVMatTreeStructBin::writeBin("test_convert.bin", tree1);
+		CppFW::CVMatTreeStructBin::WriteOptions indexOptions;
+		indexOptions.index = true;
+		CppFW::CVMatTreeStructBin::writeBin("test_convert_index.bin", tree1, indexOptions);
+
+		for(const char* filename : { "test_convert.bin", "test_convert_index.bin" })
+		{
+			for(int mode = 0; mode < 3; ++mode)
+			{
+				CppFW::CVMatTreeStructBin::ReadOptions options;
+				options.parallel = mode == 1;
+				options.lazy     = mode == 2;
+
+				options.convertDepth = CV_32F;
+				CppFW::CVMatTree read1 = CppFW::CVMatTreeStructBin::readBin(filename, options);
+				BOOST_CHECK( read1 == allFloat );
+				BOOST_CHECK_EQUAL( read1.getDirNode("bscans").getListNode(0).getMat().depth(), CV_32F );
+
+				options.convertPaths = { { "bscans/*", CV_64F } };
+				BOOST_CHECK( CppFW::CVMatTreeStructBin::readBin(filename, options) == perPath );
+
+				options.convertDepth = -1;
+				options.convertPaths = { { "**/1", CV_64F }, { "bscans/*", CV_64F } };
+				BOOST_CHECK( CppFW::CVMatTreeStructBin::readBin(filename, options) == onlyPath );
+			}
+		}
+
+		if(CppFW::CVMatTreeBinCodec::isAvailable(CppFW::CVMatTreeBinCodec::Codec::Deflate))
+		{
+			CppFW::CVMatTreeStructBin::WriteOptions compressOptions;
+			compressOptions.codec   = CppFW::CVMatTreeBinCodec::Codec::Deflate;
+			compressOptions.filters = CppFW::CVMatTreeBinCodec::Delta;
+			CppFW::CVMatTreeStructBin::writeBin("test_convert_compressed.bin", tree1, compressOptions);
+
+			CppFW::CVMatTreeStructBin::ReadOptions options;
+			options.convertDepth = CV_32F;
+			BOOST_CHECK( CppFW::CVMatTreeStructBin::readBin("test_convert_compressed.bin", options) == allFloat );
+			std::remove("test_convert_compressed.bin");
+		}
+
+		// unsupported target depths are ignored
+		CppFW::CVMatTreeStructBin::ReadOptions options;
+		options.convertDepth = CV_16S;
+		BOOST_CHECK( CppFW::CVMatTreeStructBin::readBin("test_convert.bin", options) == tree1 );
+
+		std::remove("test_convert.bin");
+		std::remove("test_convert_index.bin");
+	}
+
+	BOOST_AUTO_TEST_CASE( CVMatTreeBin_buffer )
+	{
+		CppFW::CVMatTree tree1;
+		createMat<uint16_t>(tree1.getDirNode("bscans").newListNode().getMat(), 13, 37);
+		createMat<uint16_t>(tree1.getDirNode("bscans").newListNode().getMat(), 13, 37);
+		cv::Mat large;
+		createMat<float>(large, 20, 30);
+		tree1.getDirNode("submat").getMat() = large(cv::Range(2, 12), cv::Range(3, 23));
+		const int volumeSize[] = { 3, 4, 5 };
+		tree1.getDirNode("volume").getMat().create(3, volumeSize, cv::DataType<int16_t>::type);
+		tree1.getDirNode("volume").getMat().ptr<int16_t>()[7] = -5;
+		tree1.getDirNode("empty").getMat();
+		tree1.getDirNode("undef");
+		tree1.getDirNode("name").getString() = "buffer";
+
+		// identical to the stream writer
+		std::vector<char> buffer;
+		BOOST_CHECK( CppFW::CVMatTreeStructBin::writeBin(buffer, tree1) );
+		std::stringstream sstream;
+		CppFW::CVMatTreeStructBin::writeBin(sstream, tree1);
+		BOOST_CHECK( std::string(buffer.begin(), buffer.end()) == sstream.str() );
+
+		CppFW::CVMatTree read1 = CppFW::CVMatTreeStructBin::readBin(buffer.data(), buffer.size());
+		BOOST_CHECK( read1 == tree1 );
+		BOOST_CHECK( read1.getDirNode("bscans").getListNode(0).getMat().data <  reinterpret_cast<const unsigned char*>(buffer.data()) ||
+		             read1.getDirNode("bscans").getListNode(0).getMat().data >= reinterpret_cast<const unsigned char*>(buffer.data() + buffer.size()) );
+
+		// zero copy mats
+		CppFW::CVMatTreeStructBin::ReadOptions shareOptions;
+		shareOptions.shareBuffer = true;
+		CppFW::CVMatTree shared = CppFW::CVMatTreeStructBin::readBin(buffer.data(), buffer.size(), shareOptions);
+		BOOST_CHECK( shared == tree1 );
+		const unsigned char* sharedData = shared.getDirNode("volume").getMat().data;
+		BOOST_CHECK( sharedData >= reinterpret_cast<const unsigned char*>(buffer.data()) && sharedData < reinterpret_cast<const unsigned char*>(buffer.data() + buffer.size()) );
+
+		CppFW::CVMatTreeStructBin::ReadOptions convertOptions;
+		convertOptions.convertPaths = { { "bscans/*", CV_32F } };
+		CppFW::CVMatTree converted = CppFW::CVMatTreeStructBin::readBin(buffer.data(), buffer.size(), convertOptions);
+		CppFW::CVMatTree expected;
+		tree1.getDirNode("bscans").getListNode(1).getMat().convertTo(expected.getMat(), CV_32F);
+		BOOST_CHECK( converted.getDirNode("bscans").getListNode(1) == expected );
+		BOOST_CHECK( converted.getDirNode("volume") == tree1.getDirNode("volume") );
+
+		// the capacity is reused
+		const char* data = buffer.data();
+		BOOST_CHECK( CppFW::CVMatTreeStructBin::writeBin(buffer, tree1) );
+		BOOST_CHECK( buffer.data() == data );
+
+		// index and compression through the stream writer
+		CppFW::CVMatTreeStructBin::WriteOptions options;
+		options.index      = true;
+		options.wideCounts = true;
+		BOOST_CHECK( CppFW::CVMatTreeStructBin::writeBin(buffer, tree1, options) );
+		BOOST_CHECK( CppFW::CVMatTreeStructBin::readBin(buffer.data(), buffer.size()) == tree1 );
+		if(CppFW::CVMatTreeBinCodec::isAvailable(CppFW::CVMatTreeBinCodec::Codec::Deflate))
+		{
+			options.codec = CppFW::CVMatTreeBinCodec::Codec::Deflate;
+			BOOST_CHECK( CppFW::CVMatTreeStructBin::writeBin(buffer, tree1, options) );
+			BOOST_CHECK( CppFW::CVMatTreeStructBin::readBin(buffer.data(), buffer.size(), shareOptions) == tree1 );
+		}
+
+		// truncated data is not read beyond its end
+		BOOST_CHECK( CppFW::CVMatTreeStructBin::writeBin(buffer, tree1) );
+		for(std::size_t size = 0; size < buffer.size(); ++size)
+		{
+			BOOST_CHECK( CppFW::CVMatTreeStructBin::readBin(buffer.data(), size) != tree1 );
+			BOOST_CHECK( CppFW::CVMatTreeStructBin::readBin(buffer.data(), size, shareOptions) != tree1 );
+			BOOST_CHECK( CppFW::CVMatTreeStructBin::readBin(buffer.data(), size, convertOptions) != converted );
+		}
+	}
+
+	BOOST_AUTO_TEST_CASE( CVMatTreeBin_serialized_size )
+	{
+		CppFW::CVMatTree tree1;
+		for(int i = 0; i < 12; ++i)                                           // two digit list indices in the index
+			createMat<uint16_t>(tree1.getDirNode("bscans").newListNode().getMat(), 7, 9 + i);
+		tree1.getDirNode("bscans").newListNode();
+		cv::Mat large;
+		createMat<float>(large, 20, 30);
+		tree1.getDirNode("meta").getDirNode("submat").getMat() = large(cv::Range(2, 12), cv::Range(3, 23));
+		tree1.getDirNode("meta").getDirNode("name").getString() = "size";
+		const int volumeSize[] = { 3, 4, 5 };
+		tree1.getDirNode("volume").getMat().create(3, volumeSize, cv::DataType<uint8_t>::type);
+		tree1.getDirNode("volume").getMat().ptr<uint8_t>()[0] = 1;
+
+		for(int variant = 0; variant < 4; ++variant)
+		{
+			CppFW::CVMatTreeStructBin::WriteOptions options;
+			options.index      = variant & 1;
+			options.wideCounts = (variant & 2) != 0;
+
+			std::stringstream sstream;
+			BOOST_CHECK( CppFW::CVMatTreeStructBin::writeBin(sstream, tree1, options) );
+			const std::string file = sstream.str();
+			BOOST_CHECK_EQUAL( CppFW::CVMatTreeStructBin::serializedSize(tree1, options), file.size() );
+
+			std::vector<char> buffer(file.size() + 5, 'x');
+			BOOST_CHECK_EQUAL( CppFW::CVMatTreeStructBin::writeBin(buffer.data(), buffer.size(), tree1, options), file.size() );
+			BOOST_CHECK( std::string(buffer.data(), file.size()) == file );
+			BOOST_CHECK_EQUAL( CppFW::CVMatTreeStructBin::writeBin(buffer.data(), file.size() - 1, tree1, options), 0 );
+		}
+		BOOST_CHECK_EQUAL( CppFW::CVMatTreeStructBin::serializedSize(CppFW::CVMatTree()), 32 );
+
+		std::vector<char> buffer;
+		CppFW::CVMatTreeStructBin::WriteOptions indexOptions;
+		indexOptions.index = true;
+		BOOST_CHECK( CppFW::CVMatTreeStructBin::writeBin(buffer, tree1, indexOptions) );
+		std::istringstream indexStream(std::string(buffer.begin(), buffer.end()));
+		BOOST_CHECK( CppFW::CVMatTreeStructBin::readNode(indexStream, "bscans/11") == tree1.getDirNode("bscans").getListNode(11) );
+
+		if(CppFW::CVMatTreeBinCodec::isAvailable(CppFW::CVMatTreeBinCodec::Codec::Deflate))
+		{
+			CppFW::CVMatTreeStructBin::WriteOptions options;
+			options.codec = CppFW::CVMatTreeBinCodec::Codec::Deflate;
+			const uint64_t bound = CppFW::CVMatTreeStructBin::serializedSize(tree1, options);
+			buffer.assign(static_cast<std::size_t>(bound), 0);
+			const std::size_t written = CppFW::CVMatTreeStructBin::writeBin(buffer.data(), buffer.size(), tree1, options);
+			BOOST_CHECK( written > 0 && written <= bound );
+			BOOST_CHECK( CppFW::CVMatTreeStructBin::readBin(buffer.data(), written) == tree1 );
+		}
+	}
+
+	BOOST_AUTO_TEST_CASE( CVMatTreeBin_write_fd )
+	{
+#if defined(__unix__) || defined(__APPLE__)
+		// more payload fragments than one writev call takes, small and large rows of non continuous mats
+		CppFW::CVMatTree tree1;
+		for(int i = 0; i < 1100; ++i)
+			createMat<uint16_t>(tree1.getDirNode("bscans").newListNode().getMat(), 2, 1024 + i%3);
+		cv::Mat large;
+		createMat<float>(large, 20, 2000);
+		tree1.getDirNode("wide rows").getMat() = large(cv::Range(2, 12), cv::Range(3, 1903));
+		tree1.getDirNode("small rows").getMat() = large(cv::Range(2, 12), cv::Range(3, 13));
+		tree1.getDirNode("name").getString() = "fd";
+
+		for(bool index : { false, true })
+		{
+			CppFW::CVMatTreeStructBin::WriteOptions options;
+			options.index = index;
+
+			std::FILE* file = std::fopen("test_fd.bin", "wb");
+			BOOST_REQUIRE( file );
+			BOOST_CHECK( CppFW::CVMatTreeStructBin::writeBinFd(fileno(file), tree1, options) );
+			std::fclose(file);
+
+			std::stringstream sstream;
+			CppFW::CVMatTreeStructBin::writeBin(sstream, tree1, options);
+			std::ifstream written("test_fd.bin", std::ios::binary);
+			std::stringstream content;
+			content << written.rdbuf();
+			BOOST_CHECK( content.str() == sstream.str() );
+		}
+		BOOST_CHECK( CppFW::CVMatTreeStructBin::readNode("test_fd.bin", "bscans/1099") == tree1.getDirNode("bscans").getListNode(1099) );
+
+		if(CppFW::CVMatTreeBinCodec::isAvailable(CppFW::CVMatTreeBinCodec::Codec::Deflate))
+		{
+			// incompressible mat larger than the header buffer of the fd output
+			cv::Mat& noise = tree1.getDirNode("noise").getMat();
+			noise.create(300, 300, cv::DataType<int>::type);
+			uint32_t state = 1;
+			for(int row = 0; row < noise.rows; ++row)
+				for(int col = 0; col < noise.cols; ++col)
+					noise.at<int>(row, col) = static_cast<int>(state = state*1664525u + 1013904223u);
+
+			for(int variant = 0; variant < 4; ++variant)
+			{
+				CppFW::CVMatTreeStructBin::WriteOptions options;
+				options.codec    = CppFW::CVMatTreeBinCodec::Codec::Deflate;
+				options.index    = (variant & 1) != 0;
+				options.parallel = (variant & 2) != 0;
+				std::FILE* file = std::fopen("test_fd.bin", "wb");
+				BOOST_REQUIRE( file );
+				BOOST_CHECK( CppFW::CVMatTreeStructBin::writeBinFd(fileno(file), tree1, options) );
+				std::fclose(file);
+
+				std::stringstream sstream;
+				CppFW::CVMatTreeStructBin::writeBin(sstream, tree1, options);
+				std::ifstream written("test_fd.bin", std::ios::binary);
+				std::stringstream content;
+				content << written.rdbuf();
+				BOOST_CHECK( content.str() == sstream.str() );
+				BOOST_CHECK( CppFW::CVMatTreeStructBin::readBin("test_fd.bin") == tree1 );
+			}
+			BOOST_CHECK( CppFW::CVMatTreeStructBin::readNode("test_fd.bin", "noise") == tree1.getDirNode("noise") );
+		}
+
+		BOOST_CHECK( !CppFW::CVMatTreeStructBin::writeBinFd(-1, tree1) );
+		std::remove("test_fd.bin");
+#endif
+	}
+
+	BOOST_AUTO_TEST_CASE( CVMatTreeBin_corrupt_counts )
+	{
+		CppFW::CVMatTree list;
+		list.newListNode().getString() = "element";
+		CppFW::CVMatTree dir;
+		dir.getDirNode("name").getString() = "element";
+
+		for(const CppFW::CVMatTree* tree : { &list, &dir })
+		{
+			std::stringstream sstream;
+			CppFW::CVMatTreeStructBin::writeBin(sstream, *tree);
+			std::string file = sstream.str();
+			std::memset(&file[32], 0xff, sizeof(uint32_t));                 // count of the root node
+
+			std::istringstream corrupt(file);
+			CppFW::CVMatTree read = CppFW::CVMatTreeStructBin::readBin(corrupt);   // reading ends with the stream
+			BOOST_CHECK( read.type() == tree->type() );
+
+			CppFW::CVMatTree target;
+			std::istringstream corruptInto(file);
+			BOOST_CHECK( !CppFW::CVMatTreeStructBin::readBinInto(target, corruptInto) );
+		}
+	}
+
+	BOOST_AUTO_TEST_CASE( CVMatTreeBin_dir_order )
+	{
+		CppFW::CVMatTree tree1;
+		tree1.getDirNode("b").getString() = "second";
+		createMat<int16_t>(tree1.getDirNode("a").getMat(), 3, 2);
+
+		CppFW::CVMatTree tree2;
+		createMat<int16_t>(tree2.getDirNode("a").getMat(), 3, 2);
+		tree2.getDirNode("b").getString() = "second";
+
+		for(bool index : { false, true })
+		{
+			CppFW::CVMatTreeStructBin::WriteOptions options;
+			options.index = index;
+
+			std::stringstream sstream1;
+			std::stringstream sstream2;
+			CppFW::CVMatTreeStructBin::writeBin(sstream1, tree1, options);
+			CppFW::CVMatTreeStructBin::writeBin(sstream2, tree2, options);
+			BOOST_CHECK( sstream1.str() == sstream2.str() );
+
+			std::vector<char> buffer;
+			BOOST_CHECK( CppFW::CVMatTreeStructBin::writeBin(buffer, tree1, options) );
+			BOOST_CHECK( std::string(buffer.begin(), buffer.end()) == sstream1.str() );
+
+			options.insertionOrder = true;
+			std::stringstream sstream3;
+			CppFW::CVMatTreeStructBin::writeBin(sstream3, tree1, options);
+			BOOST_CHECK( sstream3.str() != sstream1.str() );
+			BOOST_CHECK( CppFW::CVMatTreeStructBin::writeBin(buffer, tree1, options) );
+			BOOST_CHECK( std::string(buffer.begin(), buffer.end()) == sstream3.str() );
+
+			sstream3.seekg(0);
+			CppFW::CVMatTree tree3 = CppFW::CVMatTreeStructBin::readBin(sstream3);
+			BOOST_CHECK( tree3 == tree2 );
+			BOOST_CHECK( tree3.getNodeDir().begin()->first == "b" );
+		}
+	}
+
 	BOOST_AUTO_TEST_CASE( CVMatTreeBin_save_more_complex_trees )
 	{
 